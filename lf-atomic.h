@@ -0,0 +1,85 @@
+/* lf-atomic.h
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LF_ATOMIC_H__
+#define __LF_ATOMIC_H__
+
+#include <glib.h>
+#include <stdatomic.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Atomic operations with an explicit memory order.
+ *
+ * The g_atomic_*() functions are full barriers on every access, which is far
+ * more than most of the accesses in a lock-free structure need.  These take
+ * one of the C11 memory_order constants from <stdatomic.h> instead.  They are
+ * built on the compiler's __atomic builtins rather than the <stdatomic.h>
+ * generics so that they work on the same plain fields g_atomic_*() is used
+ * on elsewhere; an _Atomic qualified field could no longer be handed to GLib.
+ *
+ * Compare-and-exchange uses the given order on success and relaxed on
+ * failure, since every caller here simply reloads and retries after failing.
+ * lf_atomic_add_fetch() takes an integer of any width and returns the sum.
+ */
+#define lf_atomic_load(p,o)        __atomic_load_n((p), (o))
+#define lf_atomic_store(p,v,o)     __atomic_store_n((p), (v), (o))
+#define lf_atomic_exchange(p,v,o)  __atomic_exchange_n((p), (v), (o))
+#define lf_atomic_add_fetch(p,v,o) __atomic_add_fetch((p), (v), (o))
+#define lf_atomic_fence(o)         atomic_thread_fence((o))
+
+static inline gboolean
+lf_atomic_pointer_cas(gpointer     atomic,
+                      gpointer     oldval,
+                      gpointer     newval,
+                      memory_order order)
+{
+	return __atomic_compare_exchange_n((gpointer *)atomic, &oldval, newval,
+	                                   FALSE, order, memory_order_relaxed);
+}
+
+static inline gboolean
+lf_atomic_int_cas(volatile gint *atomic,
+                  gint           oldval,
+                  gint           newval,
+                  memory_order   order)
+{
+	return __atomic_compare_exchange_n(atomic, &oldval, newval,
+	                                   FALSE, order, memory_order_relaxed);
+}
+
+/*
+ * Adds val to *atomic and returns the value it held before.
+ */
+static inline gint
+lf_atomic_int_add(volatile gint *atomic,
+                  gint           val,
+                  memory_order   order)
+{
+	return __atomic_fetch_add(atomic, val, order);
+}
+
+G_END_DECLS
+
+#endif /* __LF_ATOMIC_H__ */
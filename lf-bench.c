@@ -0,0 +1,1176 @@
+/* lf-bench.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Throughput and latency benchmarks for LfQueue and friends.
+ *
+ * Each run spawns a number of producer and consumer threads which move a
+ * fixed number of items through a queue implementation, and reports the
+ * overall throughput, per-call latency percentiles for both sides, and the
+ * number of heap allocations made per item moved.  Locking GLib queues are
+ * included as baselines so that changes can be compared against something
+ * other than themselves.
+ *
+ *   ./lf-bench --producers=4 --consumers=4 --burst=16 --format=json
+ *
+ * Thread pools are measured the same way, with the pool's workers standing
+ * in for consumers.  The enqueue latency is then the time taken to submit a
+ * task and the dequeue latency the time from submission until a worker
+ * starts running it.
+ *
+ *   ./lf-bench --impl=lfexecutor,gthreadpool --producers=2 --consumers=4
+ *
+ * Hazard pointer scans can be moved onto a background thread to compare the
+ * tail latencies with and without them on the dequeue path.
+ *
+ *   ./lf-bench --impl=lfqueue --reclaimer=65536
+ *
+ * LfPriorityQueue is not FIFO either, but is included so that its cost can
+ * be compared with the plain queues.  Keys are scrambled from the items.
+ *
+ *   ./lf-bench --impl=lfpriority,lfqueue
+ *
+ * The single-producer and single-consumer queues only accept as many
+ * threads on each side as they support.
+ *
+ *   ./lf-bench --impl=lfspsc,lfmpsc,lfqueue --producers=1 --consumers=1
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "lf-executor.h"
+#include "lf-hazard.h"
+#include "lf-mpsc-queue.h"
+#include "lf-priority-queue.h"
+#include "lf-queue.h"
+#include "lf-ring.h"
+#include "lf-sharded-queue.h"
+#include "lf-spsc-queue.h"
+#include "lf-stack.h"
+
+#define BENCH_RING_CAPACITY (65536)
+#define BENCH_DEFAULT_IMPLS "lfqueue,lfqueue-epoch,lfqueue-segment,lfring,"    \
+                            "gasyncqueue,gqueue"
+
+typedef struct _BenchImpl   BenchImpl;
+typedef struct _BenchPool   BenchPool;
+typedef struct _BenchTask   BenchTask;
+typedef struct _BenchThread BenchThread;
+typedef struct _BenchRun    BenchRun;
+typedef struct _BenchResult BenchResult;
+
+struct _BenchImpl {
+	const gchar *name;
+	gpointer   (*create)  (void);
+	void       (*destroy) (gpointer queue);
+	void       (*push)    (gpointer queue, gpointer *items, guint n_items);
+	guint      (*pop)     (gpointer queue, gpointer *items, guint max_items);
+	gint         max_producers;  /* 0 for no limit */
+	gint         max_consumers;  /* 0 for no limit */
+};
+
+struct _BenchPool {
+	const gchar *name;
+	gpointer   (*create)  (GFunc func, gpointer user_data, gint n_workers);
+	void       (*destroy) (gpointer pool);
+	void       (*push)    (gpointer pool, gpointer task);
+};
+
+/*
+ * A task submitted to a pool.  submitted is only set for sampled tasks, in
+ * which case the worker running it records its dispatch latency.
+ */
+struct _BenchTask {
+	guint64 submitted;
+};
+
+struct _BenchRun {
+	const BenchImpl *impl;
+	const BenchPool *pool;
+	gpointer         queue;
+	volatile gint    go;
+	volatile gint    n_ready;
+	volatile gint    n_producers_done;
+	gint             n_producers;
+	gint             n_consumers;
+	gint64           n_items;
+	guint            burst;
+	gboolean         alloc_payload;
+	gsize            payload_size;
+	guint            sample;
+	volatile gsize   n_done;
+	volatile gint    n_dispatched;
+	BenchThread     *dispatch;
+};
+
+struct _BenchThread {
+	BenchRun  *run;
+	GThread   *thread;
+	guint64   *latencies;
+	gsize      n_latencies;
+	gsize      max_latencies;
+	gint64     n_moved;
+	BenchTask *tasks;
+};
+
+struct _BenchResult {
+	gdouble seconds;
+	gdouble ops_per_sec;
+	guint64 enq[3];
+	guint64 deq[3];
+	gdouble allocs_per_op;
+};
+
+static gint     opt_producers    = 1;
+static gint     opt_consumers    = 1;
+static gint     opt_threads      = 0;
+static gchar   *opt_ratio        = NULL;
+static gint64   opt_items        = 1000000;
+static gint     opt_burst        = 1;
+static gchar   *opt_payload      = NULL;
+static gint     opt_payload_size = 64;
+static gint     opt_sample       = 8;
+static gchar   *opt_impls        = NULL;
+static gchar   *opt_format       = NULL;
+static gint     opt_reclaimer    = -1;
+
+static GOptionEntry entries[] = {
+	{ "producers", 'p', 0, G_OPTION_ARG_INT, &opt_producers,
+	  "Number of producer threads", "N" },
+	{ "consumers", 'c', 0, G_OPTION_ARG_INT, &opt_consumers,
+	  "Number of consumer threads", "N" },
+	{ "threads", 't', 0, G_OPTION_ARG_INT, &opt_threads,
+	  "Total threads, split according to --ratio", "N" },
+	{ "ratio", 'r', 0, G_OPTION_ARG_STRING, &opt_ratio,
+	  "Producer to consumer ratio used with --threads", "P:C" },
+	{ "items", 'n', 0, G_OPTION_ARG_INT64, &opt_items,
+	  "Number of items each producer enqueues", "N" },
+	{ "burst", 'b', 0, G_OPTION_ARG_INT, &opt_burst,
+	  "Items moved per enqueue or dequeue call, ignored by pools", "N" },
+	{ "payload", 0, 0, G_OPTION_ARG_STRING, &opt_payload,
+	  "Payload pattern, \"int\" or \"alloc\"", "PATTERN" },
+	{ "payload-size", 0, 0, G_OPTION_ARG_INT, &opt_payload_size,
+	  "Bytes per payload with --payload=alloc", "BYTES" },
+	{ "sample", 's', 0, G_OPTION_ARG_INT, &opt_sample,
+	  "Time one in every N calls", "N" },
+	{ "impl", 'i', 0, G_OPTION_ARG_STRING, &opt_impls,
+	  "Comma separated implementations to run", "NAMES" },
+	{ "format", 'f', 0, G_OPTION_ARG_STRING, &opt_format,
+	  "Output format, \"csv\" or \"json\"", "FORMAT" },
+	{ "reclaimer", 0, 0, G_OPTION_ARG_INT, &opt_reclaimer,
+	  "Reclaim hazard pointers on a background thread, letting up to N "
+	  "queue up", "N" },
+	{ NULL }
+};
+
+/*
+ * Allocation counting.  On glibc we interpose the allocator entry points so
+ * that every allocation is seen, whether it comes from g_malloc(), the slice
+ * allocator or posix_memalign().  Counting is only switched on while a run
+ * is being timed.
+ */
+static volatile gint  counting = FALSE;
+static volatile gsize n_allocs = 0;
+
+#ifdef __GLIBC__
+extern gpointer __libc_malloc   (gsize size);
+extern gpointer __libc_calloc   (gsize n, gsize size);
+extern gpointer __libc_realloc  (gpointer mem, gsize size);
+extern gpointer __libc_memalign (gsize alignment, gsize size);
+
+#define COUNT_ALLOC() G_STMT_START {                                 \
+    if (G_UNLIKELY(counting))                                        \
+        g_atomic_pointer_add(&n_allocs, 1);                          \
+} G_STMT_END
+
+gpointer
+malloc(gsize size)
+{
+	COUNT_ALLOC();
+	return __libc_malloc(size);
+}
+
+gpointer
+calloc(gsize n,
+       gsize size)
+{
+	COUNT_ALLOC();
+	return __libc_calloc(n, size);
+}
+
+gpointer
+realloc(gpointer mem,
+        gsize    size)
+{
+	COUNT_ALLOC();
+	return __libc_realloc(mem, size);
+}
+
+gint
+posix_memalign(gpointer *mem,
+               gsize     alignment,
+               gsize     size)
+{
+	COUNT_ALLOC();
+	*mem = __libc_memalign(alignment, size);
+	return *mem ? 0 : ENOMEM;
+}
+
+#define ALLOCS_COUNTED TRUE
+#else
+#define ALLOCS_COUNTED FALSE
+#endif /* __GLIBC__ */
+
+static inline guint64
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * LfQueue, with either hazard pointer or epoch based reclaimation, and the
+ * segment engine.
+ */
+static gpointer
+lfqueue_create(void)
+{
+	return lf_queue_new_full(LF_QUEUE_RECLAIM_HAZARD);
+}
+
+static gpointer
+lfqueue_epoch_create(void)
+{
+	return lf_queue_new_full(LF_QUEUE_RECLAIM_EPOCH);
+}
+
+static gpointer
+lfqueue_segment_create(void)
+{
+	return lf_queue_new_with_engine(LF_QUEUE_ENGINE_SEGMENT,
+	                                LF_QUEUE_RECLAIM_HAZARD);
+}
+
+static void
+lfqueue_push(gpointer  queue,
+             gpointer *items,
+             guint     n_items)
+{
+	if (n_items == 1)
+		lf_queue_enqueue(queue, items[0]);
+	else
+		lf_queue_enqueue_many(queue, items, n_items);
+}
+
+static guint
+lfqueue_pop(gpointer  queue,
+            gpointer *items,
+            guint     max_items)
+{
+	if (max_items == 1)
+		return (items[0] = lf_queue_dequeue(queue)) ? 1 : 0;
+	return lf_queue_dequeue_many(queue, items, max_items);
+}
+
+/*
+ * LfShardedQueue with a lane per CPU.  Only FIFO within a lane.
+ */
+static gpointer
+lfsharded_create(void)
+{
+	return lf_sharded_queue_new(0, LF_SHARDED_QUEUE_NONE);
+}
+
+static void
+lfsharded_push(gpointer  queue,
+               gpointer *items,
+               guint     n_items)
+{
+	guint i;
+
+	for (i = 0; i < n_items; i++)
+		lf_sharded_queue_enqueue(queue, items[i]);
+}
+
+static guint
+lfsharded_pop(gpointer  queue,
+              gpointer *items,
+              guint     max_items)
+{
+	guint i;
+
+	for (i = 0; i < max_items; i++) {
+		if (!(items[i] = lf_sharded_queue_dequeue(queue)))
+			break;
+	}
+	return i;
+}
+
+/*
+ * LfStack.  Not FIFO, but it moves items between threads all the same.
+ */
+static gpointer
+lfstack_create(void)
+{
+	return lf_stack_new();
+}
+
+static void
+lfstack_push(gpointer  stack,
+             gpointer *items,
+             guint     n_items)
+{
+	guint i;
+
+	for (i = 0; i < n_items; i++)
+		lf_stack_push(stack, items[i]);
+}
+
+static guint
+lfstack_pop(gpointer  stack,
+            gpointer *items,
+            guint     max_items)
+{
+	guint i;
+
+	for (i = 0; i < max_items; i++) {
+		if (!(items[i] = lf_stack_pop(stack)))
+			break;
+	}
+	return i;
+}
+
+/*
+ * LfRing.  The ring is bounded, so producers back off while it is full.
+ */
+static gpointer
+lfring_create(void)
+{
+	return lf_ring_new(BENCH_RING_CAPACITY);
+}
+
+static void
+lfring_push(gpointer  queue,
+            gpointer *items,
+            guint     n_items)
+{
+	guint i;
+
+	for (i = 0; i < n_items; i++) {
+		while (!lf_ring_enqueue(queue, items[i]))
+			g_thread_yield();
+	}
+}
+
+static guint
+lfring_pop(gpointer  queue,
+           gpointer *items,
+           guint     max_items)
+{
+	guint i;
+
+	for (i = 0; i < max_items; i++) {
+		if (!(items[i] = lf_ring_dequeue(queue)))
+			break;
+	}
+	return i;
+}
+
+/*
+ * LfSpscQueue.  Like LfRing it is bounded, so the producer backs off while
+ * it is full.
+ */
+static gpointer
+lfspsc_create(void)
+{
+	return lf_spsc_queue_new(BENCH_RING_CAPACITY);
+}
+
+static void
+lfspsc_push(gpointer  queue,
+            gpointer *items,
+            guint     n_items)
+{
+	guint n;
+
+	while (n_items) {
+		if (!(n = lf_spsc_queue_enqueue_many(queue, items, n_items)))
+			g_thread_yield();
+		items += n;
+		n_items -= n;
+	}
+}
+
+static guint
+lfspsc_pop(gpointer  queue,
+           gpointer *items,
+           guint     max_items)
+{
+	return lf_spsc_queue_dequeue_many(queue, items, max_items);
+}
+
+/*
+ * LfMpscQueue.
+ */
+static gpointer
+lfmpsc_create(void)
+{
+	return lf_mpsc_queue_new();
+}
+
+static void
+lfmpsc_push(gpointer  queue,
+            gpointer *items,
+            guint     n_items)
+{
+	if (n_items == 1)
+		lf_mpsc_queue_enqueue(queue, items[0]);
+	else
+		lf_mpsc_queue_enqueue_many(queue, items, n_items);
+}
+
+static guint
+lfmpsc_pop(gpointer  queue,
+           gpointer *items,
+           guint     max_items)
+{
+	return lf_mpsc_queue_dequeue_many(queue, items, max_items);
+}
+
+/*
+ * LfPriorityQueue.  Items are inserted with a key scrambled from the item
+ * itself so that consecutive pushes do not all land at the same end.
+ */
+static gpointer
+lfpriority_create(void)
+{
+	return lf_priority_queue_new();
+}
+
+static void
+lfpriority_push(gpointer  queue,
+                gpointer *items,
+                guint     n_items)
+{
+	gint64 key;
+	guint i;
+
+	for (i = 0; i < n_items; i++) {
+		key = (GPOINTER_TO_SIZE(items[i]) * G_GUINT64_CONSTANT(2654435761))
+		      & G_MAXINT32;
+		lf_priority_queue_insert(queue, key, items[i]);
+	}
+}
+
+static guint
+lfpriority_pop(gpointer  queue,
+               gpointer *items,
+               guint     max_items)
+{
+	guint i;
+
+	for (i = 0; i < max_items; i++) {
+		if (!(items[i] = lf_priority_queue_delete_min(queue, NULL)))
+			break;
+	}
+	return i;
+}
+
+/*
+ * GAsyncQueue.
+ */
+static gpointer
+gasyncqueue_create(void)
+{
+	return g_async_queue_new();
+}
+
+static void
+gasyncqueue_push(gpointer  queue,
+                 gpointer *items,
+                 guint     n_items)
+{
+	guint i;
+
+	for (i = 0; i < n_items; i++)
+		g_async_queue_push(queue, items[i]);
+}
+
+static guint
+gasyncqueue_pop(gpointer  queue,
+                gpointer *items,
+                guint     max_items)
+{
+	guint i;
+
+	for (i = 0; i < max_items; i++) {
+		if (!(items[i] = g_async_queue_try_pop(queue)))
+			break;
+	}
+	return i;
+}
+
+/*
+ * GQueue protected by a GMutex.  Bursts are moved under a single lock.
+ */
+typedef struct {
+	GMutex *mutex;
+	GQueue *queue;
+} MutexQueue;
+
+static gpointer
+gqueue_create(void)
+{
+	MutexQueue *mq;
+
+	mq = g_new0(MutexQueue, 1);
+	mq->mutex = g_mutex_new();
+	mq->queue = g_queue_new();
+
+	return mq;
+}
+
+static void
+gqueue_destroy(gpointer queue)
+{
+	MutexQueue *mq = queue;
+
+	g_queue_free(mq->queue);
+	g_mutex_free(mq->mutex);
+	g_free(mq);
+}
+
+static void
+gqueue_push(gpointer  queue,
+            gpointer *items,
+            guint     n_items)
+{
+	MutexQueue *mq = queue;
+	guint i;
+
+	g_mutex_lock(mq->mutex);
+	for (i = 0; i < n_items; i++)
+		g_queue_push_tail(mq->queue, items[i]);
+	g_mutex_unlock(mq->mutex);
+}
+
+static guint
+gqueue_pop(gpointer  queue,
+           gpointer *items,
+           guint     max_items)
+{
+	MutexQueue *mq = queue;
+	guint i;
+
+	g_mutex_lock(mq->mutex);
+	for (i = 0; i < max_items; i++) {
+		if (!(items[i] = g_queue_pop_head(mq->queue)))
+			break;
+	}
+	g_mutex_unlock(mq->mutex);
+	return i;
+}
+
+static const BenchImpl impls[] = {
+	{ "lfqueue", lfqueue_create, (GDestroyNotify)lf_queue_unref,
+	  lfqueue_push, lfqueue_pop },
+	{ "lfqueue-epoch", lfqueue_epoch_create, (GDestroyNotify)lf_queue_unref,
+	  lfqueue_push, lfqueue_pop },
+	{ "lfqueue-segment", lfqueue_segment_create,
+	  (GDestroyNotify)lf_queue_unref, lfqueue_push, lfqueue_pop },
+	{ "lfsharded", lfsharded_create, (GDestroyNotify)lf_sharded_queue_unref,
+	  lfsharded_push, lfsharded_pop },
+	{ "lfstack", lfstack_create, (GDestroyNotify)lf_stack_unref,
+	  lfstack_push, lfstack_pop },
+	{ "lfring", lfring_create, (GDestroyNotify)lf_ring_unref,
+	  lfring_push, lfring_pop },
+	{ "lfspsc", lfspsc_create, (GDestroyNotify)lf_spsc_queue_unref,
+	  lfspsc_push, lfspsc_pop, 1, 1 },
+	{ "lfmpsc", lfmpsc_create, (GDestroyNotify)lf_mpsc_queue_unref,
+	  lfmpsc_push, lfmpsc_pop, 0, 1 },
+	{ "lfpriority", lfpriority_create,
+	  (GDestroyNotify)lf_priority_queue_unref, lfpriority_push, lfpriority_pop },
+	{ "gasyncqueue", gasyncqueue_create, (GDestroyNotify)g_async_queue_unref,
+	  gasyncqueue_push, gasyncqueue_pop },
+	{ "gqueue", gqueue_create, gqueue_destroy,
+	  gqueue_push, gqueue_pop },
+};
+
+/*
+ * LfExecutor.
+ */
+static gpointer
+lfexecutor_create(GFunc    func,
+                  gpointer user_data,
+                  gint     n_workers)
+{
+	return lf_executor_new(func, user_data, n_workers);
+}
+
+static void
+lfexecutor_destroy(gpointer pool)
+{
+	lf_executor_free(pool);
+}
+
+static void
+lfexecutor_push(gpointer pool,
+                gpointer task)
+{
+	lf_executor_push(pool, task);
+}
+
+/*
+ * GThreadPool.
+ */
+static gpointer
+gthreadpool_create(GFunc    func,
+                   gpointer user_data,
+                   gint     n_workers)
+{
+	return g_thread_pool_new(func, user_data, n_workers, TRUE, NULL);
+}
+
+static void
+gthreadpool_destroy(gpointer pool)
+{
+	g_thread_pool_free(pool, FALSE, TRUE);
+}
+
+static void
+gthreadpool_push(gpointer pool,
+                 gpointer task)
+{
+	g_thread_pool_push(pool, task, NULL);
+}
+
+static const BenchPool pools[] = {
+	{ "lfexecutor", lfexecutor_create, lfexecutor_destroy, lfexecutor_push },
+	{ "gthreadpool", gthreadpool_create, gthreadpool_destroy,
+	  gthreadpool_push },
+};
+
+static inline void
+bench_thread_record(BenchThread *bt,
+                    guint64      latency)
+{
+	if (bt->n_latencies < bt->max_latencies)
+		bt->latencies[bt->n_latencies++] = latency;
+}
+
+static void
+bench_thread_start(BenchThread *bt)
+{
+	g_atomic_int_inc(&bt->run->n_ready);
+	while (!g_atomic_int_get(&bt->run->go))
+		g_thread_yield();
+}
+
+static gpointer
+bench_producer(gpointer data)
+{
+	BenchThread *bt = data;
+	BenchRun *run = bt->run;
+	gpointer *items;
+	guint64 begin;
+	gint64 produced = 0;
+	guint n, i, calls = 0;
+
+	items = g_new(gpointer, run->burst);
+	bench_thread_start(bt);
+
+	while (produced < run->n_items) {
+		n = MIN(run->burst, run->n_items - produced);
+		for (i = 0; i < n; i++) {
+			if (run->alloc_payload) {
+				items[i] = g_malloc(run->payload_size);
+				*(gint64 *)items[i] = produced + i + 1;
+			} else {
+				items[i] = GSIZE_TO_POINTER(produced + i + 1);
+			}
+		}
+		if (calls++ % run->sample == 0) {
+			begin = now_ns();
+			run->impl->push(run->queue, items, n);
+			bench_thread_record(bt, now_ns() - begin);
+		} else {
+			run->impl->push(run->queue, items, n);
+		}
+		produced += n;
+	}
+
+	bt->n_moved = produced;
+	g_atomic_int_inc(&run->n_producers_done);
+	g_free(items);
+
+	return NULL;
+}
+
+static gpointer
+bench_consumer(gpointer data)
+{
+	BenchThread *bt = data;
+	BenchRun *run = bt->run;
+	gpointer *items;
+	guint64 begin;
+	gboolean done;
+	guint n, i, calls = 0;
+
+	items = g_new(gpointer, run->burst);
+	bench_thread_start(bt);
+
+	while (TRUE) {
+		/*
+		 * Check for completion before popping, so that an empty pop after
+		 * every producer finished really means the queue is drained.
+		 */
+		done = (g_atomic_int_get(&run->n_producers_done) == run->n_producers);
+		if (calls++ % run->sample == 0) {
+			begin = now_ns();
+			n = run->impl->pop(run->queue, items, run->burst);
+			if (n)
+				bench_thread_record(bt, now_ns() - begin);
+		} else {
+			n = run->impl->pop(run->queue, items, run->burst);
+		}
+		if (!n) {
+			if (done)
+				break;
+			g_thread_yield();
+			continue;
+		}
+		if (run->alloc_payload) {
+			for (i = 0; i < n; i++) {
+				g_assert(*(gint64 *)items[i] > 0);
+				g_free(items[i]);
+			}
+		}
+		bt->n_moved += n;
+	}
+
+	g_free(items);
+
+	return NULL;
+}
+
+static gpointer
+bench_pool_producer(gpointer data)
+{
+	BenchThread *bt = data;
+	BenchRun *run = bt->run;
+	BenchTask *tasks = bt->tasks;
+	guint64 begin;
+	gint64 i;
+
+	bench_thread_start(bt);
+
+	for (i = 0; i < run->n_items; i++) {
+		if (i % run->sample == 0) {
+			begin = tasks[i].submitted = now_ns();
+			run->pool->push(run->queue, &tasks[i]);
+			bench_thread_record(bt, now_ns() - begin);
+		} else {
+			run->pool->push(run->queue, &tasks[i]);
+		}
+	}
+
+	bt->n_moved = run->n_items;
+	g_atomic_int_inc(&run->n_producers_done);
+
+	return NULL;
+}
+
+static void
+bench_pool_task(gpointer data,
+                gpointer user_data)
+{
+	BenchTask *task = data;
+	BenchRun *run = user_data;
+	guint64 now;
+	gint idx;
+
+	if (task->submitted) {
+		now = now_ns();
+		idx = g_atomic_int_exchange_and_add(&run->n_dispatched, 1);
+		if (idx < run->dispatch->max_latencies)
+			run->dispatch->latencies[idx] = now - task->submitted;
+	}
+	g_atomic_pointer_add(&run->n_done, 1);
+}
+
+static gint
+compare_guint64(gconstpointer a,
+                gconstpointer b)
+{
+	guint64 ua = *(const guint64 *)a;
+	guint64 ub = *(const guint64 *)b;
+
+	return (ua < ub) ? -1 : (ua > ub);
+}
+
+/*
+ * Merges the latency samples from a set of threads and stores the 50th, 99th
+ * and 99.9th percentiles in percentiles.
+ */
+static void
+bench_percentiles(BenchThread *threads,
+                  gint         n_threads,
+                  guint64     *percentiles)
+{
+	static const gdouble ranks[] = { 0.5, 0.99, 0.999 };
+	guint64 *all;
+	gsize n = 0;
+	gint i;
+
+	for (i = 0; i < n_threads; i++)
+		n += threads[i].n_latencies;
+
+	if (n == 0) {
+		memset(percentiles, 0, sizeof(guint64) * G_N_ELEMENTS(ranks));
+		return;
+	}
+
+	all = g_new(guint64, n);
+	for (n = 0, i = 0; i < n_threads; i++) {
+		memcpy(all + n, threads[i].latencies,
+		       sizeof(guint64) * threads[i].n_latencies);
+		n += threads[i].n_latencies;
+	}
+	qsort(all, n, sizeof(guint64), compare_guint64);
+
+	for (i = 0; i < G_N_ELEMENTS(ranks); i++)
+		percentiles[i] = all[MIN((gsize)(ranks[i] * n), n - 1)];
+
+	g_free(all);
+}
+
+static void
+bench_run(const BenchImpl *impl,
+          BenchResult     *result)
+{
+	BenchRun run = { 0 };
+	BenchThread *producers, *consumers;
+	guint64 begin, end;
+	gint64 moved = 0;
+	gsize allocs;
+	gint i;
+
+	run.impl = impl;
+	run.queue = impl->create();
+	run.n_producers = opt_producers;
+	run.n_consumers = opt_consumers;
+	run.n_items = opt_items;
+	run.burst = opt_burst;
+	run.alloc_payload = (g_strcmp0(opt_payload, "alloc") == 0);
+	run.payload_size = MAX(opt_payload_size, sizeof(gint64));
+	run.sample = opt_sample;
+
+	producers = g_new0(BenchThread, run.n_producers);
+	consumers = g_new0(BenchThread, run.n_consumers);
+
+	for (i = 0; i < run.n_producers; i++) {
+		producers[i].run = &run;
+		producers[i].max_latencies = run.n_items / run.burst / run.sample + 1;
+		producers[i].latencies = g_new(guint64, producers[i].max_latencies);
+		producers[i].thread = g_thread_create(bench_producer, &producers[i],
+		                                      TRUE, NULL);
+	}
+	for (i = 0; i < run.n_consumers; i++) {
+		consumers[i].run = &run;
+		consumers[i].max_latencies = producers[0].max_latencies * run.n_producers;
+		consumers[i].latencies = g_new(guint64, consumers[i].max_latencies);
+		consumers[i].thread = g_thread_create(bench_consumer, &consumers[i],
+		                                      TRUE, NULL);
+	}
+
+	while (g_atomic_int_get(&run.n_ready) < run.n_producers + run.n_consumers)
+		g_thread_yield();
+
+	n_allocs = 0;
+	g_atomic_int_set(&counting, TRUE);
+	begin = now_ns();
+	g_atomic_int_set(&run.go, TRUE);
+
+	for (i = 0; i < run.n_producers; i++)
+		g_thread_join(producers[i].thread);
+	for (i = 0; i < run.n_consumers; i++) {
+		g_thread_join(consumers[i].thread);
+		moved += consumers[i].n_moved;
+	}
+
+	end = now_ns();
+	g_atomic_int_set(&counting, FALSE);
+	allocs = n_allocs;
+
+	g_assert_cmpint(moved, ==, run.n_items * run.n_producers);
+
+	result->seconds = (end - begin) / 1e9;
+	result->ops_per_sec = moved / result->seconds;
+	result->allocs_per_op = ALLOCS_COUNTED ? (gdouble)allocs / moved : -1;
+	bench_percentiles(producers, run.n_producers, result->enq);
+	bench_percentiles(consumers, run.n_consumers, result->deq);
+
+	for (i = 0; i < run.n_producers; i++)
+		g_free(producers[i].latencies);
+	for (i = 0; i < run.n_consumers; i++)
+		g_free(consumers[i].latencies);
+	g_free(producers);
+	g_free(consumers);
+
+	impl->destroy(run.queue);
+}
+
+/*
+ * Runs the producers against a thread pool with opt_consumers workers.  The
+ * clock stops once the last task has run, rather than when the pool has
+ * been torn down, so that both pools are timed on the same work.
+ */
+static void
+bench_pool_run(const BenchPool *pool,
+               BenchResult     *result)
+{
+	BenchRun run = { 0 };
+	BenchThread *producers, dispatch = { 0 };
+	guint64 begin, end;
+	gint64 total;
+	gsize allocs;
+	gint i;
+
+	run.pool = pool;
+	run.n_producers = opt_producers;
+	run.n_consumers = opt_consumers;
+	run.n_items = opt_items;
+	run.sample = opt_sample;
+	run.dispatch = &dispatch;
+	run.queue = pool->create(bench_pool_task, &run, run.n_consumers);
+	total = run.n_items * run.n_producers;
+
+	producers = g_new0(BenchThread, run.n_producers);
+	for (i = 0; i < run.n_producers; i++) {
+		producers[i].run = &run;
+		producers[i].max_latencies = run.n_items / run.sample + 1;
+		producers[i].latencies = g_new(guint64, producers[i].max_latencies);
+		producers[i].tasks = g_new0(BenchTask, run.n_items);
+		producers[i].thread = g_thread_create(bench_pool_producer,
+		                                      &producers[i], TRUE, NULL);
+	}
+	dispatch.max_latencies = producers[0].max_latencies * run.n_producers;
+	dispatch.latencies = g_new(guint64, dispatch.max_latencies);
+
+	while (g_atomic_int_get(&run.n_ready) < run.n_producers)
+		g_thread_yield();
+
+	n_allocs = 0;
+	g_atomic_int_set(&counting, TRUE);
+	begin = now_ns();
+	g_atomic_int_set(&run.go, TRUE);
+
+	for (i = 0; i < run.n_producers; i++)
+		g_thread_join(producers[i].thread);
+	while ((gsize)g_atomic_pointer_get(&run.n_done) < (gsize)total)
+		g_thread_yield();
+
+	end = now_ns();
+	g_atomic_int_set(&counting, FALSE);
+	allocs = n_allocs;
+
+	pool->destroy(run.queue);
+	dispatch.n_latencies = MIN(run.n_dispatched, dispatch.max_latencies);
+
+	result->seconds = (end - begin) / 1e9;
+	result->ops_per_sec = total / result->seconds;
+	result->allocs_per_op = ALLOCS_COUNTED ? (gdouble)allocs / total : -1;
+	bench_percentiles(producers, run.n_producers, result->enq);
+	bench_percentiles(&dispatch, 1, result->deq);
+
+	for (i = 0; i < run.n_producers; i++) {
+		g_free(producers[i].latencies);
+		g_free(producers[i].tasks);
+	}
+	g_free(producers);
+	g_free(dispatch.latencies);
+}
+
+static void
+bench_print(const gchar       *name,
+            const BenchResult *result,
+            gboolean           json,
+            gboolean           first)
+{
+	const gchar *payload = opt_payload ? opt_payload : "int";
+
+	if (json) {
+		g_print("%s  {\"impl\": \"%s\", \"producers\": %d, "
+		        "\"consumers\": %d, \"burst\": %d, "
+		        "\"payload\": \"%s\", \"items\": %" G_GINT64_FORMAT ", "
+		        "\"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+		        "\"enq_ns\": {\"p50\": %" G_GUINT64_FORMAT ", "
+		        "\"p99\": %" G_GUINT64_FORMAT ", "
+		        "\"p99.9\": %" G_GUINT64_FORMAT "}, "
+		        "\"deq_ns\": {\"p50\": %" G_GUINT64_FORMAT ", "
+		        "\"p99\": %" G_GUINT64_FORMAT ", "
+		        "\"p99.9\": %" G_GUINT64_FORMAT "}, "
+		        "\"allocs_per_op\": ",
+		        first ? "" : ",\n", name, opt_producers, opt_consumers,
+		        opt_burst, payload, opt_items * opt_producers,
+		        result->seconds, result->ops_per_sec,
+		        result->enq[0], result->enq[1], result->enq[2],
+		        result->deq[0], result->deq[1], result->deq[2]);
+		if (result->allocs_per_op < 0)
+			g_print("null}");
+		else
+			g_print("%.4f}", result->allocs_per_op);
+	} else {
+		if (first)
+			g_print("impl,producers,consumers,burst,payload,items,seconds,"
+			        "ops_per_sec,enq_p50_ns,enq_p99_ns,enq_p999_ns,"
+			        "deq_p50_ns,deq_p99_ns,deq_p999_ns,allocs_per_op\n");
+		g_print("%s,%d,%d,%d,%s,%" G_GINT64_FORMAT ",%.6f,%.0f,"
+		        "%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ","
+		        "%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",",
+		        name, opt_producers, opt_consumers, opt_burst, payload,
+		        opt_items * opt_producers, result->seconds, result->ops_per_sec,
+		        result->enq[0], result->enq[1], result->enq[2],
+		        result->deq[0], result->deq[1], result->deq[2]);
+		if (result->allocs_per_op < 0)
+			g_print("\n");
+		else
+			g_print("%.4f\n", result->allocs_per_op);
+	}
+}
+
+static gboolean
+bench_parse_ratio(void)
+{
+	gint p, c;
+
+	if (opt_threads <= 0)
+		return TRUE;
+	if (!opt_ratio)
+		p = c = 1;
+	else if (sscanf(opt_ratio, "%d:%d", &p, &c) != 2 || p <= 0 || c <= 0)
+		return FALSE;
+	if (opt_threads < 2)
+		return FALSE;
+
+	opt_producers = CLAMP(opt_threads * p / (p + c), 1, opt_threads - 1);
+	opt_consumers = opt_threads - opt_producers;
+
+	return TRUE;
+}
+
+gint
+main(gint   argc,
+     gchar *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	BenchResult result;
+	gchar **names;
+	gboolean json, first = TRUE;
+	gint i, j, k;
+
+	g_thread_init(NULL);
+
+	context = g_option_context_new("- benchmark lock-free queues");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(context);
+
+	if (!bench_parse_ratio()) {
+		g_printerr("Invalid --threads or --ratio\n");
+		return EXIT_FAILURE;
+	}
+	if (opt_producers < 1 || opt_consumers < 1 || opt_items < 1 ||
+	    opt_burst < 1 || opt_sample < 1) {
+		g_printerr("Thread, item, burst and sample counts must be positive\n");
+		return EXIT_FAILURE;
+	}
+	if (opt_payload && g_strcmp0(opt_payload, "int") != 0 &&
+	    g_strcmp0(opt_payload, "alloc") != 0) {
+		g_printerr("Unknown payload pattern \"%s\"\n", opt_payload);
+		return EXIT_FAILURE;
+	}
+
+	if (opt_reclaimer >= 0)
+		lf_hazard_domain_start_reclaimer(lf_hazard_domain_get_default(),
+		                                 opt_reclaimer);
+
+	json = (g_strcmp0(opt_format, "json") == 0);
+	names = g_strsplit(opt_impls ? opt_impls : BENCH_DEFAULT_IMPLS, ",", -1);
+
+	if (json)
+		g_print("[\n");
+	for (i = 0; names[i]; i++) {
+		for (j = 0; j < G_N_ELEMENTS(impls); j++) {
+			if (g_strcmp0(names[i], impls[j].name) == 0)
+				break;
+		}
+		for (k = 0; k < G_N_ELEMENTS(pools); k++) {
+			if (g_strcmp0(names[i], pools[k].name) == 0)
+				break;
+		}
+		if (j < G_N_ELEMENTS(impls)) {
+			if (impls[j].max_producers &&
+			    opt_producers > impls[j].max_producers) {
+				g_printerr("\"%s\" supports at most %d producer(s)\n",
+				           names[i], impls[j].max_producers);
+				return EXIT_FAILURE;
+			}
+			if (impls[j].max_consumers &&
+			    opt_consumers > impls[j].max_consumers) {
+				g_printerr("\"%s\" supports at most %d consumer(s)\n",
+				           names[i], impls[j].max_consumers);
+				return EXIT_FAILURE;
+			}
+			bench_run(&impls[j], &result);
+		} else if (k < G_N_ELEMENTS(pools)) {
+			bench_pool_run(&pools[k], &result);
+		} else {
+			g_printerr("Unknown implementation \"%s\"\n", names[i]);
+			return EXIT_FAILURE;
+		}
+		bench_print(names[i], &result, json, first);
+		first = FALSE;
+	}
+	if (json)
+		g_print("\n]\n");
+
+	g_strfreev(names);
+	if (opt_reclaimer >= 0)
+		lf_hazard_domain_stop_reclaimer(lf_hazard_domain_get_default());
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,475 @@
+/* lf-delay-queue.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "lf-atomic.h"
+#include "lf-delay-queue.h"
+#include "lf-queue.h"
+
+/**
+ * @LF_DELAY_QUEUE_RESOLUTION: The default length of a tick in microseconds.
+ */
+#define LF_DELAY_QUEUE_RESOLUTION (1000)
+
+/**
+ * @LF_DELAY_QUEUE_BITS: The base two logarithm of the number of slots in
+ *                       each level of the wheel.
+ */
+#define LF_DELAY_QUEUE_BITS (6)
+#define LF_DELAY_QUEUE_SLOTS (1 << LF_DELAY_QUEUE_BITS)
+#define LF_DELAY_QUEUE_MASK (LF_DELAY_QUEUE_SLOTS - 1)
+
+/**
+ * @LF_DELAY_QUEUE_LEVELS: The number of levels in the wheel.  Each level's
+ *                         slots span as many ticks as the whole level below,
+ *                         so the wheel covers SLOTS ^ LEVELS ticks, a little
+ *                         over four and a half hours at the default
+ *                         resolution.  Items due later wait in the top
+ *                         level and are placed again each time it turns.
+ */
+#define LF_DELAY_QUEUE_LEVELS (4)
+
+/**
+ * @LF_DELAY_QUEUE_BATCH: The number of due items collected before they are
+ *                        moved to the ready queue at once.
+ */
+#define LF_DELAY_QUEUE_BATCH (64)
+
+typedef struct _LfDelayNode  LfDelayNode;
+typedef struct _LfDelayBatch LfDelayBatch;
+
+struct _LfDelayNode {
+	LfDelayNode *next;
+	gpointer     data;
+	gint64       tick;
+};
+
+struct _LfDelayBatch {
+	gpointer items[LF_DELAY_QUEUE_BATCH];
+	guint    n_items;
+};
+
+/*
+ * A hierarchical timing wheel.  Each slot is a stack of nodes which producers
+ * push onto with a single CAS, and which the wheel empties all at once with
+ * an exchange, so no node is ever popped on its own and the stacks have no
+ * ABA problem.  Nothing but the thread turning the wheel ever follows a
+ * node's next pointer, so it frees nodes as soon as it has moved their items
+ * on, without hazard pointers.
+ *
+ * tick is the last tick the wheel has turned to.  An item is placed in level
+ * 0 if it is due within tick's lap of that level, otherwise in the lowest
+ * level whose lap it falls in.  When the wheel turns onto a tick, the level
+ * 0 slot of the tick and the slots of the higher levels that start there
+ * are emptied and their nodes placed again, which drops them a level or
+ * more.  Items that are due go to ready, an LfQueue from which consumers
+ * take them, so a dequeue never sees an item that is not due.  Only one
+ * thread turns the wheel at a time, guarded by busy.
+ *
+ * A producer places its node by the tick it read, so if the wheel turned in
+ * the meantime the node may have landed in a slot that was already emptied,
+ * where it would sit until the next lap.  The producer reads tick again
+ * after pushing and, if it moved, sets rescan.  The wheel then empties and
+ * places again every slot on its next turn.  The push and the rescan check
+ * are sequentially consistent, as are the wheel's store to tick and its
+ * exchanges, so either the wheel sees the node or the producer sees the new
+ * tick.
+ */
+struct _LfDelayQueue {
+	LfDelayNode    *slots[LF_DELAY_QUEUE_LEVELS][LF_DELAY_QUEUE_SLOTS];
+	volatile gint64 tick;
+	gint64          resolution;
+	volatile gint   busy;
+	volatile gint   rescan;
+	LfQueue        *ready;
+	volatile gint   ref_count;
+};
+
+/*
+ * Converts a deadline to the first tick at or after it, so an item is never
+ * considered due before its deadline.
+ */
+static inline gint64
+lf_delay_queue_tick(LfDelayQueue *queue,
+                    gint64        deadline)
+{
+	if (deadline <= 0)
+		return 0;
+	return (deadline + queue->resolution - 1) / queue->resolution;
+}
+
+/*
+ * Finds the slot for an item due at tick when the wheel is at current, which
+ * must be earlier.  The lower levels take an item due within the lap of the
+ * level they are in, the top level any item due within a lap of its own
+ * slot, since nothing above it could take one across the boundary of its
+ * lap.  Items due later still go in the top level slot that comes round
+ * last.
+ */
+static inline LfDelayNode**
+lf_delay_queue_slot(LfDelayQueue *queue,
+                    gint64        current,
+                    gint64        tick)
+{
+	gint level, shift;
+
+	for (level = 0; level < LF_DELAY_QUEUE_LEVELS - 1; level++) {
+		shift = LF_DELAY_QUEUE_BITS * (level + 1);
+		if ((tick >> shift) == (current >> shift)) {
+			shift -= LF_DELAY_QUEUE_BITS;
+			return &queue->slots[level][(tick >> shift) & LF_DELAY_QUEUE_MASK];
+		}
+	}
+
+	shift = LF_DELAY_QUEUE_BITS * level;
+	if ((tick >> shift) - (current >> shift) < LF_DELAY_QUEUE_SLOTS)
+		return &queue->slots[level][(tick >> shift) & LF_DELAY_QUEUE_MASK];
+	return &queue->slots[level][((current >> shift) - 1) & LF_DELAY_QUEUE_MASK];
+}
+
+static inline void
+lf_delay_queue_push(LfDelayNode **slot,
+                    LfDelayNode  *node)
+{
+	LfDelayNode *head;
+
+	do {
+		head = lf_atomic_load(slot, memory_order_relaxed);
+		node->next = head;
+	} while (!lf_atomic_pointer_cas(slot, head, node, memory_order_seq_cst));
+}
+
+static void
+lf_delay_queue_flush(LfDelayQueue *queue,
+                     LfDelayBatch *batch)
+{
+	if (batch->n_items) {
+		lf_queue_enqueue_many(queue->ready, batch->items, batch->n_items);
+		batch->n_items = 0;
+	}
+}
+
+/*
+ * Empties slot and places each of its nodes again for the wheel at current.
+ * Due items are collected in batch and their nodes freed.
+ */
+static void
+lf_delay_queue_drain(LfDelayQueue  *queue,
+                     LfDelayBatch  *batch,
+                     LfDelayNode  **slot,
+                     gint64         current)
+{
+	LfDelayNode *node, *next;
+
+	/*
+	 * Skipping an empty slot is as much a part of the handshake with the
+	 * producers as emptying a full one, so this load is ordered too.
+	 */
+	if (!lf_atomic_load(slot, memory_order_seq_cst))
+		return;
+
+	node = lf_atomic_exchange(slot, NULL, memory_order_seq_cst);
+	for (; node; node = next) {
+		next = node->next;
+		if (node->tick > current) {
+			lf_delay_queue_push(lf_delay_queue_slot(queue, current,
+			                                        node->tick), node);
+			continue;
+		}
+		if (batch->n_items == LF_DELAY_QUEUE_BATCH)
+			lf_delay_queue_flush(queue, batch);
+		batch->items[batch->n_items++] = node->data;
+		g_slice_free(LfDelayNode, node);
+	}
+}
+
+/*
+ * Turns the wheel to the current time, moving everything that has come due
+ * to the ready queue.  If another thread is already turning it, this
+ * returns at once.
+ *
+ * Each level empties the slots whose span starts after the old tick and no
+ * later than the new one, lowest level first, placing their nodes again for
+ * the new tick.  That is the same set of slots as stepping through the ticks
+ * one by one would empty, but at most a lap's worth per level, so a wheel
+ * left alone for a long time costs no more than one pass over it.  Only when
+ * a producer asked for it is every slot emptied.
+ */
+static void
+lf_delay_queue_advance(LfDelayQueue *queue)
+{
+	LfDelayBatch batch;
+	gint64 current, now, base, n, i;
+	gint level, shift;
+
+	if (!lf_atomic_int_cas(&queue->busy, 0, 1, memory_order_acquire))
+		return;
+
+	batch.n_items = 0;
+	current = lf_atomic_load(&queue->tick, memory_order_relaxed);
+	now = MAX(current, g_get_monotonic_time() / queue->resolution);
+	lf_atomic_store(&queue->tick, now, memory_order_seq_cst);
+
+	if (lf_atomic_exchange(&queue->rescan, 0, memory_order_seq_cst)) {
+		for (level = 0; level < LF_DELAY_QUEUE_LEVELS; level++) {
+			for (i = 0; i < LF_DELAY_QUEUE_SLOTS; i++)
+				lf_delay_queue_drain(queue, &batch,
+				                     &queue->slots[level][i], now);
+		}
+	} else {
+		for (level = 0; level < LF_DELAY_QUEUE_LEVELS; level++) {
+			shift = LF_DELAY_QUEUE_BITS * level;
+			base = current >> shift;
+			n = MIN((now >> shift) - base, LF_DELAY_QUEUE_SLOTS);
+			if (!n)
+				break;
+			for (i = 1; i <= n; i++) {
+				lf_delay_queue_drain(queue, &batch,
+				                     &queue->slots[level][(base + i) &
+				                                          LF_DELAY_QUEUE_MASK],
+				                     now);
+			}
+		}
+	}
+
+	lf_delay_queue_flush(queue, &batch);
+	lf_atomic_store(&queue->busy, 0, memory_order_release);
+}
+
+static void
+lf_delay_queue_destroy(LfDelayQueue *queue)
+{
+	LfDelayNode *node, *next;
+	gint level, i;
+
+	g_return_if_fail(queue != NULL);
+
+	for (level = 0; level < LF_DELAY_QUEUE_LEVELS; level++) {
+		for (i = 0; i < LF_DELAY_QUEUE_SLOTS; i++) {
+			for (node = queue->slots[level][i]; node; node = next) {
+				next = node->next;
+				g_slice_free(LfDelayNode, node);
+			}
+		}
+	}
+	lf_queue_unref(queue->ready);
+}
+
+/**
+ * lf_delay_queue_new:
+ *
+ * Creates a new instance of #LfDelayQueue with a resolution of one
+ * millisecond.  See lf_delay_queue_new_with_resolution().
+ *
+ * Returns: The newly created #LfDelayQueue.
+ * Side effects: None.
+ */
+LfDelayQueue*
+lf_delay_queue_new(void)
+{
+	return lf_delay_queue_new_with_resolution(LF_DELAY_QUEUE_RESOLUTION);
+}
+
+/**
+ * lf_delay_queue_new_with_resolution:
+ * @resolution_us: The length of a tick in microseconds.
+ *
+ * Creates a new instance of #LfDelayQueue, a queue of items which only
+ * become available once their deadline has passed, for retries and
+ * timeouts.  Items are kept in a hierarchical timing wheel of
+ * @resolution_us long ticks.  An item is never handed out before its
+ * deadline, but may be up to a tick later, plus however long it takes
+ * consumers to come back for it.  The #LfDelayQueue structure is reference
+ * counted and should be freed using lf_delay_queue_unref().
+ *
+ * Returns: The newly created #LfDelayQueue.
+ * Side effects: None.
+ */
+LfDelayQueue*
+lf_delay_queue_new_with_resolution(guint resolution_us)
+{
+	LfDelayQueue *queue;
+
+	g_return_val_if_fail(resolution_us > 0, NULL);
+
+	queue = g_slice_new0(LfDelayQueue);
+	queue->resolution = resolution_us;
+	queue->tick = g_get_monotonic_time() / queue->resolution;
+	queue->ready = lf_queue_new();
+	queue->ref_count = 1;
+
+	return queue;
+}
+
+/**
+ * lf_delay_queue_ref:
+ * @queue: A #LfDelayQueue
+ *
+ * Atomically increments the reference count of @queue by one.
+ *
+ * Returns: A reference to @queue.
+ * Side effects: None.
+ */
+LfDelayQueue*
+lf_delay_queue_ref(LfDelayQueue *queue)
+{
+	g_return_val_if_fail(queue != NULL, NULL);
+	g_return_val_if_fail(queue->ref_count > 0, NULL);
+
+	g_atomic_int_inc(&queue->ref_count);
+	return queue;
+}
+
+/**
+ * lf_delay_queue_unref:
+ * @queue: A #LfDelayQueue
+ *
+ * Decrements the reference count of @queue by one.  When the reference count
+ * reaches zero, the structures allocations are released and the queue is
+ * freed.  Items still in the queue, due or not, are not freed.
+ */
+void
+lf_delay_queue_unref(LfDelayQueue *queue)
+{
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(queue->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&queue->ref_count)) {
+		lf_delay_queue_destroy(queue);
+		g_slice_free(LfDelayQueue, queue);
+	}
+}
+
+/**
+ * lf_delay_queue_get_type:
+ *
+ * Retrieves the GObject type system's type identifier for #LfDelayQueue.
+ *
+ * Returns: A #GType containing the type id.
+ * Side effects: Registers the #LfDelayQueue type if not already.
+ */
+GType
+lf_delay_queue_get_type(void)
+{
+	static GType type_id = 0;
+	GType tmp_id;
+
+	if (g_once_init_enter((gsize *)&type_id)) {
+		tmp_id = g_boxed_type_register_static("LfDelayQueue",
+		                                      (GBoxedCopyFunc)lf_delay_queue_ref,
+		                                      (GBoxedFreeFunc)lf_delay_queue_unref);
+		g_once_init_leave((gsize *)&type_id, tmp_id);
+	}
+
+	return type_id;
+}
+
+/**
+ * lf_delay_queue_enqueue_at:
+ * @queue: A #LfDelayQueue.
+ * @data: a non-%NULL pointer.
+ * @deadline: The monotonic time, as returned by g_get_monotonic_time(), at
+ *   which @data becomes due.
+ *
+ * Enqueues an item into the #LfDelayQueue to be handed out once @deadline
+ * has passed.  Any thread may call this.  It takes a single CAS on the slot
+ * the item falls in, however far away @deadline is; an item already due
+ * goes straight to the consumers.
+ *
+ * Side effects: None.
+ */
+void
+lf_delay_queue_enqueue_at(LfDelayQueue  *queue,
+                          gconstpointer  data,
+                          gint64         deadline)
+{
+	LfDelayNode *node;
+	gint64 current, tick;
+
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(data != NULL);
+
+	tick = lf_delay_queue_tick(queue, deadline);
+	current = lf_atomic_load(&queue->tick, memory_order_seq_cst);
+	if (tick <= current) {
+		lf_queue_enqueue(queue->ready, data);
+		return;
+	}
+
+	node = g_slice_new(LfDelayNode);
+	node->data = (gpointer)data;
+	node->tick = tick;
+	lf_delay_queue_push(lf_delay_queue_slot(queue, current, tick), node);
+
+	if (lf_atomic_load(&queue->tick, memory_order_seq_cst) != current)
+		lf_atomic_store(&queue->rescan, 1, memory_order_seq_cst);
+}
+
+/**
+ * lf_delay_queue_dequeue_ready:
+ * @queue: A #LfDelayQueue
+ *
+ * Dequeues an item whose deadline has passed.  Any thread may call this.
+ * Items due in earlier ticks are generally handed out first, but those due
+ * in the same tick come in no particular order.  If no item is due, %NULL is
+ * returned.  An item enqueued while the wheel is turning may only turn up
+ * on a later call.
+ *
+ * Returns: A due item or %NULL.
+ *
+ * Side effects: The wheel is turned to the current time unless another
+ *   thread is doing so, and hazard pointer reclaimation can occur.
+ */
+gpointer
+lf_delay_queue_dequeue_ready(LfDelayQueue *queue)
+{
+	g_return_val_if_fail(queue != NULL, NULL);
+
+	lf_delay_queue_advance(queue);
+	return lf_queue_dequeue(queue->ready);
+}
+
+/**
+ * lf_delay_queue_dequeue_ready_many:
+ * @queue: A #LfDelayQueue
+ * @items: A location for up to @max_items pointers.
+ * @max_items: The maximum number of items to dequeue.
+ *
+ * Dequeues up to @max_items items whose deadlines have passed into @items,
+ * as lf_delay_queue_dequeue_ready() would one at a time.
+ *
+ * Returns: The number of items stored in @items, 0 if none are due.
+ *
+ * Side effects: The wheel is turned to the current time unless another
+ *   thread is doing so, and hazard pointer reclaimation can occur.
+ */
+guint
+lf_delay_queue_dequeue_ready_many(LfDelayQueue *queue,
+                                  gpointer     *items,
+                                  guint         max_items)
+{
+	g_return_val_if_fail(queue != NULL, 0);
+	g_return_val_if_fail(items != NULL || max_items == 0, 0);
+
+	lf_delay_queue_advance(queue);
+	return lf_queue_dequeue_many(queue->ready, items, max_items);
+}
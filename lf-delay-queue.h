@@ -0,0 +1,46 @@
+/* lf-delay-queue.h
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LF_DELAY_QUEUE_H__
+#define __LF_DELAY_QUEUE_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LfDelayQueue LfDelayQueue;
+
+GType         lf_delay_queue_get_type            (void) G_GNUC_CONST;
+LfDelayQueue* lf_delay_queue_new                 (void);
+LfDelayQueue* lf_delay_queue_new_with_resolution (guint resolution_us);
+LfDelayQueue* lf_delay_queue_ref                 (LfDelayQueue *queue);
+void          lf_delay_queue_unref               (LfDelayQueue *queue);
+void          lf_delay_queue_enqueue_at          (LfDelayQueue *queue, gconstpointer data,
+                                                  gint64 deadline);
+gpointer      lf_delay_queue_dequeue_ready       (LfDelayQueue *queue);
+guint         lf_delay_queue_dequeue_ready_many  (LfDelayQueue *queue, gpointer *items,
+                                                  guint max_items);
+
+G_END_DECLS
+
+#endif /* __LF_DELAY_QUEUE_H__ */
@@ -0,0 +1,367 @@
+/* lf-deque.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "lf-atomic.h"
+#include "lf-deque.h"
+#include "lf-hazard.h"
+
+/**
+ * @LF_CACHE_LINE: The assumed size of a cache line in bytes.  The end
+ *                 stolen from gets a line of its own so thieves do not
+ *                 falsely share with the owner.
+ */
+#define LF_CACHE_LINE (64)
+
+/**
+ * @LF_DEQUE_MIN_ORDER: The base two logarithm of the initial capacity.
+ */
+#define LF_DEQUE_MIN_ORDER (6)
+
+typedef struct _LfDequeArray LfDequeArray;
+
+/*
+ * A circular array.  Position i lives in items[i & mask], so positions keep
+ * counting up forever and only the array needs to be replaced to grow.
+ */
+struct _LfDequeArray {
+	guint    mask;
+	gpointer items[1];
+};
+
+/*
+ * A Chase-Lev work-stealing deque.  The owner pushes and pops at bottom
+ * without contention, thieves take from top with a CAS.  The two only race
+ * over the last item.
+ *
+ * Positions are compared by subtraction so they may wrap.
+ */
+struct _LfDeque {
+	volatile gint    top;
+	gchar            pad0[LF_CACHE_LINE - sizeof(gint)];
+	volatile gint    bottom;
+	LfDequeArray    *array;
+	volatile gint    ref_count;
+	LfHazardDomain  *domain;
+};
+
+static LfDequeArray*
+lf_deque_array_new(guint size)
+{
+	LfDequeArray *array;
+
+	array = g_malloc(sizeof(LfDequeArray) + sizeof(gpointer) * (size - 1));
+	array->mask = size - 1;
+
+	return array;
+}
+
+/*
+ * Replaces the array with one twice the size.  Only the owner calls this, so
+ * it is the only thread to ever write to an array.  Thieves may still be
+ * reading the old one, so it is retired rather than freed.
+ */
+static LfDequeArray*
+lf_deque_grow(LfDeque      *deque,
+              LfDequeArray *array,
+              gint          top,
+              gint          bottom)
+{
+	LfDequeArray *grown;
+	gint i;
+	LF_HAZARD_INIT;
+
+	LF_HAZARD_ENTER(deque->domain);
+
+	grown = lf_deque_array_new((array->mask + 1) * 2);
+	for (i = top; i != bottom; i++)
+		grown->items[i & grown->mask] = array->items[i & array->mask];
+	lf_atomic_store(&deque->array, grown, memory_order_release);
+	LF_HAZARD_UNSET(array, g_free);
+
+	return grown;
+}
+
+static void
+lf_deque_destroy(LfDeque *deque)
+{
+	g_return_if_fail(deque != NULL);
+
+	g_free(deque->array);
+}
+
+/**
+ * lf_deque_new:
+ *
+ * Creates a new instance of #LfDeque, a work-stealing deque.  A single owner
+ * thread pushes and pops items at one end, LIFO, while any number of other
+ * threads steal items from the other end, FIFO.  The capacity grows as
+ * needed.  The #LfDeque structure is reference counted and should be freed
+ * using lf_deque_unref().
+ *
+ * Returns: The newly created #LfDeque.
+ * Side effects: None.
+ */
+LfDeque*
+lf_deque_new(void)
+{
+	LfDeque *deque;
+	gpointer mem;
+
+	if (posix_memalign(&mem, LF_CACHE_LINE, sizeof(LfDeque)) != 0)
+		g_error("Failed to allocate %" G_GSIZE_FORMAT " bytes",
+		        sizeof(LfDeque));
+
+	deque = mem;
+	deque->top = 0;
+	deque->bottom = 0;
+	deque->array = lf_deque_array_new(1 << LF_DEQUE_MIN_ORDER);
+	deque->ref_count = 1;
+	deque->domain = lf_hazard_domain_get_default();
+
+	return deque;
+}
+
+/**
+ * lf_deque_ref:
+ * @deque: A #LfDeque
+ *
+ * Atomically increments the reference count of @deque by one.
+ *
+ * Returns: A reference to @deque.
+ * Side effects: None.
+ */
+LfDeque*
+lf_deque_ref(LfDeque *deque)
+{
+	g_return_val_if_fail(deque != NULL, NULL);
+	g_return_val_if_fail(deque->ref_count > 0, NULL);
+
+	g_atomic_int_inc(&deque->ref_count);
+	return deque;
+}
+
+/**
+ * lf_deque_unref:
+ * @deque: A #LfDeque
+ *
+ * Decrements the reference count of @deque by one.  When the reference count
+ * reaches zero, the structures allocations are released and the deque is
+ * freed.
+ */
+void
+lf_deque_unref(LfDeque *deque)
+{
+	g_return_if_fail(deque != NULL);
+	g_return_if_fail(deque->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&deque->ref_count)) {
+		lf_deque_destroy(deque);
+		free(deque);
+	}
+}
+
+/**
+ * lf_deque_get_type:
+ *
+ * Retrieves the GObject type system's type identifier for #LfDeque.
+ *
+ * Returns: A #GType containing the type id.
+ * Side effects: Registers the #LfDeque type if not already.
+ */
+GType
+lf_deque_get_type(void)
+{
+	static GType type_id = 0;
+	GType tmp_id;
+
+	if (g_once_init_enter((gsize *)&type_id)) {
+		tmp_id = g_boxed_type_register_static("LfDeque",
+		                                      (GBoxedCopyFunc)lf_deque_ref,
+		                                      (GBoxedFreeFunc)lf_deque_unref);
+		g_once_init_leave((gsize *)&type_id, tmp_id);
+	}
+
+	return type_id;
+}
+
+/**
+ * lf_deque_push:
+ * @deque: A #LfDeque
+ * @data: a non-%NULL pointer.
+ *
+ * Pushes an item onto the owner's end of the deque.  Only the owner of
+ * @deque may call this.
+ *
+ * Side effects: The deque may grow, in which case the old array is freed
+ *   once no thief is reading it.
+ */
+void
+lf_deque_push(LfDeque       *deque,
+              gconstpointer  data)
+{
+	LfDequeArray *array;
+	gint bottom, top;
+
+	g_return_if_fail(deque != NULL);
+	g_return_if_fail(data != NULL);
+
+	bottom = lf_atomic_load(&deque->bottom, memory_order_relaxed);
+	top = lf_atomic_load(&deque->top, memory_order_acquire);
+	array = lf_atomic_load(&deque->array, memory_order_relaxed);
+
+	if ((guint)bottom - (guint)top > array->mask)
+		array = lf_deque_grow(deque, array, top, bottom);
+
+	lf_atomic_store(&array->items[bottom & array->mask], (gpointer)data,
+	                memory_order_relaxed);
+	lf_atomic_store(&deque->bottom, bottom + 1, memory_order_release);
+}
+
+/**
+ * lf_deque_pop:
+ * @deque: A #LfDeque
+ *
+ * Pops the most recently pushed item from the owner's end of the deque.
+ * Only the owner of @deque may call this.
+ *
+ * Returns: An item from the deque or %NULL if it is empty.
+ * Side effects: None.
+ */
+gpointer
+lf_deque_pop(LfDeque *deque)
+{
+	LfDequeArray *array;
+	gpointer data;
+	gint bottom, top;
+
+	g_return_val_if_fail(deque != NULL, NULL);
+
+	/*
+	 * Claim the bottom item before looking at top.  The claim and the
+	 * thieves' reads of bottom and top are all sequentially consistent, so
+	 * a thief either sees the claim or we see its steal.
+	 */
+	bottom = lf_atomic_int_add(&deque->bottom, -1, memory_order_seq_cst) - 1;
+	array = lf_atomic_load(&deque->array, memory_order_relaxed);
+	top = lf_atomic_load(&deque->top, memory_order_seq_cst);
+
+	if ((gint)((guint)bottom - (guint)top) < 0) {
+		/*
+		 * Empty.  Put bottom back where it was.
+		 */
+		lf_atomic_store(&deque->bottom, bottom + 1,
+		                memory_order_relaxed);
+		return NULL;
+	}
+
+	data = lf_atomic_load(&array->items[bottom & array->mask],
+	                      memory_order_relaxed);
+	if (bottom != top)
+		return data;
+
+	/*
+	 * This was the last item, so race the thieves for it through top just
+	 * like they race each other.
+	 */
+	if (!lf_atomic_int_cas(&deque->top, top, top + 1, memory_order_seq_cst))
+		data = NULL;
+	lf_atomic_store(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+	return data;
+}
+
+/**
+ * lf_deque_steal:
+ * @deque: A #LfDeque
+ *
+ * Steals the least recently pushed item from the far end of the deque.  Any
+ * thread may call this.
+ *
+ * Returns: An item from the deque or %NULL if it is empty.
+ *
+ * Side effects: Hazard pointer reclaimation can occur meaning that structures
+ *   no longer in use may be freed by the system.
+ */
+gpointer
+lf_deque_steal(LfDeque *deque)
+{
+	LfDequeArray *array;
+	gpointer data;
+	gint bottom, top;
+	LF_HAZARD_INIT;
+
+	g_return_val_if_fail(deque != NULL, NULL);
+
+	LF_HAZARD_ENTER(deque->domain);
+
+	while (TRUE) {
+		top = lf_atomic_load(&deque->top, memory_order_seq_cst);
+		bottom = lf_atomic_load(&deque->bottom, memory_order_seq_cst);
+		if ((gint)((guint)bottom - (guint)top) <= 0)
+			return NULL;
+
+		/*
+		 * The array is read after bottom, so it is at least as new as
+		 * the one the item at top was pushed into.
+		 */
+		array = lf_atomic_load(&deque->array, memory_order_acquire);
+		LF_HAZARD_SET(0, array);
+		if (lf_atomic_load(&deque->array, memory_order_seq_cst) == array)
+			data = lf_atomic_load(&array->items[top & array->mask],
+			                      memory_order_relaxed);
+		else
+			data = NULL;
+		LF_HAZARD_SET(0, NULL);
+		if (!data)
+			continue;
+
+		if (lf_atomic_int_cas(&deque->top, top, top + 1,
+		                      memory_order_seq_cst))
+			return data;
+	}
+}
+
+/**
+ * lf_deque_is_empty:
+ * @deque: A #LfDeque
+ *
+ * Checks whether @deque has any items.  With concurrent updates this is only
+ * a snapshot.
+ *
+ * Returns: %TRUE if @deque is empty.
+ * Side effects: None.
+ */
+gboolean
+lf_deque_is_empty(LfDeque *deque)
+{
+	gint bottom, top;
+
+	g_return_val_if_fail(deque != NULL, TRUE);
+
+	top = lf_atomic_load(&deque->top, memory_order_acquire);
+	bottom = lf_atomic_load(&deque->bottom, memory_order_acquire);
+
+	return (gint)((guint)bottom - (guint)top) <= 0;
+}
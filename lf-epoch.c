@@ -0,0 +1,484 @@
+/* lf-epoch.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "lf-atomic.h"
+#include "lf-epoch.h"
+
+/*
+ * Epoch based reclaimation.
+ *
+ * Every thread announces the global epoch it observed when it enters a
+ * critical section and withdraws the announcement when it leaves.  Pointers
+ * retired while the global epoch is e are kept in one of three limbo lists
+ * until the global epoch reaches e + 2.  Any thread that could still reach
+ * such a pointer entered at e or earlier, and the global epoch only advances
+ * from e to e + 1 once every thread inside a critical section has announced
+ * e, so by e + 2 no thread can still hold a reference obtained before the
+ * pointer was retired.
+ *
+ * Compared to hazard pointers, a critical section costs one barrier no matter
+ * how many pointers it dereferences.  The price is that a thread stalled
+ * inside a critical section holds back reclaimation for everybody.
+ */
+
+#define LF_EPOCH_N_LIMBO (3)
+
+typedef struct _LfEpochRetired LfEpochRetired;
+typedef struct _LfEpochLimbo   LfEpochLimbo;
+typedef struct _LfEpochOrphan  LfEpochOrphan;
+
+struct _LfEpochRetired {
+	gpointer       data;
+	GDestroyNotify notify;
+};
+
+/*
+ * A list of pointers retired by one thread during epoch.
+ */
+struct _LfEpochLimbo {
+	guint           epoch;
+	LfEpochRetired *retired;
+	gint            n_retired;
+	gint            size;
+};
+
+/*
+ * A limbo list left behind by a thread that exited.  Orphans are pushed onto
+ * their domain's orphan list and freed by a live thread once their epoch has
+ * passed.
+ */
+struct _LfEpochOrphan {
+	LfEpochOrphan  *next;
+	guint           epoch;
+	gint            n_retired;
+	LfEpochRetired  retired[1];
+};
+
+/*
+ * A thread's record within a domain.  state holds the announced epoch
+ * shifted left by one, with the low bit set while inside a critical section,
+ * and is only ever written by the owning thread.  nesting allows critical
+ * sections to nest, only the outermost announces.
+ */
+struct _LfEpoch {
+	volatile gint   state;
+	guint           epoch;
+	guint           nesting;
+	LfEpoch        *next;
+	LfEpochDomain  *domain;
+	volatile gint   active;
+	gint            id;
+	guint           n_since_collect;
+	LfEpochLimbo    limbo[LF_EPOCH_N_LIMBO];
+};
+
+/*
+ * records is the linked-list of all thread records ever created in the
+ * domain; the records of exited threads are reused.
+ */
+struct _LfEpochDomain {
+	volatile gint   epoch;
+	LfEpoch        *records;
+	volatile gint   n_records;
+	LfEpochOrphan  *orphans;
+	GStaticPrivate  tls;
+};
+
+/*
+ * Pointers retired during epoch can be freed once the global epoch is at
+ * least two ahead.  Epochs are compared by subtraction so they may wrap.
+ */
+static inline gboolean
+lf_epoch_expired(guint epoch,
+                 guint global)
+{
+	return (global - epoch) >= 2;
+}
+
+static void
+lf_epoch_limbo_free(LfEpochLimbo *limbo)
+{
+	gint i;
+
+	for (i = 0; i < limbo->n_retired; i++)
+		limbo->retired[i].notify(limbo->retired[i].data);
+	limbo->n_retired = 0;
+}
+
+/**
+ * lf_epoch_domain_new:
+ *
+ * Creates a new epoch domain.  Structures should generally share the default
+ * domain from lf_epoch_domain_get_default().
+ *
+ * Threads keep their records in a domain until they exit, so domains are
+ * meant to be created once and never freed.
+ *
+ * Returns: The newly created #LfEpochDomain.
+ * Side effects: None.
+ */
+LfEpochDomain*
+lf_epoch_domain_new(void)
+{
+	LfEpochDomain *domain;
+
+	domain = g_slice_new0(LfEpochDomain);
+	g_static_private_init(&domain->tls);
+
+	return domain;
+}
+
+/**
+ * lf_epoch_domain_get_default:
+ *
+ * Retrieves the process wide epoch domain.
+ *
+ * Returns: The default #LfEpochDomain.
+ * Side effects: Creates the domain if not already.
+ */
+LfEpochDomain*
+lf_epoch_domain_get_default(void)
+{
+	static LfEpochDomain *domain = NULL;
+	LfEpochDomain *tmp;
+
+	if (g_once_init_enter((gsize *)&domain)) {
+		tmp = lf_epoch_domain_new();
+		g_once_init_leave((gsize *)&domain, (gsize)tmp);
+	}
+
+	return domain;
+}
+
+/**
+ * lf_epoch_domain_get_epoch:
+ * @domain: A #LfEpochDomain
+ *
+ * Retrieves the current global epoch of @domain.
+ *
+ * Returns: The epoch.
+ * Side effects: None.
+ */
+guint
+lf_epoch_domain_get_epoch(LfEpochDomain *domain)
+{
+	g_return_val_if_fail(domain != NULL, 0);
+
+	return lf_atomic_load(&domain->epoch, memory_order_acquire);
+}
+
+/*
+ * Thread exit hook that hands the thread's limbo lists to the domain's
+ * orphan list.  Nothing is freed here since the destroy notifies may rely on
+ * thread local state that is already gone.
+ */
+static void
+lf_epoch_thread_release(LfEpoch *epoch)
+{
+	LfEpochDomain *domain = epoch->domain;
+	LfEpochLimbo *limbo;
+	LfEpochOrphan *orphan;
+	gint i;
+
+	lf_atomic_store(&epoch->state, 0, memory_order_release);
+	epoch->nesting = 0;
+
+	for (i = 0; i < LF_EPOCH_N_LIMBO; i++) {
+		limbo = &epoch->limbo[i];
+		if (!limbo->n_retired)
+			continue;
+		orphan = g_malloc(sizeof(LfEpochOrphan) +
+		                  sizeof(LfEpochRetired) * (limbo->n_retired - 1));
+		orphan->epoch = limbo->epoch;
+		orphan->n_retired = limbo->n_retired;
+		memcpy(orphan->retired, limbo->retired,
+		       sizeof(LfEpochRetired) * limbo->n_retired);
+		limbo->n_retired = 0;
+		do {
+			orphan->next = lf_atomic_load(&domain->orphans,
+			                              memory_order_relaxed);
+		} while (!lf_atomic_pointer_cas(&domain->orphans, orphan->next,
+		                                orphan, memory_order_release));
+	}
+
+	lf_atomic_store(&epoch->active, FALSE, memory_order_release);
+}
+
+/*
+ * Acquires a record for the calling thread, reusing one left by an exited
+ * thread if possible.
+ */
+static LfEpoch*
+lf_epoch_thread_acquire(LfEpochDomain *domain)
+{
+	LfEpoch *epoch, *old_head;
+
+	for (epoch = lf_atomic_load(&domain->records, memory_order_acquire);
+	     epoch; epoch = epoch->next) {
+		if (lf_atomic_load(&epoch->active, memory_order_relaxed))
+			continue;
+		if (lf_atomic_int_cas(&epoch->active, FALSE, TRUE,
+		                      memory_order_acquire))
+			goto done;
+	}
+
+	epoch = g_slice_new0(LfEpoch);
+	epoch->domain = domain;
+	epoch->active = TRUE;
+	epoch->id = lf_atomic_int_add(&domain->n_records, 1, memory_order_relaxed);
+	do {
+		old_head = lf_atomic_load(&domain->records, memory_order_relaxed);
+		epoch->next = old_head;
+	} while (!lf_atomic_pointer_cas(&domain->records, old_head, epoch,
+	                                memory_order_release));
+
+done:
+	g_static_private_set(&domain->tls, epoch,
+	                     (GDestroyNotify)lf_epoch_thread_release);
+	return epoch;
+}
+
+/**
+ * lf_epoch_enter:
+ * @domain: A #LfEpochDomain
+ *
+ * Enters a critical section in @domain.  Pointers read from a structure
+ * protected by @domain remain valid until the matching lf_epoch_leave().
+ * Critical sections may nest.
+ *
+ * Returns: The calling thread's #LfEpoch.
+ * Side effects: Acquires a record for the thread if it has none yet.
+ */
+LfEpoch*
+lf_epoch_enter(LfEpochDomain *domain)
+{
+	LfEpoch *epoch;
+	guint global;
+
+	epoch = g_static_private_get(&domain->tls);
+	if (G_UNLIKELY(!epoch))
+		epoch = lf_epoch_thread_acquire(domain);
+
+	if (epoch->nesting++ == 0) {
+		global = lf_atomic_load(&domain->epoch, memory_order_acquire);
+		epoch->epoch = global;
+		/*
+		 * The announcement must be visible before any pointer is read
+		 * from the structure, which takes a store-load fence.  It pairs
+		 * with the one in lf_epoch_try_advance().  The store itself is a
+		 * release so that seeing it also means seeing everything done in
+		 * this thread's previous critical section.
+		 */
+		lf_atomic_store(&epoch->state, (gint)((global << 1) | 1),
+		                memory_order_release);
+		lf_atomic_fence(memory_order_seq_cst);
+	}
+
+	return epoch;
+}
+
+/**
+ * lf_epoch_leave:
+ * @epoch: A #LfEpoch
+ *
+ * Leaves the critical section entered with lf_epoch_enter().
+ *
+ * Side effects: None.
+ */
+void
+lf_epoch_leave(LfEpoch *epoch)
+{
+	g_return_if_fail(epoch != NULL);
+	g_return_if_fail(epoch->nesting > 0);
+
+	if (--epoch->nesting == 0)
+		lf_atomic_store(&epoch->state, 0, memory_order_release);
+}
+
+/*
+ * Advances the global epoch if every thread inside a critical section has
+ * announced the current one.
+ */
+static void
+lf_epoch_try_advance(LfEpochDomain *domain)
+{
+	LfEpoch *epoch;
+	guint global;
+	gint state;
+
+	global = lf_atomic_load(&domain->epoch, memory_order_acquire);
+	lf_atomic_fence(memory_order_seq_cst);
+	for (epoch = lf_atomic_load(&domain->records, memory_order_acquire);
+	     epoch; epoch = epoch->next) {
+		state = lf_atomic_load(&epoch->state, memory_order_acquire);
+		if ((state & 1) && ((guint)state >> 1) != (global & (G_MAXUINT >> 1)))
+			return;
+	}
+	lf_atomic_int_cas(&domain->epoch, (gint)global, (gint)(global + 1),
+	                  memory_order_acq_rel);
+}
+
+/*
+ * Frees the orphaned limbo lists whose epoch has passed and puts the others
+ * back.
+ */
+static void
+lf_epoch_adopt_orphans(LfEpochDomain *domain,
+                       guint          global)
+{
+	LfEpochOrphan *orphan, *next;
+	gint i;
+
+	do {
+		orphan = lf_atomic_load(&domain->orphans, memory_order_relaxed);
+		if (!orphan)
+			return;
+	} while (!lf_atomic_pointer_cas(&domain->orphans, orphan, NULL,
+	                                memory_order_acquire));
+
+	for (; orphan; orphan = next) {
+		next = orphan->next;
+		if (lf_epoch_expired(orphan->epoch, global)) {
+			for (i = 0; i < orphan->n_retired; i++)
+				orphan->retired[i].notify(orphan->retired[i].data);
+			g_free(orphan);
+			continue;
+		}
+		do {
+			orphan->next = lf_atomic_load(&domain->orphans,
+			                              memory_order_relaxed);
+		} while (!lf_atomic_pointer_cas(&domain->orphans, orphan->next,
+		                                orphan, memory_order_release));
+	}
+}
+
+/**
+ * lf_epoch_collect:
+ * @epoch: A #LfEpoch
+ *
+ * Attempts to advance the global epoch and then frees every limbo list of
+ * the calling thread, and every orphaned list, whose epoch has passed.
+ * lf_epoch_retire() calls this every %LF_EPOCH_BATCH pointers.  It may be
+ * called inside or outside of a critical section.
+ *
+ * Side effects: Retired pointers are freed with their destroy notify.
+ */
+void
+lf_epoch_collect(LfEpoch *epoch)
+{
+	LfEpochDomain *domain;
+	LfEpochLimbo *limbo;
+	guint global;
+	gint i;
+
+	g_return_if_fail(epoch != NULL);
+
+	domain = epoch->domain;
+	epoch->n_since_collect = 0;
+
+	lf_epoch_try_advance(domain);
+	global = lf_atomic_load(&domain->epoch, memory_order_acquire);
+
+	for (i = 0; i < LF_EPOCH_N_LIMBO; i++) {
+		limbo = &epoch->limbo[i];
+		if (limbo->n_retired && lf_epoch_expired(limbo->epoch, global))
+			lf_epoch_limbo_free(limbo);
+	}
+
+	if (lf_atomic_load(&domain->orphans, memory_order_relaxed))
+		lf_epoch_adopt_orphans(domain, global);
+}
+
+/**
+ * lf_epoch_retire:
+ * @epoch: A #LfEpoch
+ * @data: The pointer to retire.
+ * @notify: The function to free @data with.
+ *
+ * Retires @data, which must already be unreachable from the structure.  It
+ * is freed with @notify once no thread can still hold a reference to it.
+ * Must be called inside a critical section.
+ *
+ * Side effects: Retired pointers may be freed with their destroy notify.
+ */
+void
+lf_epoch_retire(LfEpoch        *epoch,
+                gpointer        data,
+                GDestroyNotify  notify)
+{
+	LfEpochLimbo *limbo;
+	guint global;
+
+	g_return_if_fail(epoch != NULL);
+	g_return_if_fail(epoch->nesting > 0);
+
+	/*
+	 * The pointer is tagged with the global epoch as of now, after it was
+	 * unlinked, rather than the one we announced.  A thread that entered
+	 * after us may have announced the next epoch and still read it.
+	 */
+	global = lf_atomic_load(&epoch->domain->epoch, memory_order_acquire);
+
+	/*
+	 * A limbo list still holding pointers from three epochs ago is safe
+	 * to free before reusing it.  The one exception is when the epoch
+	 * counter wraps, in which case the old pointers simply wait longer.
+	 */
+	limbo = &epoch->limbo[global % LF_EPOCH_N_LIMBO];
+	if (limbo->epoch != global) {
+		if (limbo->n_retired && lf_epoch_expired(limbo->epoch, global))
+			lf_epoch_limbo_free(limbo);
+		limbo->epoch = global;
+	}
+
+	if (G_UNLIKELY(limbo->n_retired >= limbo->size)) {
+		limbo->size = MAX(limbo->size * 2, LF_EPOCH_BATCH);
+		limbo->retired = g_renew(LfEpochRetired, limbo->retired, limbo->size);
+	}
+	limbo->retired[limbo->n_retired].data = data;
+	limbo->retired[limbo->n_retired].notify = notify;
+	limbo->n_retired++;
+
+	if (G_UNLIKELY(++epoch->n_since_collect >= LF_EPOCH_BATCH))
+		lf_epoch_collect(epoch);
+}
+
+/**
+ * lf_epoch_get_id:
+ * @epoch: A #LfEpoch
+ *
+ * Retrieves the record's position in creation order.  Since a record is
+ * owned by one thread at a time this doubles as a cheap thread index.
+ *
+ * Returns: The id of @epoch.
+ * Side effects: None.
+ */
+gint
+lf_epoch_get_id(LfEpoch *epoch)
+{
+	g_return_val_if_fail(epoch != NULL, 0);
+
+	return epoch->id;
+}
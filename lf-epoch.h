@@ -0,0 +1,55 @@
+/* lf-epoch.h
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LF_EPOCH_H__
+#define __LF_EPOCH_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * @LF_EPOCH_BATCH: The number of pointers a thread retires between attempts
+ *                  to advance the global epoch and free its limbo lists.
+ */
+#ifndef LF_EPOCH_BATCH
+#define LF_EPOCH_BATCH (64)
+#endif
+
+typedef struct _LfEpoch       LfEpoch;
+typedef struct _LfEpochDomain LfEpochDomain;
+
+LfEpochDomain* lf_epoch_domain_get_default (void);
+LfEpochDomain* lf_epoch_domain_new         (void);
+guint          lf_epoch_domain_get_epoch   (LfEpochDomain  *domain);
+LfEpoch*       lf_epoch_enter              (LfEpochDomain  *domain);
+void           lf_epoch_leave              (LfEpoch        *epoch);
+void           lf_epoch_retire             (LfEpoch        *epoch,
+                                            gpointer        data,
+                                            GDestroyNotify  notify);
+void           lf_epoch_collect            (LfEpoch        *epoch);
+gint           lf_epoch_get_id             (LfEpoch        *epoch);
+
+G_END_DECLS
+
+#endif /* __LF_EPOCH_H__ */
@@ -0,0 +1,347 @@
+/* lf-executor.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "lf-atomic.h"
+#include "lf-deque.h"
+#include "lf-executor.h"
+#include "lf-futex.h"
+#include "lf-hazard.h"
+#include "lf-queue.h"
+
+/**
+ * @LF_CACHE_LINE: The assumed size of a cache line in bytes.  Each worker
+ *                 gets a line of its own so that their victim selection
+ *                 does not falsely share.
+ */
+#define LF_CACHE_LINE (64)
+
+/**
+ * @LF_EXECUTOR_SPIN_COUNT: The number of times an idle worker looks for
+ *                          work before going to sleep.
+ */
+#ifndef LF_EXECUTOR_SPIN_COUNT
+#define LF_EXECUTOR_SPIN_COUNT (64)
+#endif
+
+typedef struct _LfExecutorWorker LfExecutorWorker;
+
+struct _LfExecutorWorker {
+	LfExecutor *executor;
+	LfDeque    *deque;
+	GThread    *thread;
+	guint32     seed;
+	gchar       pad[LF_CACHE_LINE - 3 * sizeof(gpointer) - sizeof(guint32)];
+};
+
+/*
+ * Each worker owns a deque which it pushes to and pops from, and other
+ * workers steal from when they run dry.  Tasks pushed by threads that are
+ * not workers go through the injector queue instead, which every worker
+ * checks after its own deque.
+ *
+ * Idle workers sleep on wake_seq.  n_sleeping counts them so that pushing a
+ * task only costs a system call when somebody is actually asleep.
+ */
+struct _LfExecutor {
+	GFunc             func;
+	gpointer          user_data;
+	guint             n_workers;
+	LfExecutorWorker *workers;
+	LfQueue          *injector;
+	volatile gint     n_sleeping;
+	volatile gint     wake_seq;
+	volatile gint     shutdown;
+};
+
+static GStaticPrivate lf_executor_current = G_STATIC_PRIVATE_INIT;
+
+/*
+ * Picks the next random victim.  xorshift is plenty for spreading steals
+ * and, unlike g_random_int(), does not take a global lock.
+ */
+static inline guint32
+lf_executor_worker_random(LfExecutorWorker *worker)
+{
+	guint32 x = worker->seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return worker->seed = x;
+}
+
+/*
+ * Looks for a task in the worker's own deque, then the injector queue, then
+ * the deques of the other workers starting at a random one.
+ */
+static gpointer
+lf_executor_worker_find(LfExecutorWorker *worker)
+{
+	LfExecutor *executor = worker->executor;
+	LfExecutorWorker *victim;
+	gpointer task;
+	guint start, i;
+
+	if ((task = lf_deque_pop(worker->deque)))
+		return task;
+	if ((task = lf_queue_dequeue(executor->injector)))
+		return task;
+
+	start = lf_executor_worker_random(worker) % executor->n_workers;
+	for (i = 0; i < executor->n_workers; i++) {
+		victim = &executor->workers[(start + i) % executor->n_workers];
+		if (victim != worker && (task = lf_deque_steal(victim->deque)))
+			return task;
+	}
+
+	return NULL;
+}
+
+static gpointer
+lf_executor_worker_run(gpointer data)
+{
+	LfExecutorWorker *worker = data;
+	LfExecutor *executor = worker->executor;
+	LfHazardDomain *domain;
+	gboolean shutdown;
+	gpointer task;
+	gint seq, i;
+
+	/*
+	 * Take the hazard record up front so that the first steal does not pay
+	 * for it, and hold on to it for the life of the worker.
+	 */
+	domain = lf_hazard_domain_get_default();
+	lf_hazard_get(domain);
+	g_static_private_set(&lf_executor_current, worker, NULL);
+
+	while (TRUE) {
+		for (i = 0; !(task = lf_executor_worker_find(worker)) &&
+		     i < LF_EXECUTOR_SPIN_COUNT; i++)
+			;
+
+		if (!task) {
+			/*
+			 * Register as sleeping before the final look around, so
+			 * that a push landing after it bumps wake_seq and stops
+			 * the futex from sleeping on a stale value.  Shutdown is
+			 * read first; once it is seen, every task pushed before it
+			 * is visible to the final look.
+			 */
+			shutdown = lf_atomic_load(&executor->shutdown,
+			                          memory_order_seq_cst);
+			seq = lf_atomic_load(&executor->wake_seq,
+			                     memory_order_seq_cst);
+			lf_atomic_int_add(&executor->n_sleeping, 1,
+			                  memory_order_seq_cst);
+			if (!(task = lf_executor_worker_find(worker)) && !shutdown)
+				lf_futex_wait(&executor->wake_seq, seq, -1);
+			lf_atomic_int_add(&executor->n_sleeping, -1,
+			                  memory_order_relaxed);
+
+			if (!task) {
+				if (shutdown)
+					break;
+				continue;
+			}
+		}
+
+		executor->func(task, executor->user_data);
+	}
+
+	g_static_private_set(&lf_executor_current, NULL, NULL);
+	lf_hazard_thread_leave(domain);
+
+	return NULL;
+}
+
+/**
+ * lf_executor_new:
+ * @func: A function to execute for each task.
+ * @user_data: User data passed to @func.
+ * @n_workers: The number of worker threads.
+ *
+ * Creates a new instance of #LfExecutor, a work-stealing thread pool.  It
+ * runs @func in one of @n_workers threads for every task pushed with
+ * lf_executor_push(), much like #GThreadPool but without a lock on the
+ * path from submission to execution.
+ *
+ * Tasks pushed from within @func stay on the worker that pushed them, most
+ * recent first, unless an idle worker steals them.  Other tasks are handed
+ * out in roughly the order they were pushed.
+ *
+ * Returns: The newly created #LfExecutor, to be freed with
+ *   lf_executor_free().
+ * Side effects: Starts @n_workers threads.
+ */
+LfExecutor*
+lf_executor_new(GFunc    func,
+                gpointer user_data,
+                guint    n_workers)
+{
+	LfExecutor *executor;
+	LfExecutorWorker *worker;
+	GError *error = NULL;
+	gpointer mem;
+	guint i;
+
+	g_return_val_if_fail(func != NULL, NULL);
+	g_return_val_if_fail(n_workers > 0, NULL);
+
+	if (posix_memalign(&mem, LF_CACHE_LINE,
+	                   sizeof(LfExecutorWorker) * n_workers) != 0)
+		g_error("Failed to allocate %" G_GSIZE_FORMAT " bytes",
+		        sizeof(LfExecutorWorker) * n_workers);
+
+	executor = g_new0(LfExecutor, 1);
+	executor->func = func;
+	executor->user_data = user_data;
+	executor->n_workers = n_workers;
+	executor->workers = mem;
+	executor->injector = lf_queue_new();
+
+	for (i = 0; i < n_workers; i++) {
+		worker = &executor->workers[i];
+		worker->executor = executor;
+		worker->deque = lf_deque_new();
+		worker->seed = g_random_int() | 1;
+	}
+
+	/*
+	 * Workers steal from each other straight away, so every deque has to
+	 * exist before the first thread starts.
+	 */
+	for (i = 0; i < n_workers; i++) {
+		worker = &executor->workers[i];
+		worker->thread = g_thread_create(lf_executor_worker_run, worker,
+		                                 TRUE, &error);
+		if (!worker->thread)
+			g_error("Failed to start worker: %s", error->message);
+	}
+
+	return executor;
+}
+
+/*
+ * Wakes one sleeping worker, if there is one, after a task has been pushed.
+ */
+static inline void
+lf_executor_signal(LfExecutor *executor)
+{
+	if (G_UNLIKELY(lf_atomic_load(&executor->n_sleeping,
+	                              memory_order_seq_cst) > 0)) {
+		lf_atomic_int_add(&executor->wake_seq, 1, memory_order_seq_cst);
+		lf_futex_wake(&executor->wake_seq, 1);
+	}
+}
+
+/**
+ * lf_executor_push:
+ * @executor: A #LfExecutor
+ * @data: A non-%NULL task.
+ *
+ * Queues @data to be passed to the executor's function by one of its
+ * workers.  When called from a worker of @executor the task goes to that
+ * worker's own deque, otherwise it goes to the shared injector queue.
+ *
+ * Side effects: May wake up a sleeping worker.
+ */
+void
+lf_executor_push(LfExecutor *executor,
+                 gpointer    data)
+{
+	LfExecutorWorker *worker;
+
+	g_return_if_fail(executor != NULL);
+	g_return_if_fail(data != NULL);
+
+	worker = g_static_private_get(&lf_executor_current);
+	if (worker && worker->executor == executor) {
+		/*
+		 * Storing to the deque is not a full barrier, so a worker going
+		 * to sleep right now may be missed.  That costs parallelism but
+		 * never a task, since this worker runs it if nobody steals it.
+		 */
+		lf_deque_push(worker->deque, data);
+	} else {
+		lf_queue_enqueue(executor->injector, data);
+	}
+
+	lf_executor_signal(executor);
+}
+
+/**
+ * lf_executor_get_n_workers:
+ * @executor: A #LfExecutor
+ *
+ * Retrieves the number of worker threads of @executor.
+ *
+ * Returns: The number of workers.
+ * Side effects: None.
+ */
+guint
+lf_executor_get_n_workers(LfExecutor *executor)
+{
+	g_return_val_if_fail(executor != NULL, 0);
+
+	return executor->n_workers;
+}
+
+/**
+ * lf_executor_free:
+ * @executor: A #LfExecutor
+ *
+ * Runs every task that has been pushed, including those pushed by the
+ * tasks themselves, then stops the workers and frees @executor.  It must
+ * not be called from one of the executor's own workers, or while other
+ * threads may still push to it.
+ *
+ * Side effects: Blocks until the workers have exited.
+ */
+void
+lf_executor_free(LfExecutor *executor)
+{
+	LfExecutorWorker *worker;
+	guint i;
+
+	g_return_if_fail(executor != NULL);
+
+	worker = g_static_private_get(&lf_executor_current);
+	g_return_if_fail(!worker || worker->executor != executor);
+
+	lf_atomic_store(&executor->shutdown, TRUE, memory_order_seq_cst);
+	lf_atomic_int_add(&executor->wake_seq, 1, memory_order_seq_cst);
+	lf_futex_wake(&executor->wake_seq, G_MAXINT);
+
+	for (i = 0; i < executor->n_workers; i++)
+		g_thread_join(executor->workers[i].thread);
+	for (i = 0; i < executor->n_workers; i++)
+		lf_deque_unref(executor->workers[i].deque);
+
+	lf_queue_unref(executor->injector);
+	free(executor->workers);
+	g_free(executor);
+}
@@ -0,0 +1,43 @@
+/* lf-executor.h
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LF_EXECUTOR_H__
+#define __LF_EXECUTOR_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LfExecutor LfExecutor;
+
+LfExecutor* lf_executor_new           (GFunc       func,
+                                       gpointer    user_data,
+                                       guint       n_workers);
+void        lf_executor_push          (LfExecutor *executor,
+                                       gpointer    data);
+guint       lf_executor_get_n_workers (LfExecutor *executor);
+void        lf_executor_free          (LfExecutor *executor);
+
+G_END_DECLS
+
+#endif /* __LF_EXECUTOR_H__ */
@@ -0,0 +1,86 @@
+/* lf-futex.h
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LF_FUTEX_H__
+#define __LF_FUTEX_H__
+
+#include <glib.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+G_BEGIN_DECLS
+
+/*
+ * Blocks the calling thread as long as *addr still contains val, for at most
+ * timeout_us microseconds, or forever if timeout_us is negative.  Like the
+ * futex it wraps, this can return early for no reason at all, so callers
+ * must always re-check their condition.
+ *
+ * Platforms without futexes fall back to a short sleep, which keeps the
+ * semantics but not the latency.
+ */
+static inline void
+lf_futex_wait(volatile gint *addr,
+              gint           val,
+              gint64         timeout_us)
+{
+#ifdef __linux__
+	struct timespec ts, *tsp = NULL;
+
+	if (timeout_us >= 0) {
+		ts.tv_sec = timeout_us / G_USEC_PER_SEC;
+		ts.tv_nsec = (timeout_us % G_USEC_PER_SEC) * 1000;
+		tsp = &ts;
+	}
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, tsp, NULL, 0);
+#else
+	if (g_atomic_int_get(addr) == val)
+		g_usleep((timeout_us < 0) ? 1000 : MIN(timeout_us, 1000));
+#endif
+}
+
+/*
+ * Wakes up to n_waiters threads blocked in lf_futex_wait() on addr.  The
+ * caller must change *addr before calling this or the waiters may simply go
+ * back to sleep.
+ */
+static inline void
+lf_futex_wake(volatile gint *addr,
+              gint           n_waiters)
+{
+#ifdef __linux__
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n_waiters, NULL, NULL, 0);
+#else
+	(void)addr;
+	(void)n_waiters;
+#endif
+}
+
+G_END_DECLS
+
+#endif /* __LF_FUTEX_H__ */
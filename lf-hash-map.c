@@ -0,0 +1,576 @@
+/* lf-hash-map.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "lf-atomic.h"
+#include "lf-hash-map.h"
+#include "lf-hazard.h"
+
+/**
+ * @LF_HASH_MAP_MIN_ORDER: The base two logarithm of the number of buckets
+ *                         in the first segment of the bucket table, which is
+ *                         also the initial number of buckets.
+ */
+#define LF_HASH_MAP_MIN_ORDER (4)
+
+/**
+ * @LF_HASH_MAP_MAX_ORDER: The base two logarithm of the largest number of
+ *                         buckets the table will grow to.
+ */
+#define LF_HASH_MAP_MAX_ORDER (30)
+
+/**
+ * @LF_HASH_MAP_LOAD_FACTOR: The average number of items per bucket at which
+ *                           the number of buckets is doubled.
+ */
+#define LF_HASH_MAP_LOAD_FACTOR (2)
+
+#define LF_HASH_MAP_N_SEGMENTS (LF_HASH_MAP_MAX_ORDER - LF_HASH_MAP_MIN_ORDER + 1)
+
+/*
+ * The list links carry a mark in their low bit once the node owning the link
+ * has been logically removed.
+ */
+#define LF_HASH_MARKED(p)  ((GPOINTER_TO_SIZE(p) & 1) != 0)
+#define LF_HASH_MARK(p)    ((LfHashNode *)(GPOINTER_TO_SIZE(p) | 1))
+#define LF_HASH_UNMARK(p)  ((LfHashNode *)(GPOINTER_TO_SIZE(p) & ~(gsize)1))
+
+typedef struct _LfHashNode LfHashNode;
+typedef struct _LfHashFind LfHashFind;
+
+/*
+ * All of the items live in one linked-list sorted by so_key, the bit reversed
+ * hash of their key.  Bit reversal means that when the table doubles, each
+ * bucket's items split into two runs that are already contiguous in the
+ * list, so growing never moves an item.  Each bucket points at a dummy node
+ * marking where its run begins.  Dummy nodes have even keys and items have
+ * odd keys, so a dummy always sorts before the items of its bucket.
+ */
+struct _LfHashNode {
+	guint       so_key;
+	gpointer    key;
+	gpointer    value;
+	LfHashNode *next;
+};
+
+/*
+ * The position found by lf_hash_map_find().  prev is the link pointing at
+ * cur, and next is the link out of cur.  While the calling thread holds
+ * them, hazard slot 0 protects next, 1 protects cur and 2 protects the node
+ * owning prev.
+ */
+struct _LfHashFind {
+	LfHashNode **prev;
+	LfHashNode  *cur;
+	LfHashNode  *next;
+};
+
+/*
+ * The bucket table is split into segments which are allocated as the table
+ * grows and never move.  Segment 0 holds the first 2^MIN_ORDER buckets and
+ * each segment after it holds as many buckets as all the ones before it
+ * combined.  size is the number of buckets currently in use and count the
+ * number of items.
+ */
+struct _LfHashMap {
+	LfHashNode      **segments[LF_HASH_MAP_N_SEGMENTS];
+	volatile gint     size;
+	volatile gint     count;
+	volatile gint     ref_count;
+	GHashFunc         hash_func;
+	GEqualFunc        key_equal_func;
+	LfHazardDomain   *domain;
+};
+
+/*
+ * Michael's list algorithm needs three hazard pointers, one more than the
+ * default domain offers, so all hash maps share a domain of their own.
+ */
+static LfHazardDomain*
+lf_hash_map_get_domain(void)
+{
+	static LfHazardDomain *domain = NULL;
+	LfHazardDomain *tmp;
+
+	if (g_once_init_enter((gsize *)&domain)) {
+		tmp = lf_hazard_domain_new(3);
+		g_once_init_leave((gsize *)&domain, (gsize)tmp);
+	}
+
+	return domain;
+}
+
+static inline guint
+lf_hash_map_reverse(guint v)
+{
+	v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+	v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+	v = ((v >> 4) & 0x0F0F0F0F) | ((v & 0x0F0F0F0F) << 4);
+	v = ((v >> 8) & 0x00FF00FF) | ((v & 0x00FF00FF) << 8);
+	return (v >> 16) | (v << 16);
+}
+
+static LfHashNode*
+lf_hash_node_new(guint    so_key,
+                 gpointer key,
+                 gpointer value)
+{
+	LfHashNode *node;
+
+	node = g_slice_new(LfHashNode);
+	node->so_key = so_key;
+	node->key = key;
+	node->value = value;
+	node->next = NULL;
+
+	return node;
+}
+
+static void
+lf_hash_node_free(LfHashNode *node)
+{
+	g_slice_free(LfHashNode, node);
+}
+
+/*
+ * Returns the location of bucket in the table, allocating its segment if
+ * needed.  Racing allocations are resolved with a CAS and the loser frees
+ * its copy.
+ */
+static LfHashNode**
+lf_hash_map_bucket(LfHashMap *map,
+                   guint      bucket)
+{
+	LfHashNode **segment;
+	guint order, seg, index, n_buckets;
+
+	if (bucket < (1U << LF_HASH_MAP_MIN_ORDER)) {
+		seg = 0;
+		index = bucket;
+		n_buckets = 1U << LF_HASH_MAP_MIN_ORDER;
+	} else {
+		order = g_bit_storage(bucket) - 1;
+		seg = order - LF_HASH_MAP_MIN_ORDER + 1;
+		index = bucket - (1U << order);
+		n_buckets = 1U << order;
+	}
+
+	segment = lf_atomic_load(&map->segments[seg], memory_order_acquire);
+	if (G_UNLIKELY(!segment)) {
+		segment = g_new0(LfHashNode*, n_buckets);
+		if (!lf_atomic_pointer_cas(&map->segments[seg], NULL, segment,
+		                           memory_order_acq_rel)) {
+			g_free(segment);
+			segment = lf_atomic_load(&map->segments[seg],
+			                         memory_order_acquire);
+		}
+	}
+
+	return &segment[index];
+}
+
+/*
+ * Searches the list starting at head for so_key and key, or just for so_key
+ * when it is the even key of a dummy node.  Marked nodes met on the way are
+ * unlinked and retired.
+ *
+ * Returns: TRUE if found, in which case f->cur is the node.  Otherwise f->cur
+ *   is the first node after where it would be inserted.
+ */
+static gboolean
+lf_hash_map_find(LfHashMap     *map,
+                 LfHazard      *myhazard,
+                 LfHashNode    *head,
+                 guint          so_key,
+                 gconstpointer  key,
+                 LfHashFind    *f)
+{
+	guint cur_key;
+
+try_again:
+	f->prev = &head->next;
+	f->cur = lf_atomic_load(f->prev, memory_order_acquire);
+	LF_HAZARD_SET(1, f->cur);
+	if (lf_atomic_load(f->prev, memory_order_seq_cst) != f->cur)
+		goto try_again;
+
+	while (TRUE) {
+		if (f->cur == NULL)
+			return FALSE;
+		f->next = lf_atomic_load(&f->cur->next, memory_order_acquire);
+		LF_HAZARD_SET(0, LF_HASH_UNMARK(f->next));
+		if (lf_atomic_load(&f->cur->next,
+		                   memory_order_seq_cst) != f->next)
+			goto try_again;
+		cur_key = f->cur->so_key;
+		if (lf_atomic_load(f->prev, memory_order_seq_cst) != f->cur)
+			goto try_again;
+
+		if (!LF_HASH_MARKED(f->next)) {
+			if (cur_key > so_key)
+				return FALSE;
+			if (cur_key == so_key &&
+			    (!(so_key & 1) || map->key_equal_func(f->cur->key, key)))
+				return TRUE;
+			f->prev = &f->cur->next;
+			LF_HAZARD_SET(2, f->cur);
+		} else {
+			/*
+			 * cur has been removed, help unlink it.
+			 */
+			if (!lf_atomic_pointer_cas(f->prev, f->cur,
+			                           LF_HASH_UNMARK(f->next),
+			                           memory_order_seq_cst))
+				goto try_again;
+			LF_HAZARD_UNSET(f->cur, lf_hash_node_free);
+		}
+		f->cur = LF_HASH_UNMARK(f->next);
+		LF_HAZARD_SET(1, f->cur);
+	}
+}
+
+/*
+ * Returns the dummy node of bucket, creating it first if needed by splitting
+ * it off of its parent bucket, the bucket with the same index minus its most
+ * significant bit.
+ */
+static LfHashNode*
+lf_hash_map_get_bucket(LfHashMap *map,
+                       LfHazard  *myhazard,
+                       guint      bucket)
+{
+	LfHashNode **slot, *parent, *dummy;
+	LfHashFind f;
+	guint so_key;
+
+	slot = lf_hash_map_bucket(map, bucket);
+	if (G_LIKELY((dummy = lf_atomic_load(slot, memory_order_acquire))))
+		return dummy;
+
+	parent = lf_hash_map_get_bucket(map, myhazard,
+	                                bucket & ~(1U << (g_bit_storage(bucket) - 1)));
+
+	so_key = lf_hash_map_reverse(bucket);
+	dummy = lf_hash_node_new(so_key, NULL, NULL);
+	while (TRUE) {
+		if (lf_hash_map_find(map, myhazard, parent, so_key, NULL, &f)) {
+			/*
+			 * Another thread beat us to it.  Dummy nodes are never
+			 * removed, so its node is safe to use without a hazard.
+			 */
+			lf_hash_node_free(dummy);
+			dummy = f.cur;
+			break;
+		}
+		dummy->next = f.cur;
+		if (lf_atomic_pointer_cas(f.prev, f.cur, dummy,
+		                          memory_order_seq_cst))
+			break;
+	}
+	lf_atomic_store(slot, dummy, memory_order_release);
+
+	return dummy;
+}
+
+static void
+lf_hash_map_destroy(LfHashMap *map)
+{
+	LfHashNode *node, *next;
+	gint i;
+
+	g_return_if_fail(map != NULL);
+
+	/*
+	 * Bucket 0's dummy heads the whole list, every other node follows it.
+	 */
+	for (node = map->segments[0][0]; node; node = next) {
+		next = LF_HASH_UNMARK(node->next);
+		lf_hash_node_free(node);
+	}
+	for (i = 0; i < LF_HASH_MAP_N_SEGMENTS; i++)
+		g_free(map->segments[i]);
+}
+
+/**
+ * lf_hash_map_new:
+ * @hash_func: A function to create a hash value from a key.
+ * @key_equal_func: A function to check two keys for equality.
+ *
+ * Creates a new instance of #LfHashMap.  The #LfHashMap structure is
+ * reference counted and should be freed using lf_hash_map_unref().
+ *
+ * The map does not own its keys or values.  Keys and values must remain
+ * valid for as long as they are in the map and values must be non-%NULL.
+ *
+ * Returns: The newly created #LfHashMap.
+ * Side effects: None.
+ */
+LfHashMap*
+lf_hash_map_new(GHashFunc  hash_func,
+                GEqualFunc key_equal_func)
+{
+	LfHashMap *map;
+
+	g_return_val_if_fail(hash_func != NULL, NULL);
+	g_return_val_if_fail(key_equal_func != NULL, NULL);
+
+	map = g_slice_new0(LfHashMap);
+	map->size = 1 << LF_HASH_MAP_MIN_ORDER;
+	map->ref_count = 1;
+	map->hash_func = hash_func;
+	map->key_equal_func = key_equal_func;
+	map->domain = lf_hash_map_get_domain();
+	*lf_hash_map_bucket(map, 0) = lf_hash_node_new(0, NULL, NULL);
+
+	return map;
+}
+
+/**
+ * lf_hash_map_ref:
+ * @map: A #LfHashMap
+ *
+ * Atomically increments the reference count of @map by one.
+ *
+ * Returns: A reference to @map.
+ * Side effects: None.
+ */
+LfHashMap*
+lf_hash_map_ref(LfHashMap *map)
+{
+	g_return_val_if_fail(map != NULL, NULL);
+	g_return_val_if_fail(map->ref_count > 0, NULL);
+
+	g_atomic_int_inc(&map->ref_count);
+	return map;
+}
+
+/**
+ * lf_hash_map_unref:
+ * @map: A #LfHashMap
+ *
+ * Decrements the reference count of @map by one.  When the reference count
+ * reaches zero, the structures allocations are released and the map is
+ * freed.
+ */
+void
+lf_hash_map_unref(LfHashMap *map)
+{
+	g_return_if_fail(map != NULL);
+	g_return_if_fail(map->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&map->ref_count)) {
+		lf_hash_map_destroy(map);
+		g_slice_free(LfHashMap, map);
+	}
+}
+
+/**
+ * lf_hash_map_get_type:
+ *
+ * Retrieves the GObject type system's type identifier for #LfHashMap.
+ *
+ * Returns: A #GType containing the type id.
+ * Side effects: Registers the #LfHashMap type if not already.
+ */
+GType
+lf_hash_map_get_type(void)
+{
+	static GType type_id = 0;
+	GType tmp_id;
+
+	if (g_once_init_enter((gsize *)&type_id)) {
+		tmp_id = g_boxed_type_register_static("LfHashMap",
+		                                      (GBoxedCopyFunc)lf_hash_map_ref,
+		                                      (GBoxedFreeFunc)lf_hash_map_unref);
+		g_once_init_leave((gsize *)&type_id, tmp_id);
+	}
+
+	return type_id;
+}
+
+/**
+ * lf_hash_map_insert:
+ * @map: A #LfHashMap
+ * @key: The key to insert.
+ * @value: A non-%NULL value to associate with @key.
+ *
+ * Inserts @key into @map with @value, unless @key is already present.
+ * Inserting may double the number of buckets; the new buckets are split off
+ * of the old ones lazily as they are first used.
+ *
+ * Returns: %TRUE if @key was inserted, %FALSE if it was already present.
+ *
+ * Side effects: Hazard pointer reclaimation can occur meaning that structures
+ *   no longer in use may be freed by the system.
+ */
+gboolean
+lf_hash_map_insert(LfHashMap     *map,
+                   gconstpointer  key,
+                   gconstpointer  value)
+{
+	LfHashNode *head, *node;
+	LfHashFind f;
+	guint hash;
+	gint size, count;
+	LF_HAZARD_INIT;
+
+	g_return_val_if_fail(map != NULL, FALSE);
+	g_return_val_if_fail(value != NULL, FALSE);
+
+	LF_HAZARD_ENTER(map->domain);
+
+	hash = map->hash_func(key);
+	size = lf_atomic_load(&map->size, memory_order_relaxed);
+	head = lf_hash_map_get_bucket(map, LF_HAZARD_TLS, hash & (size - 1));
+	node = lf_hash_node_new(lf_hash_map_reverse(hash) | 1,
+	                        (gpointer)key, (gpointer)value);
+
+	while (TRUE) {
+		if (lf_hash_map_find(map, LF_HAZARD_TLS, head, node->so_key, key, &f)) {
+			lf_hash_node_free(node);
+			return FALSE;
+		}
+		node->next = f.cur;
+		if (lf_atomic_pointer_cas(f.prev, f.cur, node,
+		                          memory_order_seq_cst))
+			break;
+	}
+
+	count = lf_atomic_int_add(&map->count, 1, memory_order_relaxed) + 1;
+	if (count > size * LF_HASH_MAP_LOAD_FACTOR &&
+	    size < (1 << LF_HASH_MAP_MAX_ORDER))
+		lf_atomic_int_cas(&map->size, size, size * 2,
+		                  memory_order_relaxed);
+
+	return TRUE;
+}
+
+/**
+ * lf_hash_map_lookup:
+ * @map: A #LfHashMap
+ * @key: The key to look up.
+ *
+ * Looks up @key in @map.  Lookups only ever write to shared memory to help
+ * unlink an item another thread is in the middle of removing.
+ *
+ * Returns: The value associated with @key, or %NULL if not present.
+ *
+ * Side effects: Hazard pointer reclaimation can occur meaning that structures
+ *   no longer in use may be freed by the system.
+ */
+gpointer
+lf_hash_map_lookup(LfHashMap     *map,
+                   gconstpointer  key)
+{
+	LfHashNode *head;
+	LfHashFind f;
+	guint hash, size;
+	LF_HAZARD_INIT;
+
+	g_return_val_if_fail(map != NULL, NULL);
+
+	LF_HAZARD_ENTER(map->domain);
+
+	hash = map->hash_func(key);
+	size = lf_atomic_load(&map->size, memory_order_relaxed);
+	head = lf_hash_map_get_bucket(map, LF_HAZARD_TLS, hash & (size - 1));
+	if (lf_hash_map_find(map, LF_HAZARD_TLS, head,
+	                     lf_hash_map_reverse(hash) | 1, key, &f))
+		return f.cur->value;
+	return NULL;
+}
+
+/**
+ * lf_hash_map_remove:
+ * @map: A #LfHashMap
+ * @key: The key to remove.
+ *
+ * Removes @key from @map.
+ *
+ * Returns: The value that was associated with @key, or %NULL if not present.
+ *
+ * Side effects: Hazard pointer reclaimation can occur meaning that structures
+ *   no longer in use may be freed by the system.
+ */
+gpointer
+lf_hash_map_remove(LfHashMap     *map,
+                   gconstpointer  key)
+{
+	LfHashNode *head;
+	LfHashFind f;
+	gpointer value;
+	guint hash, so_key, size;
+	LF_HAZARD_INIT;
+
+	g_return_val_if_fail(map != NULL, NULL);
+
+	LF_HAZARD_ENTER(map->domain);
+
+	hash = map->hash_func(key);
+	so_key = lf_hash_map_reverse(hash) | 1;
+	size = lf_atomic_load(&map->size, memory_order_relaxed);
+	head = lf_hash_map_get_bucket(map, LF_HAZARD_TLS, hash & (size - 1));
+
+	while (TRUE) {
+		if (!lf_hash_map_find(map, LF_HAZARD_TLS, head, so_key, key, &f))
+			return NULL;
+		/*
+		 * Marking the link out of cur is what removes it.  Only one
+		 * thread can succeed, the rest will go looking again.
+		 */
+		if (lf_atomic_pointer_cas(&f.cur->next, f.next,
+		                          LF_HASH_MARK(f.next),
+		                          memory_order_seq_cst))
+			break;
+	}
+
+	value = f.cur->value;
+	lf_atomic_int_add(&map->count, -1, memory_order_relaxed);
+
+	/*
+	 * Try to unlink it ourselves, otherwise have find do it for us.
+	 */
+	if (lf_atomic_pointer_cas(f.prev, f.cur, f.next, memory_order_seq_cst))
+		LF_HAZARD_UNSET(f.cur, lf_hash_node_free);
+	else
+		lf_hash_map_find(map, LF_HAZARD_TLS, head, so_key, key, &f);
+
+	return value;
+}
+
+/**
+ * lf_hash_map_size:
+ * @map: A #LfHashMap
+ *
+ * Retrieves the number of items in @map.  With concurrent updates this is
+ * only a snapshot.
+ *
+ * Returns: The number of items.
+ * Side effects: None.
+ */
+guint
+lf_hash_map_size(LfHashMap *map)
+{
+	g_return_val_if_fail(map != NULL, 0);
+
+	return MAX(lf_atomic_load(&map->count, memory_order_relaxed), 0);
+}
@@ -0,0 +1,44 @@
+/* lf-hash-map.h
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LF_HASH_MAP_H__
+#define __LF_HASH_MAP_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LfHashMap LfHashMap;
+
+GType      lf_hash_map_get_type (void) G_GNUC_CONST;
+LfHashMap* lf_hash_map_new      (GHashFunc hash_func, GEqualFunc key_equal_func);
+LfHashMap* lf_hash_map_ref      (LfHashMap *map);
+void       lf_hash_map_unref    (LfHashMap *map);
+gboolean   lf_hash_map_insert   (LfHashMap *map, gconstpointer key, gconstpointer value);
+gpointer   lf_hash_map_lookup   (LfHashMap *map, gconstpointer key);
+gpointer   lf_hash_map_remove   (LfHashMap *map, gconstpointer key);
+guint      lf_hash_map_size     (LfHashMap *map);
+
+G_END_DECLS
+
+#endif /* __LF_HASH_MAP_H__ */
@@ -0,0 +1,793 @@
+/* lf-hazard.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef LF_ENABLE_STATS
+#include <time.h>
+#endif
+
+#ifdef LF_HAZARD_MEMBARRIER
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "lf-futex.h"
+#include "lf-hazard.h"
+
+/*
+ * A batch of retired pointers left behind by a thread that exited before it
+ * could reclaim them, or handed off to the domain's reclaimer thread.
+ * Batches are pushed onto their domain's orphan list and drained by the
+ * reclaimer, or otherwise the next live thread to collect.
+ *
+ * retired is the rlist array of the thread that handed the batch off, which
+ * took the batch's previous, empty, array in exchange.  Drained batches go
+ * onto the domain's spares list to be swapped in again, so that a hand off
+ * neither copies the pointers nor touches the heap.
+ */
+struct _LfHazardOrphan {
+	LfHazardOrphan  *next;
+	LfHazardRetired *retired;
+	gint             n_retired;
+	gint             size;
+};
+
+/*
+ * A hazard pointer domain.  Every structure protected by the same domain
+ * shares its hazard records, so one scan reclaims pointers retired by all of
+ * them.
+ *
+ * records is the linked-list of all hazard records ever created in the
+ * domain and n_hazards is the total count of their hazard pointer slots
+ * (_LF_H).  Records of exited threads are reused, so both are bounded by the
+ * peak number of concurrent threads.  n_active counts only the slots of
+ * records owned by live threads; it drives the scan threshold since the
+ * slots of released records are always empty.  tls holds the record of the
+ * calling thread.
+ *
+ * n_pending counts the pointers on the orphan list.  While reclaiming is set
+ * a reclaimer thread adopts the list as it fills, and threads due for a scan
+ * push their retired pointers onto it instead unless n_pending would exceed
+ * max_pending.  The reclaimer sleeps on reclaimer_seq with sleeping set.
+ * spares holds the drained batches until a thread handing off takes them.
+ */
+struct _LfHazardDomain {
+	LfHazard       *records;
+	volatile gint   n_hazards;
+	volatile gint   n_active;
+	guint           n_slots;
+	LfHazardOrphan *orphans;
+	LfHazardOrphan *spares;
+	volatile gint   n_pending;
+	GStaticPrivate  tls;
+	volatile gint   reclaiming;
+	volatile gint   sleeping;
+	volatile gint   reclaimer_seq;
+	guint           max_pending;
+	GThread        *reclaimer;
+};
+
+/*
+ * Sorting method for the hazard pointer snapshot.
+ */
+static gint
+lf_hazard_pointer_compare(gconstpointer a,
+                          gconstpointer b)
+{
+	gconstpointer pa = *(const gpointer *)a;
+	gconstpointer pb = *(const gpointer *)b;
+
+	return (pa < pb) ? -1 : (pa > pb);
+}
+
+#ifdef LF_ENABLE_STATS
+static inline guint64
+lf_hazard_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+#ifdef LF_HAZARD_MEMBARRIER
+gboolean _lf_hazard_membarrier = FALSE;
+
+/*
+ * Registers the process for expedited membarrier() commands.  Publishers
+ * only drop their barrier once this has succeeded, and every thread passes
+ * through here before it first publishes a hazard pointer.
+ */
+static void
+lf_hazard_membarrier_init(void)
+{
+	static gsize initialized = 0;
+
+	if (g_once_init_enter(&initialized)) {
+		_lf_hazard_membarrier =
+			syscall(__NR_membarrier,
+			        MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+		g_once_init_leave(&initialized, 1);
+	}
+}
+#endif
+
+/*
+ * Orders the unlinking of the pointers about to be checked before the reads
+ * of the hazard pointers.  With membarrier() it also stands in for the
+ * barrier that publishers left out.
+ */
+static inline void
+lf_hazard_barrier(void)
+{
+#ifdef LF_HAZARD_MEMBARRIER
+	if (G_LIKELY(_lf_hazard_membarrier)) {
+		syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+		return;
+	}
+#endif
+	lf_atomic_fence(memory_order_seq_cst);
+}
+
+/**
+ * lf_hazard_domain_new:
+ * @n_slots: The number of hazard pointers each thread needs at once.
+ *
+ * Creates a new hazard pointer domain.  Structures needing no more than
+ * %LF_HAZARD_K hazard pointers should share the default domain from
+ * lf_hazard_domain_get_default() instead, so that they share scans.
+ *
+ * Threads keep their hazard records in a domain until they exit, so domains
+ * are meant to be created once per kind of structure and never freed.
+ *
+ * Returns: The newly created #LfHazardDomain.
+ * Side effects: None.
+ */
+LfHazardDomain*
+lf_hazard_domain_new(guint n_slots)
+{
+	LfHazardDomain *domain;
+
+	g_return_val_if_fail(n_slots > 0, NULL);
+
+	domain = g_slice_new0(LfHazardDomain);
+	domain->n_slots = n_slots;
+	g_static_private_init(&domain->tls);
+
+	return domain;
+}
+
+/**
+ * lf_hazard_domain_get_default:
+ *
+ * Retrieves the process wide hazard pointer domain, which has %LF_HAZARD_K
+ * hazard pointers per thread.
+ *
+ * Returns: The default #LfHazardDomain.
+ * Side effects: Creates the domain if not already.
+ */
+LfHazardDomain*
+lf_hazard_domain_get_default(void)
+{
+	static LfHazardDomain *domain = NULL;
+	LfHazardDomain *tmp;
+
+	if (g_once_init_enter((gsize *)&domain)) {
+		tmp = lf_hazard_domain_new(LF_HAZARD_K);
+		g_once_init_leave((gsize *)&domain, (gsize)tmp);
+	}
+
+	return domain;
+}
+
+/**
+ * lf_hazard_domain_get_n_slots:
+ * @domain: A #LfHazardDomain
+ *
+ * Retrieves the number of hazard pointers each thread has in @domain.
+ *
+ * Returns: The number of hazard pointer slots.
+ * Side effects: None.
+ */
+guint
+lf_hazard_domain_get_n_slots(LfHazardDomain *domain)
+{
+	g_return_val_if_fail(domain != NULL, 0);
+
+	return domain->n_slots;
+}
+
+/*
+ * Recomputes the number of retired pointers at which the record is due for a
+ * scan.  Keeping it in the record saves the fast path a trip to the domain.
+ */
+static inline void
+lf_hazard_update_threshold(LfHazard *hazard)
+{
+	hazard->rthreshold = lf_atomic_load(&hazard->domain->n_active,
+	                                    memory_order_relaxed) +
+	                     LF_HAZARD_R;
+}
+
+/**
+ * lf_hazard_rlist_grow:
+ * @hazard: A #LfHazard
+ *
+ * Grows the rlist of @hazard.  Called by lf_hazard_push() when full, which
+ * only happens after more threads have entered the domain.
+ *
+ * Side effects: None.
+ */
+void
+lf_hazard_rlist_grow(LfHazard *hazard)
+{
+	gint size;
+
+	size = MAX(hazard->rsize * 2,
+	           lf_atomic_load(&hazard->domain->n_hazards,
+	                          memory_order_relaxed) + LF_HAZARD_R);
+	hazard->rlist = g_renew(LfHazardRetired, hazard->rlist, size);
+	hazard->rsize = size;
+}
+
+static void lf_hazard_thread_release (LfHazard *hazard);
+
+/*
+ * Takes an empty batch from the record's spares, refilling them with the
+ * domain's whole spares list when they run out.  Like the orphan list, the
+ * spares list is only ever emptied at once, which is immune to ABA.  A new
+ * batch is only allocated while none have been drained yet.
+ */
+static LfHazardOrphan*
+lf_hazard_orphan_get(LfHazard *hazard)
+{
+	LfHazardDomain *domain = hazard->domain;
+	LfHazardOrphan *orphan;
+
+	if (!hazard->spares) {
+		do {
+			orphan = lf_atomic_load(&domain->spares,
+			                        memory_order_relaxed);
+		} while (orphan &&
+		         !lf_atomic_pointer_cas(&domain->spares, orphan, NULL,
+		                                memory_order_acquire));
+		hazard->spares = orphan;
+	}
+
+	orphan = hazard->spares;
+	if (G_LIKELY(orphan)) {
+		hazard->spares = orphan->next;
+		return orphan;
+	}
+
+	orphan = g_slice_new(LfHazardOrphan);
+	orphan->size = hazard->rsize;
+	orphan->retired = g_new(LfHazardRetired, orphan->size);
+
+	return orphan;
+}
+
+/*
+ * Moves the retired pointers of hazard onto the domain's orphan list as one
+ * batch, waking the reclaimer if it is asleep.  The batch takes the rlist
+ * array as is and hands its own empty one back.  The push and the check for
+ * a sleeping reclaimer are seq_cst, as are the reclaimer's counterparts, so
+ * either we see it asleep or it sees the batch.
+ */
+static void
+lf_hazard_orphan_push(LfHazard *hazard)
+{
+	LfHazardDomain *domain = hazard->domain;
+	LfHazardOrphan *orphan;
+	LfHazardRetired *rlist;
+	gint rsize;
+
+	orphan = lf_hazard_orphan_get(hazard);
+	rlist = orphan->retired;
+	rsize = orphan->size;
+	orphan->retired = hazard->rlist;
+	orphan->size = hazard->rsize;
+	orphan->n_retired = hazard->rcount;
+	hazard->rlist = rlist;
+	hazard->rsize = rsize;
+	lf_atomic_store(&hazard->rcount, 0, memory_order_relaxed);
+
+	lf_atomic_int_add(&domain->n_pending, orphan->n_retired,
+	                  memory_order_relaxed);
+	do {
+		orphan->next = lf_atomic_load(&domain->orphans, memory_order_relaxed);
+	} while (!lf_atomic_pointer_cas(&domain->orphans, orphan->next, orphan,
+	                                memory_order_seq_cst));
+
+	if (lf_atomic_load(&domain->sleeping, memory_order_seq_cst)) {
+		lf_atomic_int_add(&domain->reclaimer_seq, 1, memory_order_release);
+		lf_futex_wake(&domain->reclaimer_seq, 1);
+	}
+}
+
+/*
+ * Method to acquire thread local data structures for hazard pointer
+ * operation.  This is called automatically as needed when a new thread
+ * enters the domain.  The record is released again when the thread exits.
+ */
+static LfHazard*
+lf_hazard_thread_acquire(LfHazardDomain *domain)
+{
+	LfHazard *hazard, *old_head;
+	gint old_count;
+
+#ifdef LF_HAZARD_MEMBARRIER
+	lf_hazard_membarrier_init();
+#endif
+
+	lf_atomic_int_add(&domain->n_active, domain->n_slots, memory_order_relaxed);
+
+	/*
+	 * Try to reclaim an existing, unused LfHazard structure.  Taking it
+	 * acquires whatever its last owner did before releasing it.
+	 */
+	for (hazard = lf_atomic_load(&domain->records, memory_order_acquire);
+	     hazard; hazard = hazard->next) {
+		if (lf_atomic_load(&hazard->active, memory_order_relaxed))
+			continue;
+		if (!lf_atomic_int_cas(&hazard->active, FALSE, TRUE,
+		                       memory_order_acquire))
+			continue;
+		lf_hazard_update_threshold(hazard);
+		g_static_private_set(&domain->tls, hazard,
+		                     (GDestroyNotify)lf_hazard_thread_release);
+		return hazard;
+	}
+
+	/*
+	 * No LfHazard could be reused.  We will create one and push it onto
+	 * the head of the linked-list.
+	 */
+	old_count = lf_atomic_int_add(&domain->n_hazards, domain->n_slots,
+	                              memory_order_relaxed);
+	hazard = g_slice_new0(LfHazard);
+	hazard->hp = g_new0(gpointer, domain->n_slots);
+	hazard->domain = domain;
+	hazard->active = TRUE;
+	hazard->id = old_count / domain->n_slots;
+	hazard->rsize = old_count + domain->n_slots + LF_HAZARD_R;
+	hazard->rlist = g_new(LfHazardRetired, hazard->rsize);
+	hazard->psize = old_count + domain->n_slots;
+	hazard->plist = g_new(gpointer, hazard->psize);
+	lf_hazard_update_threshold(hazard);
+	do {
+		old_head = lf_atomic_load(&domain->records, memory_order_relaxed);
+		hazard->next = old_head;
+	} while (!lf_atomic_pointer_cas(&domain->records, old_head, hazard,
+	                                memory_order_release));
+	g_static_private_set(&domain->tls, hazard,
+	                     (GDestroyNotify)lf_hazard_thread_release);
+
+	return hazard;
+}
+
+/*
+ * Thread exit hook that releases the thread's hazard record.  Its hazard
+ * pointers are cleared and its retired pointers are handed to the domain's
+ * orphan list rather than freed here, since the reclaim callbacks may rely on
+ * thread local state that is already gone.  Only then is the record marked
+ * inactive, so the next thread to take it over starts out empty.
+ */
+static void
+lf_hazard_thread_release(LfHazard *hazard)
+{
+	LfHazardDomain *domain = hazard->domain;
+	guint i;
+
+	for (i = 0; i < domain->n_slots; i++)
+		lf_atomic_store(&hazard->hp[i], NULL, memory_order_release);
+
+	if (hazard->rcount > 0)
+		lf_hazard_orphan_push(hazard);
+
+	lf_atomic_int_add(&domain->n_active, -(gint)domain->n_slots,
+	                  memory_order_relaxed);
+	lf_atomic_store(&hazard->active, FALSE, memory_order_release);
+}
+
+/**
+ * lf_hazard_get:
+ * @domain: A #LfHazardDomain
+ *
+ * Retrieves the calling thread's hazard record in @domain.
+ *
+ * Returns: The thread's #LfHazard.
+ * Side effects: Acquires a hazard record for the thread if it has none yet.
+ */
+LfHazard*
+lf_hazard_get(LfHazardDomain *domain)
+{
+	LfHazard *hazard;
+
+	hazard = g_static_private_get(&domain->tls);
+	if (G_UNLIKELY(!hazard))
+		hazard = lf_hazard_thread_acquire(domain);
+
+	return hazard;
+}
+
+/**
+ * lf_hazard_thread_leave:
+ * @domain: A #LfHazardDomain
+ *
+ * Releases the calling thread's hazard record in @domain right away rather
+ * than when the thread exits.  Long running threads, such as the workers of
+ * a pool, can take their record with lf_hazard_get() when they start and hand
+ * it back with this when they are done, so neither step lands in the middle
+ * of an operation.  The thread may enter the domain again later.
+ *
+ * Side effects: Any pointers the thread retired that are still hazardous
+ *   are handed to the domain to be freed by another thread.
+ */
+void
+lf_hazard_thread_leave(LfHazardDomain *domain)
+{
+	g_return_if_fail(domain != NULL);
+
+	/*
+	 * Replacing the thread local record runs its destroy notifier, which
+	 * is the same release that happens on thread exit.
+	 */
+	if (g_static_private_get(&domain->tls))
+		g_static_private_set(&domain->tls, NULL, NULL);
+}
+
+/*
+ * This method works in two stages.  The first stage scans all neighbor threads
+ * for hazard pointers and copies them into a flat array which is then sorted.
+ * The second stage looks to see if any hazard pointers in the threads local
+ * hazard pointers are found in the array using a binary search.  If they are
+ * not, they are ready to be reclaimed.  If they are found, we store them back
+ * into our list of hazard pointers for the next round of reclaimation.
+ */
+static void
+lf_hazard_scan(LfHazard *myhazard)
+{
+	LfHazardDomain *domain = myhazard->domain;
+	LfHazard *hazard;
+	LfHazardRetired *retired;
+	gpointer data = NULL;
+	gint i, j, n = 0;
+	guint k;
+#ifdef LF_ENABLE_STATS
+	guint64 elapsed;
+	guint64 start = lf_hazard_now_ns();
+#endif
+
+	/*
+	 * Stage 1: Collect all the current hazard pointers from active threads.
+	 * The loads pair with the seq_cst stores in lf_hazard_set().
+	 */
+	lf_hazard_barrier();
+	hazard = lf_atomic_load(&domain->records, memory_order_acquire);
+	while (hazard != NULL) {
+		for (k = 0; k < domain->n_slots; k++) {
+			data = lf_atomic_load(&hazard->hp[k], memory_order_seq_cst);
+			if (data == NULL)
+				continue;
+			if (G_UNLIKELY(n >= myhazard->psize)) {
+				myhazard->psize = MAX(myhazard->psize * 2,
+				                      lf_atomic_load(&domain->n_hazards,
+				                                     memory_order_relaxed));
+				myhazard->plist = g_renew(gpointer, myhazard->plist,
+				                          myhazard->psize);
+			}
+			myhazard->plist[n++] = data;
+		}
+		hazard = hazard->next;
+	}
+	qsort(myhazard->plist, n, sizeof(gpointer), lf_hazard_pointer_compare);
+
+	/*
+	 * Stage 2: Reclaim expired hazard pointers.  Pointers still hazardous
+	 * are compacted towards the front of the rlist in place.
+	 */
+	for (i = 0, j = 0; i < myhazard->rcount; i++) {
+		retired = &myhazard->rlist[i];
+		if (n > 0 && bsearch(&retired->data, myhazard->plist, n,
+		                     sizeof(gpointer), lf_hazard_pointer_compare)) {
+			myhazard->rlist[j++] = *retired;
+		} else {
+			retired->notify(retired->data);
+		}
+	}
+	lf_atomic_store(&myhazard->rcount, j, memory_order_relaxed);
+	lf_hazard_update_threshold(myhazard);
+
+#ifdef LF_ENABLE_STATS
+	elapsed = lf_hazard_now_ns() - start;
+	lf_atomic_store(&myhazard->n_scans, myhazard->n_scans + 1,
+	                memory_order_relaxed);
+	lf_atomic_store(&myhazard->scan_time_ns,
+	                myhazard->scan_time_ns + elapsed, memory_order_relaxed);
+	if (elapsed > myhazard->scan_max_ns)
+		lf_atomic_store(&myhazard->scan_max_ns, elapsed,
+		                memory_order_relaxed);
+#endif
+}
+
+/*
+ * Adopts the retired pointers orphaned by exited threads or handed off to the
+ * reclaimer so they are not stranded.  The whole orphan list is taken at
+ * once, which is immune to ABA just like the node depot.
+ */
+static void
+lf_hazard_adopt_orphans(LfHazard *myhazard)
+{
+	LfHazardDomain *domain = myhazard->domain;
+	LfHazardOrphan *orphans, *orphan, *last = NULL;
+	gint i;
+
+	do {
+		orphans = lf_atomic_load(&domain->orphans, memory_order_relaxed);
+		if (!orphans)
+			return;
+	} while (!lf_atomic_pointer_cas(&domain->orphans, orphans, NULL,
+	                                memory_order_acquire));
+
+	for (orphan = orphans; orphan; orphan = orphan->next) {
+		lf_atomic_int_add(&domain->n_pending, -orphan->n_retired,
+		                  memory_order_relaxed);
+		for (i = 0; i < orphan->n_retired; i++) {
+			lf_hazard_push(myhazard, orphan->retired[i].data,
+			               orphan->retired[i].notify);
+			if (myhazard->rcount >= myhazard->rthreshold)
+				lf_hazard_scan(myhazard);
+		}
+#ifdef LF_ENABLE_STATS
+		lf_atomic_store(&myhazard->n_adoptions,
+		                myhazard->n_adoptions + 1,
+		                memory_order_relaxed);
+#endif
+		last = orphan;
+	}
+
+	/*
+	 * The drained batches are still linked together, so they go onto the
+	 * spares list in one push.
+	 */
+	do {
+		last->next = lf_atomic_load(&domain->spares,
+		                            memory_order_relaxed);
+	} while (!lf_atomic_pointer_cas(&domain->spares, last->next, orphans,
+	                                memory_order_release));
+}
+
+/*
+ * Adopts any orphaned pointers and then scans, freeing everything retired by
+ * hazard that is no longer hazardous.
+ */
+static void
+lf_hazard_reclaim(LfHazard *hazard)
+{
+	if (lf_atomic_load(&hazard->domain->orphans, memory_order_relaxed))
+		lf_hazard_adopt_orphans(hazard);
+	lf_hazard_scan(hazard);
+}
+
+/**
+ * lf_hazard_collect:
+ * @hazard: A #LfHazard
+ *
+ * Adopts the pointers orphaned by threads that have exited, then reclaims
+ * every pointer retired by @hazard that no thread in its domain still holds
+ * a hazard pointer to.  LF_HAZARD_COLLECT() calls this once
+ * enough pointers have been retired.
+ *
+ * While the domain has a reclaimer thread, the retired pointers are handed
+ * to it instead, unless that would put its backlog over the limit given to
+ * lf_hazard_domain_start_reclaimer().
+ *
+ * Side effects: Retired pointers are freed with their destroy notify, or
+ *   handed to the reclaimer thread to be.
+ */
+void
+lf_hazard_collect(LfHazard *hazard)
+{
+	LfHazardDomain *domain;
+
+	g_return_if_fail(hazard != NULL);
+
+	domain = hazard->domain;
+	if (lf_atomic_load(&domain->reclaiming, memory_order_relaxed) &&
+	    hazard->rcount > 0 &&
+	    lf_atomic_load(&domain->n_pending, memory_order_relaxed) +
+	    hazard->rcount <= (gint)domain->max_pending) {
+		lf_hazard_orphan_push(hazard);
+#ifdef LF_ENABLE_STATS
+		lf_atomic_store(&hazard->n_handoffs, hazard->n_handoffs + 1,
+		                memory_order_relaxed);
+#endif
+		return;
+	}
+
+	lf_hazard_reclaim(hazard);
+}
+
+/*
+ * The reclaimer thread.  It adopts whatever is handed off as it arrives and
+ * retries the pointers that were still hazardous every
+ * LF_HAZARD_RECLAIMER_RETRY_US, so that nobody else has to scan.  On the way
+ * out its leftovers go back onto the orphan list.
+ */
+static gpointer
+lf_hazard_reclaimer_run(gpointer data)
+{
+	LfHazardDomain *domain = data;
+	LfHazard *hazard;
+	gint seq;
+
+	hazard = lf_hazard_get(domain);
+
+	while (lf_atomic_load(&domain->reclaiming, memory_order_acquire)) {
+		if (lf_atomic_load(&domain->orphans, memory_order_relaxed)) {
+			lf_hazard_reclaim(hazard);
+			continue;
+		}
+
+		/*
+		 * Announce that we are going to sleep before the final check,
+		 * so a thread pushing a batch after it will wake us.
+		 */
+		lf_atomic_store(&domain->sleeping, TRUE, memory_order_seq_cst);
+		seq = lf_atomic_load(&domain->reclaimer_seq, memory_order_acquire);
+		if (!lf_atomic_load(&domain->orphans, memory_order_seq_cst) &&
+		    lf_atomic_load(&domain->reclaiming, memory_order_acquire)) {
+			lf_futex_wait(&domain->reclaimer_seq, seq,
+			              hazard->rcount ? LF_HAZARD_RECLAIMER_RETRY_US : -1);
+		}
+		lf_atomic_store(&domain->sleeping, FALSE, memory_order_relaxed);
+
+		if (hazard->rcount > 0)
+			lf_hazard_reclaim(hazard);
+	}
+
+	lf_hazard_reclaim(hazard);
+	lf_hazard_thread_leave(domain);
+
+	return NULL;
+}
+
+/**
+ * lf_hazard_domain_start_reclaimer:
+ * @domain: A #LfHazardDomain
+ * @max_pending: The maximum number of retired pointers to let queue up for
+ *   the reclaimer.
+ *
+ * Starts a background thread that reclaims the pointers retired in @domain.
+ * A thread that is due for a scan then hands its retired pointers to the
+ * reclaimer rather than scanning and freeing them itself, which takes both
+ * off the latency of the operation that happened to cross the threshold.
+ *
+ * Should the reclaimer fall behind by more than @max_pending pointers,
+ * threads go back to scanning inline, which also helps drain the backlog.
+ * Passing 0 effectively disables the hand off.
+ *
+ * Must not be called concurrently with itself or
+ * lf_hazard_domain_stop_reclaimer() on the same domain.
+ *
+ * Side effects: Starts a thread.
+ */
+void
+lf_hazard_domain_start_reclaimer(LfHazardDomain *domain,
+                                 guint           max_pending)
+{
+	GError *error = NULL;
+
+	g_return_if_fail(domain != NULL);
+	g_return_if_fail(domain->reclaimer == NULL);
+
+	domain->max_pending = MIN(max_pending, G_MAXINT);
+	lf_atomic_store(&domain->reclaiming, TRUE, memory_order_release);
+	domain->reclaimer = g_thread_create(lf_hazard_reclaimer_run, domain,
+	                                    TRUE, &error);
+	if (!domain->reclaimer)
+		g_error("Failed to start reclaimer: %s", error->message);
+}
+
+/**
+ * lf_hazard_domain_stop_reclaimer:
+ * @domain: A #LfHazardDomain
+ *
+ * Stops the reclaimer thread started with lf_hazard_domain_start_reclaimer()
+ * and waits for it to exit.  Threads go back to scanning inline.  Whatever
+ * the reclaimer could not free yet is adopted by the next of them to scan.
+ *
+ * Side effects: Retired pointers may be freed with their destroy notify.
+ */
+void
+lf_hazard_domain_stop_reclaimer(LfHazardDomain *domain)
+{
+	g_return_if_fail(domain != NULL);
+	g_return_if_fail(domain->reclaimer != NULL);
+
+	lf_atomic_store(&domain->reclaiming, FALSE, memory_order_seq_cst);
+	lf_atomic_int_add(&domain->reclaimer_seq, 1, memory_order_release);
+	lf_futex_wake(&domain->reclaimer_seq, 1);
+	g_thread_join(domain->reclaimer);
+	domain->reclaimer = NULL;
+}
+
+/**
+ * lf_hazard_domain_get_stats:
+ * @domain: A #LfHazardDomain
+ * @stats: A location for the statistics.
+ *
+ * Fills @stats with the reclaimation counters of @domain summed over every
+ * hazard record.  Each counter is read atomically, but their owners may be
+ * updating them meanwhile, so the result is not a snapshot of one instant.
+ *
+ * Statistics are only kept when the library is built with LF_ENABLE_STATS
+ * defined.  Otherwise only the record and slot counts are filled in.
+ *
+ * Returns: %TRUE if statistics are available.
+ * Side effects: None.
+ */
+gboolean
+lf_hazard_domain_get_stats(LfHazardDomain *domain,
+                           LfHazardStats  *stats)
+{
+	LfHazard *hazard;
+
+	g_return_val_if_fail(domain != NULL, FALSE);
+	g_return_val_if_fail(stats != NULL, FALSE);
+
+	memset(stats, 0, sizeof(LfHazardStats));
+	for (hazard = lf_atomic_load(&domain->records, memory_order_acquire);
+	     hazard; hazard = hazard->next) {
+		stats->scans += lf_atomic_load(&hazard->n_scans,
+		                               memory_order_relaxed);
+		stats->scan_time_ns += lf_atomic_load(&hazard->scan_time_ns,
+		                                      memory_order_relaxed);
+		stats->scan_max_ns = MAX(stats->scan_max_ns,
+		                         lf_atomic_load(&hazard->scan_max_ns,
+		                                        memory_order_relaxed));
+		stats->adoptions += lf_atomic_load(&hazard->n_adoptions,
+		                                   memory_order_relaxed);
+		stats->handoffs += lf_atomic_load(&hazard->n_handoffs,
+		                                  memory_order_relaxed);
+		stats->retired += MAX(lf_atomic_load(&hazard->rcount,
+		                                     memory_order_relaxed), 0);
+		stats->n_records++;
+		if (lf_atomic_load(&hazard->active, memory_order_relaxed))
+			stats->n_active++;
+	}
+	stats->n_hazards = lf_atomic_load(&domain->n_hazards, memory_order_relaxed);
+	stats->pending = MAX(lf_atomic_load(&domain->n_pending,
+	                                    memory_order_relaxed), 0);
+
+#ifdef LF_ENABLE_STATS
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
@@ -26,12 +26,15 @@
 
 #include <glib.h>
 
+#include "lf-atomic.h"
+#include "lf-stats.h"
+
 G_BEGIN_DECLS
 
 /**
- * @LF_HAZARD_K: The maximum number of hazard pointers needed by a thread at
- *               any given time.  This is 2 for most of the lock-free data
- *               structures out there.
+ * @LF_HAZARD_K: The number of hazard pointers each thread gets in the default
+ *               domain.  This is 2 for most of the lock-free data structures
+ *               out there.  Structures needing more create their own domain.
  */
 #ifndef LF_HAZARD_K
 #define LF_HAZARD_K (2)
@@ -47,237 +50,166 @@ G_BEGIN_DECLS
 #define LF_HAZARD_R (8)
 #endif
 
-#define LF_HAZARD_INIT LfHazard *myhazard = (g_static_private_get(&_lf_myhazard))
-#define LF_HAZARD_TLS (myhazard)
-
-#define LF_HAZARD_SET(i,p) G_STMT_START {                            \
-    if (!myhazard) {                                                 \
-        lf_hazard_thread_acquire();                                  \
-        myhazard = g_static_private_get(&_lf_myhazard);              \
-        g_assert(myhazard);                                          \
-    }                                                                \
-    myhazard->hp[(i)] = (p);                                         \
-} G_STMT_END
-
-
-// XXX: What the hell is happening with the first if statment.
-#define LF_HAZARD_UNSET(p) G_STMT_START {                            \
-    LfHazard *_head;                                                 \
-    myhazard->rlist = g_slist_prepend(myhazard->rlist, (p));         \
-    myhazard->rcount++;                                              \
-    _head = _lf_hazards;                                             \
-    if (myhazard->rcount >= (_LF_H + LF_HAZARD_R)) {                 \
-        lf_hazard_scan(_head);                                       \
-        lf_hazard_help_scan();                                       \
-    }                                                                \
-} G_STMT_END
-
-#define G_SLIST_POP(l,d) G_STMT_START {                              \
-    if (!(l)) {                                                      \
-        *(d) = NULL;                                                 \
-    } else {                                                         \
-        *(d) = (l)->data;                                            \
-        (l) = g_slist_delete_link((l), (l));                         \
-    }                                                                \
-} G_STMT_END
-
-typedef struct _LfHazard LfHazard;
-
-struct _LfHazard {
-	gpointer  hp[LF_HAZARD_K];
-	LfHazard *next;
-	gboolean  active;
-	GSList   *rlist;
-	gint      rcount;
-	GTree    *plist;
-};
-
-/*
- * Thread local hazard pointers.
+/**
+ * @LF_HAZARD_RECLAIMER_RETRY_US: How often the background reclaimer retries
+ *                                pointers that were still hazardous, in
+ *                                microseconds, when nothing new arrives.
  */
-static GStaticPrivate _lf_myhazard = G_STATIC_PRIVATE_INIT;
+#ifndef LF_HAZARD_RECLAIMER_RETRY_US
+#define LF_HAZARD_RECLAIMER_RETRY_US (1000)
+#endif
 
-/*
- * Global linked-list of all hazard pointers.
+/**
+ * @LF_HAZARD_MEMBARRIER: Define to publish hazard pointers with only a
+ *                        compiler barrier and have scans issue a
+ *                        membarrier() system call instead, which forces a
+ *                        full barrier on every thread of the process.  This
+ *                        moves the cost of the fence from every protected
+ *                        read to every scan.  Where the kernel lacks
+ *                        support the usual fences are used.
  */
-static LfHazard *_lf_hazards = NULL;
 
 /*
- * Total count of all potential hazard pointers.
+ * The macros below expect the hazard record of the calling thread in a local
+ * named myhazard.  LF_HAZARD_INIT declares it and LF_HAZARD_ENTER() loads it
+ * for the domain in use.
  */
-static gint _LF_H = 0;
+#define LF_HAZARD_INIT LfHazard *myhazard
+#define LF_HAZARD_ENTER(d) (myhazard = lf_hazard_get((d)))
+#define LF_HAZARD_TLS (myhazard)
 
-/*
- * Hazard pointer callback for reclaimation of memory.  This should
- * be set by the data structure consuming lf-hazard.h.
- */
-static void (*lf_hazard_free) (gpointer data) = NULL;
+#define LF_HAZARD_SET(i,p) lf_hazard_set(myhazard, (i), (p))
 
 /*
- * Sorting method for GTree.
+ * LF_HAZARD_RETIRE() queues a pointer for reclaimation by notify without
+ * checking if a scan is due.  Use it with LF_HAZARD_COLLECT() to retire a
+ * batch of pointers at once; LF_HAZARD_UNSET() does both for a single
+ * pointer.
  */
-static gint
-lf_hazard_pointer_compare(gconstpointer a,
-                          gconstpointer b)
-{
-	return (a == b) ? 0 : a - b;
-}
+#define LF_HAZARD_RETIRE(p,n) lf_hazard_push(myhazard, (p), (GDestroyNotify)(n))
 
-/*
- * Method to acquire thread local data structures for hazard pointer
- * operation.  This is called automatically as needed when a new thread
- * enters the arena.
- *
- * Your data structure should provide a method for threads leaving the arena
- * to lose their allocated resources which should in turn call
- * lf_hazard_thread_release().
- */
-static void
-lf_hazard_thread_acquire(void)
-{
-	LfHazard *hazard, *old_head;
-	gint old_count;
+#define LF_HAZARD_COLLECT() G_STMT_START {                           \
+    if (G_UNLIKELY(myhazard->rcount >= myhazard->rthreshold))        \
+        lf_hazard_collect(myhazard);                                 \
+} G_STMT_END
 
-	/*
-	 * Try to reclaim an existing, unused LfHazard structure.
-	 */
-	for (hazard = _lf_hazards; hazard; hazard = hazard->next) {
-	  // XXX: Why is this first if needed?  Seems redundant.
-	  //	if (hazard->active)
-	  //		continue;
-		if (!g_atomic_int_compare_and_exchange(&hazard->active, FALSE, TRUE))
-			continue;
-		// Why no destructor function here?  Why rely on programmers to
-		// clean this up?
-		g_static_private_set(&_lf_myhazard, hazard, NULL);
-		return;
-	}
+#define LF_HAZARD_UNSET(p,n) G_STMT_START {                          \
+    LF_HAZARD_RETIRE((p), (n));                                      \
+    LF_HAZARD_COLLECT();                                             \
+} G_STMT_END
 
-	/*
-	 * No LfHazard could be reused.  We will create one and push it onto
-	 * the head of the linked-list.
-	 * XXX: Why create only one?  It maybe more efficient with the slice
-	 *      allocater to create a few in order reduce wasted space and
-	 *      avoid allocation delays in the near future.
-	 */
-	old_count = g_atomic_int_exchange_and_add(&_LF_H, LF_HAZARD_K);
-	hazard = g_slice_new0(LfHazard);
-	hazard->active = TRUE;
-	hazard->plist = g_tree_new(lf_hazard_pointer_compare);
-	do {
-		old_head = _lf_hazards;
-		hazard->next = old_head;
-	} while (!g_atomic_pointer_compare_and_exchange((gpointer *)&_lf_hazards,
-	                                                old_head, hazard));
-	g_static_private_set(&_lf_myhazard, hazard, NULL);
-}
+typedef struct _LfHazard        LfHazard;
+typedef struct _LfHazardDomain  LfHazardDomain;
+typedef struct _LfHazardOrphan  LfHazardOrphan;
+typedef struct _LfHazardRetired LfHazardRetired;
+
+struct _LfHazardRetired {
+	gpointer       data;
+	GDestroyNotify notify;
+};
 
 /*
- * This method will release the resources acquired for a thread to participate
- * in the lock-free arena.  This method should be called when a thread is no
- * longer going to participate in the consuming algorithm.  It is suggested
- * that you wrap a call to this method in your algorithm.
+ * A thread's record within a domain.  It is only public so that the macros
+ * above can be inlined; treat it as opaque.
+ *
+ * hp holds the domain's number of hazard pointer slots.  rlist holds the
+ * pointers this thread has retired but not yet freed, along with the function
+ * to free each one.  A scan is due once it holds rthreshold pointers, which
+ * is LF_HAZARD_R plus the number of hazard pointer slots owned by live
+ * threads as of the last scan.  plist is scratch space for
+ * the snapshot of all threads' hazard pointers taken during a scan.  Both
+ * lists only grow when new threads enter the domain, so a scan never touches
+ * the heap otherwise.  spares caches empty batches whose arrays take over
+ * from rlist when it is handed off to the domain.
+ *
+ * id is the record's position in creation order.  Since a record is owned by
+ * one thread at a time it doubles as a cheap thread index for sharding.  The
+ * statistics are only ever written by the owning thread.  They and rcount
+ * are stored relaxed, since lf_hazard_domain_get_stats() reads them from any
+ * thread.
  */
-#if 0
-static void
-lf_hazard_thread_release(void)
-{
-	gint i;
+struct _LfHazard {
+	gpointer        *hp;
+	LfHazard        *next;
+	LfHazardDomain  *domain;
+	volatile gint    active;
+	gint             id;
+	LfHazardRetired *rlist;
+	gint             rcount;
+	gint             rsize;
+	gint             rthreshold;
+	LfHazardOrphan  *spares;
+	gpointer        *plist;
+	gint             psize;
+	guint64          n_scans;
+	guint64          scan_time_ns;
+	guint64          scan_max_ns;
+	guint64          n_adoptions;
+	guint64          n_handoffs;
+};
 
-	for (i = 0; i < (LF_HAZARD_K - 1); i++) /* Clear any lingering hazards */
-		myhazard->hp[i] = NULL;
-	myhazard->active = FALSE;           /* Notify structure is avaialble */
-}
+LfHazardDomain* lf_hazard_domain_get_default     (void);
+LfHazardDomain* lf_hazard_domain_new             (guint           n_slots);
+guint           lf_hazard_domain_get_n_slots     (LfHazardDomain *domain);
+gboolean        lf_hazard_domain_get_stats       (LfHazardDomain *domain,
+                                                  LfHazardStats  *stats);
+void            lf_hazard_domain_start_reclaimer (LfHazardDomain *domain,
+                                                  guint           max_pending);
+void            lf_hazard_domain_stop_reclaimer  (LfHazardDomain *domain);
+LfHazard*       lf_hazard_get                    (LfHazardDomain *domain);
+void            lf_hazard_thread_leave           (LfHazardDomain *domain);
+void            lf_hazard_collect                (LfHazard       *hazard);
+void            lf_hazard_rlist_grow             (LfHazard       *hazard);
+
+#ifdef LF_HAZARD_MEMBARRIER
+extern gboolean _lf_hazard_membarrier;
 #endif
 
 /*
- * This method works in two stages.  The first stage scans all neighbor threads
- * for hazard pointers and stores them in a worst-case O(log N) balanced-binary
- * GTree.  The second stage looks to see if any hazard pointers in the threads
- * local hazard pointers are found in the GTree.  If they are not, they are
- * ready to be reclaimed.  If they are found, we store them back into our
- * list of hazard pointers for the next round of reclaimation.
+ * Publishes p in slot i of the hazard record.  A scan has to observe the
+ * store before the caller re-reads the location p was loaded from, or it could
+ * free p after the check succeeded.  That takes a store-load barrier, here
+ * the seq_cst store, so the re-read must be a seq_cst load as well.  With
+ * membarrier() the scanner supplies the barrier and only the compiler needs
+ * to be kept from reordering.  Clearing a slot only has to keep earlier reads
+ * through the old pointer from moving past it.
  */
-static void
-lf_hazard_scan(LfHazard *head)
+static inline void
+lf_hazard_set(LfHazard *hazard,
+              guint     i,
+              gpointer  p)
 {
-	LfHazard *hazard;
-	GSList *tmplist;
-	gpointer data = NULL;
-	gint i;
-
-	LF_HAZARD_INIT;
-
-	/*
-	 * Stage 1: Collect all the current hazard pointers from active threads.
-	 */
-	hazard = head;
-	while (hazard != NULL) {
-		for (i = 0; i < (LF_HAZARD_K - 1); i++) {
-			data = g_atomic_pointer_get(&hazard->hp[i]);
-			if (data != NULL)
-				g_tree_insert(LF_HAZARD_TLS->plist, data, data);
-		}
-		hazard = hazard->next;
+	if (!p) {
+		lf_atomic_store(&hazard->hp[i], NULL, memory_order_release);
+		return;
 	}
-
-	/*
-	 * Stage 2: Reclaim expired hazard pointers.
-	 */
-	LF_HAZARD_TLS->rcount = 0;
-	tmplist = LF_HAZARD_TLS->rlist;
-	LF_HAZARD_TLS->rlist = NULL;
-	G_SLIST_POP(tmplist, &data);
-	while (data != NULL) {
-		if (g_tree_lookup(LF_HAZARD_TLS->plist, data)) {
-			LF_HAZARD_TLS->rlist = g_slist_prepend(LF_HAZARD_TLS->rlist, data);
-			LF_HAZARD_TLS->rcount++;
-		} else {
-			lf_hazard_free(data);
-		}
-		G_SLIST_POP(tmplist, &data);
+#ifdef LF_HAZARD_MEMBARRIER
+	if (G_LIKELY(_lf_hazard_membarrier)) {
+		lf_atomic_store(&hazard->hp[i], p, memory_order_relaxed);
+		atomic_signal_fence(memory_order_seq_cst);
+		return;
 	}
-
-	/*
-	 * This is part of a micro-optimization for GLib 2.22+.  GTree became
-	 * reference counted and allows us to reuse the structure and quickly
-	 * remove all of the existing pointers from the tree.  However, it also
-	 * decrements the reference count in the process.  Therefore, we increment
-	 * it before-hand.
-	 */
-	LF_HAZARD_TLS->plist = g_tree_ref(LF_HAZARD_TLS->plist);
-	g_tree_destroy(LF_HAZARD_TLS->plist);
+#endif
+	lf_atomic_store(&hazard->hp[i], p, memory_order_seq_cst);
 }
 
-static void
-lf_hazard_help_scan(void)
+/*
+ * Appends a retired pointer to the hazard's rlist.  The rlist is only
+ * resized if more threads have entered the domain since it was allocated.
+ */
+static inline void
+lf_hazard_push(LfHazard       *hazard,
+               gpointer        data,
+               GDestroyNotify  notify)
 {
-	LfHazard *hazard, *head;
-	gpointer data;
-
-	LF_HAZARD_INIT;
-
-	for (hazard = _lf_hazards; hazard; hazard = hazard->next) {
-	  // XXX: See comment above about this being redundant.
-	  //	if (hazard->active)
-	  //		continue;
-		if (!g_atomic_int_compare_and_exchange(&hazard->active, FALSE, TRUE))
-			continue;
-		while (hazard->rcount > 0) {
-			G_SLIST_POP(hazard->rlist, &data);
-			hazard->rcount--;
-			LF_HAZARD_TLS->rlist = g_slist_prepend(LF_HAZARD_TLS->rlist, data);
-			LF_HAZARD_TLS->rcount++;
-			head = _lf_hazards;
-			if (LF_HAZARD_TLS->rcount >= (_LF_H + LF_HAZARD_R))
-				lf_hazard_scan(head);
-		}
-		hazard->active = FALSE;
-	}
+	if (G_UNLIKELY(hazard->rcount >= hazard->rsize))
+		lf_hazard_rlist_grow(hazard);
+	hazard->rlist[hazard->rcount].data = data;
+	hazard->rlist[hazard->rcount].notify = notify;
+	lf_atomic_store(&hazard->rcount, hazard->rcount + 1,
+	                memory_order_relaxed);
 }
 
-#undef G_SLIST_POP
-
 G_END_DECLS
 
 #endif /* __LF_HAZARD_H__ */
@@ -0,0 +1,266 @@
+/* lf-iqueue.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "lf-atomic.h"
+#include "lf-hazard.h"
+#include "lf-iqueue.h"
+
+/*
+ * A Michael-Scott queue of caller owned links.  As in LfQueue the head is a
+ * dummy whose successor is the next link to be dequeued, so the link handed
+ * out by a dequeue stays in the queue as the new dummy.  It is only passed to
+ * reclaim once a later dequeue has unlinked it and no thread holds a hazard
+ * pointer to it.
+ *
+ * The very first dummy belongs to the queue and is freed with g_free().
+ */
+struct _LfIQueue {
+	LfQueueLink     *head;
+	LfQueueLink     *tail;
+	LfQueueLink     *stub;
+	GDestroyNotify   reclaim;
+	volatile gint    ref_count;
+	LfHazardDomain  *domain;
+};
+
+static void
+lf_iqueue_destroy(LfIQueue *queue)
+{
+	LfQueueLink *link, *next;
+
+	g_return_if_fail(queue != NULL);
+
+	for (link = queue->head; link; link = next) {
+		next = link->next;
+		if (link == queue->stub)
+			g_free(link);
+		else
+			queue->reclaim(link);
+	}
+}
+
+/**
+ * lf_iqueue_new:
+ * @reclaim: A function called with each link once the queue is done with it.
+ *
+ * Creates a new instance of #LfIQueue, an intrusive queue.  Items are queued
+ * by a #LfQueueLink embedded in them rather than by pointer, so enqueueing
+ * does not allocate.  The #LfIQueue structure is reference counted and should
+ * be freed using lf_iqueue_unref().
+ *
+ * The queue keeps referring to a link for a while after dequeueing it, so
+ * the link must not be freed or enqueued again until it has been passed to
+ * @reclaim.  That happens exactly once for every link enqueued, after a
+ * later dequeue on whichever thread reclaims hazardous memory at the time,
+ * or when the queue is freed.  The rest of the structure may be read and
+ * written in the meantime.  Since @reclaim may run while the thread that
+ * dequeued the link is still using the structure, the two have to agree on
+ * who frees it, for example with a reference count each of them drops.
+ *
+ * Returns: The newly created #LfIQueue.
+ * Side effects: None.
+ */
+LfIQueue*
+lf_iqueue_new(GDestroyNotify reclaim)
+{
+	LfIQueue *queue;
+
+	g_return_val_if_fail(reclaim != NULL, NULL);
+
+	queue = g_slice_new(LfIQueue);
+	queue->stub = g_new0(LfQueueLink, 1);
+	queue->head = queue->tail = queue->stub;
+	queue->reclaim = reclaim;
+	queue->ref_count = 1;
+	queue->domain = lf_hazard_domain_get_default();
+
+	return queue;
+}
+
+/**
+ * lf_iqueue_ref:
+ * @queue: A #LfIQueue
+ *
+ * Atomically increments the reference count of @queue by one.
+ *
+ * Returns: A reference to @queue.
+ * Side effects: None.
+ */
+LfIQueue*
+lf_iqueue_ref(LfIQueue *queue)
+{
+	g_return_val_if_fail(queue != NULL, NULL);
+	g_return_val_if_fail(queue->ref_count > 0, NULL);
+
+	g_atomic_int_inc(&queue->ref_count);
+	return queue;
+}
+
+/**
+ * lf_iqueue_unref:
+ * @queue: A #LfIQueue
+ *
+ * Decrements the reference count of @queue by one.  When the reference count
+ * reaches zero, every link still in the queue is passed to the reclaim
+ * function and the queue is freed.
+ */
+void
+lf_iqueue_unref(LfIQueue *queue)
+{
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(queue->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&queue->ref_count)) {
+		lf_iqueue_destroy(queue);
+		g_slice_free(LfIQueue, queue);
+	}
+}
+
+/**
+ * lf_iqueue_get_type:
+ *
+ * Retrieves the GObject type system's type identifier for #LfIQueue.
+ *
+ * Returns: A #GType containing the type id.
+ * Side effects: Registers the #LfIQueue type if not already.
+ */
+GType
+lf_iqueue_get_type(void)
+{
+	static GType type_id = 0;
+	GType tmp_id;
+
+	if (g_once_init_enter((gsize *)&type_id)) {
+		tmp_id = g_boxed_type_register_static("LfIQueue",
+		                                      (GBoxedCopyFunc)lf_iqueue_ref,
+		                                      (GBoxedFreeFunc)lf_iqueue_unref);
+		g_once_init_leave((gsize *)&type_id, tmp_id);
+	}
+
+	return type_id;
+}
+
+/**
+ * lf_iqueue_enqueue:
+ * @queue: A #LfIQueue
+ * @link: A #LfQueueLink which is not in any queue.
+ *
+ * Enqueues the structure @link is embedded in.  Nothing is allocated.
+ *
+ * Side effects: None.
+ */
+void
+lf_iqueue_enqueue(LfIQueue    *queue,
+                  LfQueueLink *link)
+{
+	LfQueueLink *tail, *next;
+	LF_HAZARD_INIT;
+
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(link != NULL);
+
+	LF_HAZARD_ENTER(queue->domain);
+
+	lf_atomic_store(&link->next, NULL, memory_order_relaxed);
+
+	while (TRUE) {
+		tail = lf_atomic_load(&queue->tail, memory_order_acquire);
+		LF_HAZARD_SET(0, tail);
+		if (lf_atomic_load(&queue->tail, memory_order_seq_cst) != tail)
+			continue;
+		next = lf_atomic_load(&tail->next, memory_order_acquire);
+		if (lf_atomic_load(&queue->tail, memory_order_acquire) != tail)
+			continue;
+		if (next != NULL) {
+			lf_atomic_pointer_cas(&queue->tail, tail, next,
+			                      memory_order_seq_cst);
+			continue;
+		}
+		if (lf_atomic_pointer_cas(&tail->next, NULL, link,
+		                          memory_order_seq_cst))
+			break;
+	}
+
+	lf_atomic_pointer_cas(&queue->tail, tail, link, memory_order_seq_cst);
+	LF_HAZARD_SET(0, NULL);
+}
+
+/**
+ * lf_iqueue_dequeue:
+ * @queue: A #LfIQueue
+ *
+ * Dequeues the oldest link from the queue.  See lf_iqueue_new() for when
+ * the link may be reused.
+ *
+ * Returns: A #LfQueueLink or %NULL if the queue is empty.
+ *
+ * Side effects: Hazard pointer reclaimation can occur meaning that links
+ *   no longer in use may be passed to the reclaim function.
+ */
+LfQueueLink*
+lf_iqueue_dequeue(LfIQueue *queue)
+{
+	LfQueueLink *head, *tail, *next;
+	LF_HAZARD_INIT;
+
+	g_return_val_if_fail(queue != NULL, NULL);
+
+	LF_HAZARD_ENTER(queue->domain);
+
+	while (TRUE) {
+		head = lf_atomic_load(&queue->head, memory_order_acquire);
+		LF_HAZARD_SET(0, head);
+		if (lf_atomic_load(&queue->head, memory_order_seq_cst) != head)
+			continue;
+		tail = lf_atomic_load(&queue->tail, memory_order_acquire);
+		next = lf_atomic_load(&head->next, memory_order_acquire);
+		LF_HAZARD_SET(1, next);
+		if (lf_atomic_load(&queue->head, memory_order_seq_cst) != head)
+			continue;
+		if (next == NULL) {
+			LF_HAZARD_SET(0, NULL);
+			return NULL;
+		}
+		if (head == tail) {
+			lf_atomic_pointer_cas(&queue->tail, tail, next,
+			                      memory_order_seq_cst);
+			continue;
+		}
+		if (lf_atomic_pointer_cas(&queue->head, head, next,
+		                          memory_order_seq_cst))
+			break;
+	}
+
+	/*
+	 * next is the new dummy, so it stays protected by the queue itself
+	 * rather than our hazard pointers.
+	 */
+	LF_HAZARD_SET(0, NULL);
+	LF_HAZARD_SET(1, NULL);
+	if (head == queue->stub)
+		LF_HAZARD_UNSET(head, g_free);
+	else
+		LF_HAZARD_UNSET(head, queue->reclaim);
+
+	return next;
+}
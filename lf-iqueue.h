@@ -0,0 +1,64 @@
+/* lf-iqueue.h
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LF_IQUEUE_H__
+#define __LF_IQUEUE_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LfIQueue    LfIQueue;
+typedef struct _LfQueueLink LfQueueLink;
+
+/**
+ * LfQueueLink:
+ *
+ * A link embedded in a structure so that it can be queued in an #LfIQueue
+ * without allocating.  Its contents are private to the queue.
+ */
+struct _LfQueueLink {
+	LfQueueLink *next;
+};
+
+/**
+ * LF_QUEUE_LINK_ENTRY:
+ * @link: A #LfQueueLink
+ * @type: The type of the structure @link is embedded in.
+ * @member: The name of @link within @type.
+ *
+ * Retrieves the structure @link is embedded in.
+ */
+#define LF_QUEUE_LINK_ENTRY(link,type,member) \
+    ((type *)((gchar *)(link) - G_STRUCT_OFFSET(type, member)))
+
+GType        lf_iqueue_get_type (void) G_GNUC_CONST;
+LfIQueue*    lf_iqueue_new      (GDestroyNotify reclaim);
+LfIQueue*    lf_iqueue_ref      (LfIQueue *queue);
+void         lf_iqueue_unref    (LfIQueue *queue);
+void         lf_iqueue_enqueue  (LfIQueue *queue, LfQueueLink *link);
+LfQueueLink* lf_iqueue_dequeue  (LfIQueue *queue);
+
+G_END_DECLS
+
+#endif /* __LF_IQUEUE_H__ */
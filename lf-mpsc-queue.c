@@ -0,0 +1,317 @@
+/* lf-mpsc-queue.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "lf-atomic.h"
+#include "lf-mpsc-queue.h"
+#include "lf-node.h"
+
+/**
+ * @LF_CACHE_LINE: The assumed size of a cache line in bytes.  The end the
+ *                 producers swap and the end the consumer walks each get a
+ *                 line of their own.
+ */
+#define LF_CACHE_LINE (64)
+
+/*
+ * Vyukov's multi-producer single-consumer queue.  A producer links its node
+ * in with one exchange on tail followed by a plain release store to the old
+ * tail's next pointer, so producers never retry.  As in LfQueue head is a
+ * dummy whose successor holds the next item, but head is only ever touched
+ * by the consumer.
+ *
+ * A node stops being the dummy only once its next pointer has been set,
+ * after which no producer will touch it again, and no other thread ever
+ * reads through head.  The consumer may therefore free the old dummy as soon
+ * as it moves past it, without hazard pointers, revalidation or scans.
+ *
+ * The price is that the consumer is not lock-free.  Between its exchange and
+ * its store a producer has appended its node but not yet linked it, so a
+ * producer preempted there hides its item, and every item enqueued after it,
+ * until it runs again.
+ */
+struct _LfMpscQueue {
+	LfNode         *tail;
+	gchar           pad0[LF_CACHE_LINE - sizeof(gpointer)];
+	LfNode         *head;
+	volatile gint   ref_count;
+	gchar           pad1[LF_CACHE_LINE - sizeof(gpointer) - sizeof(gint)];
+};
+
+static void
+lf_mpsc_queue_destroy(LfMpscQueue *queue)
+{
+	LfNode *node, *next;
+
+	g_return_if_fail(queue != NULL);
+
+	for (node = queue->head; node; node = next) {
+		next = node->next;
+		lf_node_free(node);
+	}
+}
+
+/*
+ * Appends the already linked chain first..last.  The exchange orders the
+ * chain's contents before any producer that links after it, and the release
+ * store hands them to the consumer.
+ */
+static inline void
+lf_mpsc_queue_append(LfMpscQueue *queue,
+                     LfNode      *first,
+                     LfNode      *last)
+{
+	LfNode *prev;
+
+	lf_atomic_store(&last->next, NULL, memory_order_relaxed);
+	prev = lf_atomic_exchange(&queue->tail, last, memory_order_acq_rel);
+	lf_atomic_store(&prev->next, first, memory_order_release);
+}
+
+/**
+ * lf_mpsc_queue_new:
+ *
+ * Creates a new instance of #LfMpscQueue, an unbounded FIFO for any number
+ * of producer threads and a single consumer thread, such as an actor's
+ * mailbox.  Enqueueing costs one atomic exchange and dequeueing none, and the
+ * consumer frees nodes as it goes rather than through hazard pointers.
+ * Which thread is the consumer may change over time, as long as the hand
+ * over itself synchronizes.  The #LfMpscQueue structure is reference counted
+ * and should be freed using lf_mpsc_queue_unref().
+ *
+ * Returns: The newly created #LfMpscQueue.
+ * Side effects: None.
+ */
+LfMpscQueue*
+lf_mpsc_queue_new(void)
+{
+	LfMpscQueue *queue;
+	gpointer mem;
+
+	if (posix_memalign(&mem, LF_CACHE_LINE, sizeof(LfMpscQueue)) != 0)
+		g_error("Failed to allocate %" G_GSIZE_FORMAT " bytes",
+		        sizeof(LfMpscQueue));
+
+	queue = mem;
+	queue->head = lf_node_new();
+	queue->head->data = NULL;
+	queue->head->next = NULL;
+	queue->tail = queue->head;
+	queue->ref_count = 1;
+
+	return queue;
+}
+
+/**
+ * lf_mpsc_queue_ref:
+ * @queue: A #LfMpscQueue
+ *
+ * Atomically increments the reference count of @queue by one.
+ *
+ * Returns: A reference to @queue.
+ * Side effects: None.
+ */
+LfMpscQueue*
+lf_mpsc_queue_ref(LfMpscQueue *queue)
+{
+	g_return_val_if_fail(queue != NULL, NULL);
+	g_return_val_if_fail(queue->ref_count > 0, NULL);
+
+	g_atomic_int_inc(&queue->ref_count);
+	return queue;
+}
+
+/**
+ * lf_mpsc_queue_unref:
+ * @queue: A #LfMpscQueue
+ *
+ * Decrements the reference count of @queue by one.  When the reference count
+ * reaches zero, the structures allocations are released and the queue is
+ * freed.  Items still in the queue are not freed.
+ */
+void
+lf_mpsc_queue_unref(LfMpscQueue *queue)
+{
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(queue->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&queue->ref_count)) {
+		lf_mpsc_queue_destroy(queue);
+		free(queue);
+	}
+}
+
+/**
+ * lf_mpsc_queue_get_type:
+ *
+ * Retrieves the GObject type system's type identifier for #LfMpscQueue.
+ *
+ * Returns: A #GType containing the type id.
+ * Side effects: Registers the #LfMpscQueue type if not already.
+ */
+GType
+lf_mpsc_queue_get_type(void)
+{
+	static GType type_id = 0;
+	GType tmp_id;
+
+	if (g_once_init_enter((gsize *)&type_id)) {
+		tmp_id = g_boxed_type_register_static("LfMpscQueue",
+		                                      (GBoxedCopyFunc)lf_mpsc_queue_ref,
+		                                      (GBoxedFreeFunc)lf_mpsc_queue_unref);
+		g_once_init_leave((gsize *)&type_id, tmp_id);
+	}
+
+	return type_id;
+}
+
+/**
+ * lf_mpsc_queue_enqueue:
+ * @queue: A #LfMpscQueue.
+ * @data: a non-%NULL pointer.
+ *
+ * Enqueues an item into the #LfMpscQueue.  Any thread may call this.
+ *
+ * Side effects: None.
+ */
+void
+lf_mpsc_queue_enqueue(LfMpscQueue   *queue,
+                      gconstpointer  data)
+{
+	LfNode *node;
+
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(data != NULL);
+
+	node = lf_node_new();
+	node->data = (gpointer)data;
+	lf_mpsc_queue_append(queue, node, node);
+}
+
+/**
+ * lf_mpsc_queue_enqueue_many:
+ * @queue: A #LfMpscQueue.
+ * @items: An array of non-%NULL pointers.
+ * @n_items: The number of pointers in @items.
+ *
+ * Enqueues all of @items into the #LfMpscQueue in order.  Any thread may call
+ * this.  The items are linked together privately first and then appended
+ * with a single exchange, so items from concurrent producers are never
+ * interleaved with them.
+ *
+ * Side effects: None.
+ */
+void
+lf_mpsc_queue_enqueue_many(LfMpscQueue  *queue,
+                           gpointer     *items,
+                           guint         n_items)
+{
+	LfNode *first, *last, *node;
+	guint i;
+
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(items != NULL || n_items == 0);
+
+	if (!n_items)
+		return;
+
+	first = last = lf_node_new();
+	first->data = items[0];
+	for (i = 1; i < n_items; i++) {
+		node = lf_node_new();
+		node->data = items[i];
+		last->next = node;
+		last = node;
+	}
+	lf_mpsc_queue_append(queue, first, last);
+}
+
+/**
+ * lf_mpsc_queue_dequeue:
+ * @queue: A #LfMpscQueue
+ *
+ * Dequeues an item from the queue.  Only the consumer may call this.  If the
+ * queue is empty, or its oldest item is still being linked in by a producer,
+ * %NULL is returned.
+ *
+ * Returns: An item from the queue or %NULL.
+ * Side effects: None.
+ */
+gpointer
+lf_mpsc_queue_dequeue(LfMpscQueue *queue)
+{
+	LfNode *head, *next;
+	gpointer data;
+
+	g_return_val_if_fail(queue != NULL, NULL);
+
+	head = queue->head;
+	next = lf_atomic_load(&head->next, memory_order_acquire);
+	if (!next)
+		return NULL;
+
+	data = next->data;
+	queue->head = next;
+	lf_node_free(head);
+
+	return data;
+}
+
+/**
+ * lf_mpsc_queue_dequeue_many:
+ * @queue: A #LfMpscQueue
+ * @items: A location for up to @max_items pointers.
+ * @max_items: The maximum number of items to dequeue.
+ *
+ * Dequeues up to @max_items items from the queue into @items in the order
+ * they were enqueued.  Only the consumer may call this.  This stops early at
+ * an item still being linked in by a producer.
+ *
+ * Returns: The number of items stored in @items, 0 if the queue is empty.
+ * Side effects: None.
+ */
+guint
+lf_mpsc_queue_dequeue_many(LfMpscQueue *queue,
+                           gpointer    *items,
+                           guint        max_items)
+{
+	LfNode *head, *next;
+	guint i;
+
+	g_return_val_if_fail(queue != NULL, 0);
+	g_return_val_if_fail(items != NULL || max_items == 0, 0);
+
+	head = queue->head;
+	for (i = 0; i < max_items; i++) {
+		next = lf_atomic_load(&head->next, memory_order_acquire);
+		if (!next)
+			break;
+		items[i] = next->data;
+		lf_node_free(head);
+		head = next;
+	}
+	queue->head = head;
+
+	return i;
+}
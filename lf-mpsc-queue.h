@@ -0,0 +1,44 @@
+/* lf-mpsc-queue.h
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LF_MPSC_QUEUE_H__
+#define __LF_MPSC_QUEUE_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LfMpscQueue LfMpscQueue;
+
+GType        lf_mpsc_queue_get_type     (void) G_GNUC_CONST;
+LfMpscQueue* lf_mpsc_queue_new          (void);
+LfMpscQueue* lf_mpsc_queue_ref          (LfMpscQueue *queue);
+void         lf_mpsc_queue_unref        (LfMpscQueue *queue);
+void         lf_mpsc_queue_enqueue      (LfMpscQueue *queue, gconstpointer data);
+gpointer     lf_mpsc_queue_dequeue      (LfMpscQueue *queue);
+void         lf_mpsc_queue_enqueue_many (LfMpscQueue *queue, gpointer *items, guint n_items);
+guint        lf_mpsc_queue_dequeue_many (LfMpscQueue *queue, gpointer *items, guint max_items);
+
+G_END_DECLS
+
+#endif /* __LF_MPSC_QUEUE_H__ */
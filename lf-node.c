@@ -0,0 +1,247 @@
+/* lf-node.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "lf-atomic.h"
+#include "lf-node.h"
+
+/**
+ * @LF_CACHE_LINE: The assumed size of a cache line in bytes.  Node slabs are
+ *                 aligned to this so nodes never straddle two lines.
+ */
+#define LF_CACHE_LINE (64)
+
+/**
+ * @LF_NODE_SLAB_SIZE: The number of nodes carved out of each slab allocated
+ *                     from the system.
+ */
+#define LF_NODE_SLAB_SIZE (256)
+
+/**
+ * @LF_NODE_MAGAZINE_SIZE: The number of nodes moved between a thread's pool
+ *                         and the shared depot at a time.
+ */
+#define LF_NODE_MAGAZINE_SIZE (64)
+
+typedef struct _LfNodePool LfNodePool;
+
+/*
+ * Per-thread node cache.  Nodes are kept in two magazines, each a chain of
+ * up to LF_NODE_MAGAZINE_SIZE nodes linked through node->next.  Keeping a
+ * spare magazine around means a thread bouncing between allocating and
+ * freeing at a magazine boundary does not thrash the depot.  Any extra
+ * magazines taken from the depot are held in reserve.
+ */
+struct _LfNodePool {
+	LfNode *loaded;
+	guint   n_loaded;
+	LfNode *spare;
+	guint   n_spare;
+	LfNode *reserve;
+};
+
+/*
+ * Thread local node pools.
+ */
+static GStaticPrivate _lf_node_pool = G_STATIC_PRIVATE_INIT;
+
+/*
+ * Shared depot of full magazines.  Magazines are linked together through
+ * the data field of their first node.  Pushing is a plain CAS loop.  Popping
+ * takes the whole depot at once, which is immune to ABA without needing
+ * hazard pointers of its own.
+ */
+static LfNode *_lf_node_depot = NULL;
+
+/*
+ * Pushes the magazines first through last, already linked together, onto
+ * the depot.  Pass the same magazine twice to push just one.
+ */
+static void
+lf_node_depot_push(LfNode *first,
+                   LfNode *last)
+{
+	LfNode *old_head;
+
+	do {
+		old_head = lf_atomic_load(&_lf_node_depot, memory_order_relaxed);
+		last->data = old_head;
+	} while (!lf_atomic_pointer_cas(&_lf_node_depot, old_head, first,
+	                                memory_order_release));
+}
+
+static LfNode*
+lf_node_depot_pop_all(void)
+{
+	LfNode *magazines;
+
+	do {
+		magazines = lf_atomic_load(&_lf_node_depot, memory_order_relaxed);
+		if (!magazines)
+			return NULL;
+	} while (!lf_atomic_pointer_cas(&_lf_node_depot, magazines, NULL,
+	                                memory_order_acquire));
+
+	return magazines;
+}
+
+/*
+ * Allocates a fresh slab from the system and threads it into a chain.  Slabs
+ * are never returned; nodes cycle between the thread pools and the depot for
+ * the lifetime of the process, just like the slice allocator's magazines.
+ */
+static LfNode*
+lf_node_slab_new(void)
+{
+	LfNode *slab;
+	gpointer mem;
+	gint i;
+
+	if (posix_memalign(&mem, LF_CACHE_LINE,
+	                   sizeof(LfNode) * LF_NODE_SLAB_SIZE) != 0)
+		g_error("Failed to allocate %" G_GSIZE_FORMAT " bytes",
+		        sizeof(LfNode) * LF_NODE_SLAB_SIZE);
+	slab = mem;
+
+	for (i = 0; i < LF_NODE_SLAB_SIZE - 1; i++)
+		slab[i].next = &slab[i + 1];
+	slab[i].next = NULL;
+
+	return slab;
+}
+
+/*
+ * Thread exit hook that hands the thread's cached nodes to the depot so
+ * they can be reused by the threads left behind.
+ */
+static void
+lf_node_pool_free(LfNodePool *pool)
+{
+	LfNode *last;
+
+	if (pool->loaded)
+		lf_node_depot_push(pool->loaded, pool->loaded);
+	if (pool->spare)
+		lf_node_depot_push(pool->spare, pool->spare);
+	if (pool->reserve) {
+		for (last = pool->reserve; last->data; last = last->data);
+		lf_node_depot_push(pool->reserve, last);
+	}
+	g_slice_free(LfNodePool, pool);
+}
+
+static inline LfNodePool*
+lf_node_pool_get(void)
+{
+	LfNodePool *pool;
+
+	pool = g_static_private_get(&_lf_node_pool);
+	if (G_UNLIKELY(!pool)) {
+		pool = g_slice_new0(LfNodePool);
+		g_static_private_set(&_lf_node_pool, pool,
+		                     (GDestroyNotify)lf_node_pool_free);
+	}
+
+	return pool;
+}
+
+/**
+ * lf_node_new:
+ *
+ * Allocates an #LfNode from the calling thread's pool.  Only when both of the
+ * thread's magazines and its reserve are empty do we go to the depot, and
+ * only when the depot is empty do we go to the system.  The contents of the
+ * node are undefined.
+ *
+ * Returns: A #LfNode to be freed with lf_node_free().
+ * Side effects: None.
+ */
+LfNode*
+lf_node_new(void)
+{
+	LfNodePool *pool;
+	LfNode *node, *magazine;
+
+	pool = lf_node_pool_get();
+
+	if (G_UNLIKELY(!pool->loaded)) {
+		if (pool->spare) {
+			pool->loaded = pool->spare;
+			pool->n_loaded = pool->n_spare;
+			pool->spare = NULL;
+			pool->n_spare = 0;
+		} else {
+			if (!pool->reserve)
+				pool->reserve = lf_node_depot_pop_all();
+			if (pool->reserve) {
+				magazine = pool->reserve;
+				pool->reserve = magazine->data;
+			} else {
+				magazine = lf_node_slab_new();
+			}
+			pool->loaded = magazine;
+			for (pool->n_loaded = 1; magazine->next; pool->n_loaded++)
+				magazine = magazine->next;
+		}
+	}
+
+	node = pool->loaded;
+	pool->loaded = node->next;
+	pool->n_loaded--;
+
+	return node;
+}
+
+/**
+ * lf_node_free:
+ * @node: A #LfNode
+ *
+ * Returns @node to the calling thread's pool.  This is also the reclaimation
+ * callback for retired nodes, so nodes reclaimed by a scan land in the pool
+ * of the thread that ran it.
+ *
+ * Side effects: None.
+ */
+void
+lf_node_free(LfNode *node)
+{
+	LfNodePool *pool;
+
+	g_return_if_fail(node != NULL);
+
+	pool = lf_node_pool_get();
+
+	if (G_UNLIKELY(pool->n_loaded >= LF_NODE_MAGAZINE_SIZE)) {
+		if (pool->spare)
+			lf_node_depot_push(pool->spare, pool->spare);
+		pool->spare = pool->loaded;
+		pool->n_spare = pool->n_loaded;
+		pool->loaded = NULL;
+		pool->n_loaded = 0;
+	}
+
+	node->next = pool->loaded;
+	pool->loaded = node;
+	pool->n_loaded++;
+}
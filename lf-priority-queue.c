@@ -0,0 +1,592 @@
+/* lf-priority-queue.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "lf-hazard.h"
+#include "lf-priority-queue.h"
+
+/**
+ * @LF_PRIORITY_QUEUE_MAX_LEVEL: The number of levels in the skiplist.  A
+ *                               queue stays balanced up to roughly two to
+ *                               the power of this many items.  Every level
+ *                               costs each thread two hazard pointer slots.
+ */
+#ifndef LF_PRIORITY_QUEUE_MAX_LEVEL
+#define LF_PRIORITY_QUEUE_MAX_LEVEL (16)
+#endif
+
+/**
+ * @LF_PRIORITY_QUEUE_BOUND_OFFSET: The number of deleted nodes
+ *                                  lf_priority_queue_delete_min() walks past
+ *                                  before it unlinks them.  Larger values
+ *                                  write the head of the list less often but
+ *                                  make every delete walk further.
+ */
+#ifndef LF_PRIORITY_QUEUE_BOUND_OFFSET
+#define LF_PRIORITY_QUEUE_BOUND_OFFSET (32)
+#endif
+
+/*
+ * The low bit of a node's level 0 link marks the node it points to as
+ * deleted.  The second bit is only ever set on the head's level 0 link, and
+ * only while the thread that unlinked a prefix of the list flags its nodes.
+ */
+#define LF_PRIORITY_MARKED(p)    ((GPOINTER_TO_SIZE(p) & 1) != 0)
+#define LF_PRIORITY_MARK(p)      ((LfPriorityNode *)(GPOINTER_TO_SIZE(p) | 1))
+#define LF_PRIORITY_BUSY(p)      ((GPOINTER_TO_SIZE(p) & 2) != 0)
+#define LF_PRIORITY_MARK_BUSY(p) ((LfPriorityNode *)(GPOINTER_TO_SIZE(p) | 3))
+#define LF_PRIORITY_UNMARK(p)                                        \
+    ((LfPriorityNode *)(GPOINTER_TO_SIZE(p) & ~(gsize)3))
+
+/*
+ * Inserting keeps the predecessor and successor found at each level
+ * protected until it has linked the node in, two slots per level.  Deleting
+ * needs two slots to walk the list with, and the other two of the lowest
+ * levels for the head's successor and, while restructuring, a level of the
+ * head.
+ */
+#define LF_PRIORITY_SLOT_PRED(i)  (2 * (i))
+#define LF_PRIORITY_SLOT_SUCC(i)  (2 * (i) + 1)
+#define LF_PRIORITY_SLOT_OBSHEAD  (2)
+#define LF_PRIORITY_SLOT_HEAD     (3)
+#define LF_PRIORITY_N_SLOTS       (2 * LF_PRIORITY_QUEUE_MAX_LEVEL)
+
+typedef struct _LfPriorityNode LfPriorityNode;
+
+/*
+ * A node with level links.  Only the level 0 links carry marks.  inserting
+ * stays set until the inserter is done linking the upper levels, and
+ * recycled is set once the node has been unlinked for good.
+ */
+struct _LfPriorityNode {
+	gint64           key;
+	gpointer         data;
+	guint            level;
+	volatile gint    inserting;
+	volatile gint    recycled;
+	LfPriorityNode  *next[1];
+};
+
+/*
+ * A skiplist based priority queue after Linden and Jonsson.  Items are
+ * sorted by key, and deleting the minimum only marks it deleted by setting
+ * the low bit of its predecessor's level 0 link.  The deleted nodes thus
+ * form a prefix of the list that delete_min walks past, marking the first
+ * node it finds unmarked, so concurrent deletes touch different nodes
+ * instead of all fighting over the head.  Inserts go after the deleted
+ * prefix.
+ *
+ * Only once a delete has walked past LF_PRIORITY_QUEUE_BOUND_OFFSET deleted
+ * nodes does it unlink the prefix, all at once, by swinging the head's level
+ * 0 link past it.  It then moves the upper levels of the head past it as
+ * well, and retires the nodes.  A prefix never reaches past a node that is
+ * still being inserted, so inserters may keep writing to their node.
+ *
+ * Hazard pointers need a way to tell that a node just read from a link has
+ * not been freed in the meantime.  Re-reading the link is not enough here,
+ * since the links of unlinked nodes do not change.  Instead each node is
+ * flagged recycled before it is retired, and a node read from a link is safe
+ * as long as the node holding the link has not been recycled.  For that to
+ * hold prefixes are unlinked in list order, and the next prefix cannot be
+ * unlinked until every node in the last one is flagged; the busy bit on the
+ * head's link holds it off until then.  The head itself is never recycled,
+ * but its links are moved past a prefix before the prefix is retired, so
+ * for the head re-reading the link does suffice.
+ */
+struct _LfPriorityQueue {
+	LfPriorityNode  *head;
+	LfPriorityNode  *tail;
+	volatile gint    ref_count;
+	LfHazardDomain  *domain;
+};
+
+static GStaticPrivate lf_priority_queue_seed = G_STATIC_PRIVATE_INIT;
+
+/*
+ * Every level of a skiplist needs its own hazard pointers, far more than the
+ * default domain offers, so all priority queues share a domain of their own.
+ */
+static LfHazardDomain*
+lf_priority_queue_get_domain(void)
+{
+	static LfHazardDomain *domain = NULL;
+	LfHazardDomain *tmp;
+
+	if (g_once_init_enter((gsize *)&domain)) {
+		tmp = lf_hazard_domain_new(LF_PRIORITY_N_SLOTS);
+		g_once_init_leave((gsize *)&domain, (gsize)tmp);
+	}
+
+	return domain;
+}
+
+/*
+ * Picks the number of levels for a new node, each level half as likely as
+ * the one below it.  xorshift on a seed kept per thread does not take the
+ * global lock g_random_int() does.
+ */
+static guint
+lf_priority_queue_random_level(void)
+{
+	guint32 x;
+	guint level = 1;
+
+	x = GPOINTER_TO_UINT(g_static_private_get(&lf_priority_queue_seed));
+	if (G_UNLIKELY(!x))
+		x = g_random_int() | 1;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	g_static_private_set(&lf_priority_queue_seed, GUINT_TO_POINTER(x), NULL);
+
+	for (; (x & 1) && level < LF_PRIORITY_QUEUE_MAX_LEVEL; x >>= 1)
+		level++;
+
+	return level;
+}
+
+static LfPriorityNode*
+lf_priority_node_new(guint    level,
+                     gint64   key,
+                     gpointer data)
+{
+	LfPriorityNode *node;
+
+	node = g_slice_alloc0(sizeof(LfPriorityNode) +
+	                      sizeof(gpointer) * (level - 1));
+	node->key = key;
+	node->data = data;
+	node->level = level;
+
+	return node;
+}
+
+static void
+lf_priority_node_free(gpointer data)
+{
+	LfPriorityNode *node = data;
+
+	g_slice_free1(sizeof(LfPriorityNode) +
+	              sizeof(gpointer) * (node->level - 1), node);
+}
+
+/*
+ * Loads the link out of pred at level and protects the node it points to
+ * with the hazard slot.
+ *
+ * Returns: FALSE if pred has been recycled, in which case the node may
+ *   already have been freed and the caller has to start over from the head.
+ */
+static inline gboolean
+lf_priority_queue_read(LfHazard        *myhazard,
+                       guint            slot,
+                       LfPriorityNode  *pred,
+                       guint            level,
+                       LfPriorityNode **link)
+{
+	do {
+		*link = lf_atomic_load(&pred->next[level], memory_order_acquire);
+		LF_HAZARD_SET(slot, LF_PRIORITY_UNMARK(*link));
+		if (lf_atomic_load(&pred->recycled, memory_order_seq_cst))
+			return FALSE;
+	} while (lf_atomic_load(&pred->next[level], memory_order_seq_cst) != *link);
+
+	return TRUE;
+}
+
+/*
+ * Finds at every level the last node with a key less than key and the node
+ * after it, leaving both protected by the hazard slots of their level.
+ * Nodes whose successor is deleted, and at level 0 the deleted nodes too,
+ * are passed over whatever their keys.
+ *
+ * Returns: The last deleted node passed over at level 0, or NULL.
+ */
+static LfPriorityNode*
+lf_priority_queue_locate(LfPriorityQueue  *queue,
+                         LfHazard         *myhazard,
+                         gint64            key,
+                         LfPriorityNode  **preds,
+                         LfPriorityNode  **succs)
+{
+	LfPriorityNode *pred, *cur, *link, *del;
+	gint i;
+
+try_again:
+	pred = queue->head;
+	del = NULL;
+	for (i = LF_PRIORITY_QUEUE_MAX_LEVEL - 1; i >= 0; i--) {
+		LF_HAZARD_SET(LF_PRIORITY_SLOT_PRED(i), pred);
+		if (!lf_priority_queue_read(myhazard, LF_PRIORITY_SLOT_SUCC(i),
+		                            pred, i, &link))
+			goto try_again;
+		cur = LF_PRIORITY_UNMARK(link);
+		while (cur != queue->tail &&
+		       (cur->key < key ||
+		        LF_PRIORITY_MARKED(lf_atomic_load(&cur->next[0],
+		                                          memory_order_acquire)) ||
+		        (i == 0 && LF_PRIORITY_MARKED(link)))) {
+			if (i == 0 && LF_PRIORITY_MARKED(link))
+				del = cur;
+			pred = cur;
+			LF_HAZARD_SET(LF_PRIORITY_SLOT_PRED(i), pred);
+			if (!lf_priority_queue_read(myhazard, LF_PRIORITY_SLOT_SUCC(i),
+			                            pred, i, &link))
+				goto try_again;
+			cur = LF_PRIORITY_UNMARK(link);
+		}
+		preds[i] = pred;
+		succs[i] = cur;
+	}
+
+	return del;
+}
+
+/*
+ * Moves every upper level of the head past the nodes whose successor is
+ * deleted.  Each level starts over from the head rather than from where the
+ * level above ended, which keeps the slots needed to two plus the head's.
+ */
+static void
+lf_priority_queue_restructure(LfPriorityQueue *queue,
+                              LfHazard        *myhazard)
+{
+	LfPriorityNode *head = queue->head, *h, *pred, *cur;
+	gboolean valid;
+	guint slot;
+	gint i;
+
+	for (i = LF_PRIORITY_QUEUE_MAX_LEVEL - 1; i > 0;) {
+		/* Cannot fail, queue->head is never recycled */
+		(void)lf_priority_queue_read(myhazard, LF_PRIORITY_SLOT_HEAD,
+		                             head, i, &h);
+		if (!LF_PRIORITY_MARKED(lf_atomic_load(&h->next[0],
+		                                       memory_order_acquire))) {
+			i--;
+			continue;
+		}
+		pred = h;
+		slot = 0;
+		valid = lf_priority_queue_read(myhazard, slot, pred, i, &cur);
+		while (valid &&
+		       LF_PRIORITY_MARKED(lf_atomic_load(&cur->next[0],
+		                                         memory_order_acquire))) {
+			pred = cur;
+			slot ^= 1;
+			valid = lf_priority_queue_read(myhazard, slot, pred, i, &cur);
+		}
+		if (valid && lf_atomic_pointer_cas(&head->next[i], h, cur,
+		                                   memory_order_seq_cst))
+			i--;
+	}
+}
+
+/*
+ * Finishes unlinking the nodes from first up to last, which the head's level
+ * 0 link has just been swung past with the busy bit set.  While the bit is
+ * set nobody else can unlink anything, so the upper levels of the head are
+ * moved past the nodes without meeting a recycled node on the way.  Then
+ * every node is flagged before the bit is cleared, so that no later prefix
+ * can be retired before this one is flagged.
+ */
+static void
+lf_priority_queue_unlink(LfPriorityQueue *queue,
+                         LfHazard        *myhazard,
+                         LfPriorityNode  *first,
+                         LfPriorityNode  *last)
+{
+	LfPriorityNode *node, *next;
+
+	lf_priority_queue_restructure(queue, myhazard);
+
+	for (node = first; node != last; node = next) {
+		next = LF_PRIORITY_UNMARK(lf_atomic_load(&node->next[0],
+		                                         memory_order_relaxed));
+		lf_atomic_store(&node->recycled, TRUE, memory_order_seq_cst);
+	}
+	lf_atomic_store(&queue->head->next[0], LF_PRIORITY_MARK(last),
+	                memory_order_seq_cst);
+
+	for (node = first; node != last; node = next) {
+		next = LF_PRIORITY_UNMARK(lf_atomic_load(&node->next[0],
+		                                         memory_order_relaxed));
+		LF_HAZARD_RETIRE(node, lf_priority_node_free);
+	}
+	LF_HAZARD_COLLECT();
+}
+
+static void
+lf_priority_queue_destroy(LfPriorityQueue *queue)
+{
+	LfPriorityNode *node, *next;
+
+	g_return_if_fail(queue != NULL);
+
+	/*
+	 * Deleted nodes that were never unlinked are still on level 0.
+	 */
+	for (node = queue->head; node; node = next) {
+		next = LF_PRIORITY_UNMARK(node->next[0]);
+		lf_priority_node_free(node);
+	}
+}
+
+/**
+ * lf_priority_queue_new:
+ *
+ * Creates a new instance of #LfPriorityQueue, a lock-free priority queue
+ * whose items are removed lowest key first.  The #LfPriorityQueue structure
+ * is reference counted and should be freed using lf_priority_queue_unref().
+ *
+ * Returns: The newly created #LfPriorityQueue.
+ * Side effects: None.
+ */
+LfPriorityQueue*
+lf_priority_queue_new(void)
+{
+	LfPriorityQueue *queue;
+	gint i;
+
+	queue = g_slice_new(LfPriorityQueue);
+	queue->head = lf_priority_node_new(LF_PRIORITY_QUEUE_MAX_LEVEL,
+	                                   G_MININT64, NULL);
+	queue->tail = lf_priority_node_new(LF_PRIORITY_QUEUE_MAX_LEVEL,
+	                                   G_MAXINT64, NULL);
+	for (i = 0; i < LF_PRIORITY_QUEUE_MAX_LEVEL; i++)
+		queue->head->next[i] = queue->tail;
+	queue->ref_count = 1;
+	queue->domain = lf_priority_queue_get_domain();
+
+	return queue;
+}
+
+/**
+ * lf_priority_queue_ref:
+ * @queue: A #LfPriorityQueue
+ *
+ * Atomically increments the reference count of @queue by one.
+ *
+ * Returns: A reference to @queue.
+ * Side effects: None.
+ */
+LfPriorityQueue*
+lf_priority_queue_ref(LfPriorityQueue *queue)
+{
+	g_return_val_if_fail(queue != NULL, NULL);
+	g_return_val_if_fail(queue->ref_count > 0, NULL);
+
+	g_atomic_int_inc(&queue->ref_count);
+	return queue;
+}
+
+/**
+ * lf_priority_queue_unref:
+ * @queue: A #LfPriorityQueue
+ *
+ * Decrements the reference count of @queue by one.  When the reference count
+ * reaches zero, the structures allocations are released and the queue is
+ * freed.
+ */
+void
+lf_priority_queue_unref(LfPriorityQueue *queue)
+{
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(queue->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&queue->ref_count)) {
+		lf_priority_queue_destroy(queue);
+		g_slice_free(LfPriorityQueue, queue);
+	}
+}
+
+/**
+ * lf_priority_queue_get_type:
+ *
+ * Retrieves the GObject type system's type identifier for #LfPriorityQueue.
+ *
+ * Returns: A #GType containing the type id.
+ * Side effects: Registers the #LfPriorityQueue type if not already.
+ */
+GType
+lf_priority_queue_get_type(void)
+{
+	static GType type_id = 0;
+	GType tmp_id;
+
+	if (g_once_init_enter((gsize *)&type_id)) {
+		tmp_id = g_boxed_type_register_static(
+			"LfPriorityQueue",
+			(GBoxedCopyFunc)lf_priority_queue_ref,
+			(GBoxedFreeFunc)lf_priority_queue_unref);
+		g_once_init_leave((gsize *)&type_id, tmp_id);
+	}
+
+	return type_id;
+}
+
+/**
+ * lf_priority_queue_insert:
+ * @queue: A #LfPriorityQueue
+ * @key: The priority of @data, lowest first.
+ * @data: a non-%NULL pointer.
+ *
+ * Inserts @data into @queue with @key.  The order in which items with equal
+ * keys are removed is unspecified.
+ *
+ * Side effects: None.
+ */
+void
+lf_priority_queue_insert(LfPriorityQueue *queue,
+                         gint64           key,
+                         gconstpointer    data)
+{
+	LfPriorityNode *preds[LF_PRIORITY_QUEUE_MAX_LEVEL];
+	LfPriorityNode *succs[LF_PRIORITY_QUEUE_MAX_LEVEL];
+	LfPriorityNode *node, *del;
+	guint level, i;
+	LF_HAZARD_INIT;
+
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(data != NULL);
+
+	LF_HAZARD_ENTER(queue->domain);
+
+	level = lf_priority_queue_random_level();
+	node = lf_priority_node_new(level, key, (gpointer)data);
+	node->inserting = TRUE;
+
+	do {
+		del = lf_priority_queue_locate(queue, LF_HAZARD_TLS, key, preds, succs);
+		node->next[0] = succs[0];
+	} while (!lf_atomic_pointer_cas(&preds[0]->next[0], succs[0], node,
+	                                memory_order_seq_cst));
+
+	/*
+	 * The node is in the queue and may be deleted at any moment, though not
+	 * unlinked while it is still inserting.  The upper levels are only
+	 * shortcuts, so rather than link them in next to deleted nodes, which
+	 * could leave a link pointing back into the deleted prefix, we give up
+	 * on them.
+	 */
+	for (i = 1; i < level; i++) {
+		lf_atomic_store(&node->next[i], succs[i], memory_order_relaxed);
+		if (LF_PRIORITY_MARKED(lf_atomic_load(&node->next[0],
+		                                      memory_order_acquire)) ||
+		    LF_PRIORITY_MARKED(lf_atomic_load(&succs[i]->next[0],
+		                                      memory_order_acquire)) ||
+		    succs[i] == del)
+			break;
+		if (lf_atomic_pointer_cas(&preds[i]->next[i], succs[i], node,
+		                          memory_order_seq_cst))
+			continue;
+		del = lf_priority_queue_locate(queue, LF_HAZARD_TLS, key,
+		                               preds, succs);
+		if (succs[0] != node)
+			break;
+		i--;
+	}
+
+	lf_atomic_store(&node->inserting, FALSE, memory_order_release);
+}
+
+/**
+ * lf_priority_queue_delete_min:
+ * @queue: A #LfPriorityQueue
+ * @key: A location for the key of the item, or %NULL.
+ *
+ * Removes the item with the lowest key from @queue.  Deleted items are
+ * unlinked in batches of about %LF_PRIORITY_QUEUE_BOUND_OFFSET, so most
+ * calls only write to the node they remove.
+ *
+ * Returns: The item with the lowest key, or %NULL if @queue is empty.
+ *
+ * Side effects: Hazard pointer reclaimation can occur meaning that structures
+ *   no longer in use may be freed by the system.
+ */
+gpointer
+lf_priority_queue_delete_min(LfPriorityQueue *queue,
+                             gint64          *key)
+{
+	LfPriorityNode *x, *next, *link, *obshead, *newhead;
+	gpointer data;
+	guint offset, slot;
+	LF_HAZARD_INIT;
+
+	g_return_val_if_fail(queue != NULL, NULL);
+
+	LF_HAZARD_ENTER(queue->domain);
+
+try_again:
+	/*
+	 * Keep the head's successor protected so that it cannot be recycled and
+	 * come back as the head's successor, letting a stale unlink succeed.
+	 * The read cannot fail since queue->head is never recycled.
+	 */
+	(void)lf_priority_queue_read(LF_HAZARD_TLS, LF_PRIORITY_SLOT_OBSHEAD,
+	                             queue->head, 0, &obshead);
+	x = queue->head;
+	newhead = NULL;
+	offset = 0;
+	slot = 0;
+
+	/*
+	 * Walk the deleted prefix until we manage to mark a node deleted.  The
+	 * node is protected before it is marked, since as soon as it is another
+	 * delete may walk past it and unlink it.
+	 */
+	while (TRUE) {
+		if (!lf_priority_queue_read(LF_HAZARD_TLS, slot ^ 1, x, 0, &link))
+			goto try_again;
+		next = LF_PRIORITY_UNMARK(link);
+		if (next == queue->tail)
+			return NULL;
+		if (!newhead && lf_atomic_load(&x->inserting, memory_order_acquire))
+			newhead = x;
+		if (!LF_PRIORITY_MARKED(link) &&
+		    !lf_atomic_pointer_cas(&x->next[0], link,
+		                           LF_PRIORITY_MARK(link),
+		                           memory_order_seq_cst))
+			continue;
+		offset++;
+		x = next;
+		slot ^= 1;
+		if (!LF_PRIORITY_MARKED(link))
+			break;
+	}
+
+	data = x->data;
+	if (key)
+		*key = x->key;
+
+	if (offset >= LF_PRIORITY_QUEUE_BOUND_OFFSET && !LF_PRIORITY_BUSY(obshead)) {
+		if (!newhead)
+			newhead = x;
+		if (newhead != LF_PRIORITY_UNMARK(obshead) &&
+		    lf_atomic_pointer_cas(&queue->head->next[0], obshead,
+		                          LF_PRIORITY_MARK_BUSY(newhead),
+		                          memory_order_seq_cst))
+			lf_priority_queue_unlink(queue, LF_HAZARD_TLS,
+			                         LF_PRIORITY_UNMARK(obshead), newhead);
+	}
+
+	return data;
+}
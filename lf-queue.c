@@ -21,39 +21,287 @@
  * THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 #include "lf-queue.h"
+#include "lf-atomic.h"
+#include "lf-epoch.h"
 #include "lf-hazard.h"
+#include "lf-futex.h"
+#include "lf-node.h"
+
+/**
+ * @LF_CACHE_LINE: The assumed size of a cache line in bytes.  Statistics
+ *                 shards are padded and aligned to this.
+ */
+#define LF_CACHE_LINE (64)
+
+/**
+ * @LF_QUEUE_SPIN_COUNT: The number of times lf_queue_dequeue_wait() polls
+ *                       the queue before going to sleep.
+ */
+#define LF_QUEUE_SPIN_COUNT (128)
+
+/**
+ * @LF_QUEUE_SOURCE_BATCH: The number of items a source created by
+ *                         lf_queue_create_source() dispatches at once when
+ *                         no batch size is given.
+ */
+#define LF_QUEUE_SOURCE_BATCH (64)
+
+/**
+ * @LF_QUEUE_COUNTER_SHARDS: The number of cache line sized counter blocks
+ *                           kept per queue for its length and, when enabled,
+ *                           its statistics.  Threads are spread over them by
+ *                           hazard record or epoch id.
+ */
+#define LF_QUEUE_COUNTER_SHARDS (16)
 
-typedef struct _LfNode LfNode;
+/**
+ * @LF_QUEUE_LENGTH_BATCH: The most a thread's shard of a queue's length may
+ *                         drift from zero before it is folded into the
+ *                         length shared by all threads.  Queues with a
+ *                         capacity or watermarks use less, so that the
+ *                         drift of all shards stays well within them, and
+ *                         count straight into the shared length once that
+ *                         would leave a batch of one.
+ */
+#define LF_QUEUE_LENGTH_BATCH (64)
+
+/**
+ * @LF_QUEUE_RECLAIM_DEFAULT: The #LfQueueReclaim used by lf_queue_new().
+ */
+#ifndef LF_QUEUE_RECLAIM_DEFAULT
+#define LF_QUEUE_RECLAIM_DEFAULT LF_QUEUE_RECLAIM_HAZARD
+#endif
+
+/**
+ * @LF_QUEUE_ENGINE_DEFAULT: The #LfQueueEngine used by lf_queue_new() and
+ *                           lf_queue_new_full().
+ */
+#ifndef LF_QUEUE_ENGINE_DEFAULT
+#define LF_QUEUE_ENGINE_DEFAULT LF_QUEUE_ENGINE_LIST
+#endif
+
+/**
+ * @LF_QUEUE_SEGMENT_SIZE: The number of item slots in each segment of a
+ *                         %LF_QUEUE_ENGINE_SEGMENT queue.  Only one in this
+ *                         many operations has to allocate or retire memory.
+ */
+#ifndef LF_QUEUE_SEGMENT_SIZE
+#define LF_QUEUE_SEGMENT_SIZE (256)
+#endif
+
+/*
+ * Marks a segment slot that a dequeuer gave up on before its enqueuer filled
+ * it.  The enqueuer then fails to fill it and claims another slot instead.
+ */
+static gchar _lf_queue_taken;
+#define LF_QUEUE_TAKEN ((gpointer)&_lf_queue_taken)
 
-struct _LfNode {
-	gpointer  data;
-	LfNode   *next;
+typedef struct _LfQueueGuard   LfQueueGuard;
+typedef struct _LfQueueSegment LfQueueSegment;
+typedef union  _LfQueueCounter LfQueueCounter;
+
+/*
+ * One shard of a queue's length and statistics, padded out to a cache line
+ * so threads counting into different shards never contend.  Two threads only
+ * share a shard when there are more threads than shards, so the atomic adds
+ * are almost always uncontended.  length is the number of items enqueued
+ * less those dequeued through this shard since it was last folded into the
+ * queue's length.
+ */
+union _LfQueueCounter {
+	struct {
+		gssize length;
+		gsize enqueued;
+		gsize dequeued;
+		gsize empty_dequeues;
+		gsize cas_failures;
+		gsize tail_helps;
+	} c;
+	gchar pad[LF_CACHE_LINE];
 };
 
+/*
+ * The calling thread's state for whichever reclaimation scheme protects the
+ * queue.  Hazard pointers protect each node as it is read, so hazard is set
+ * and the loops publish every node they dereference.  Epochs protect
+ * everything between entering and leaving, so epoch is set instead and
+ * publishing is a no-op.  id picks the thread's counter shard.
+ */
+struct _LfQueueGuard {
+	LfHazard *hazard;
+	LfEpoch  *epoch;
+	gint      id;
+};
+
+/*
+ * A segment of a %LF_QUEUE_ENGINE_SEGMENT queue.  Enqueuers claim slots by
+ * incrementing enq_idx and dequeuers by incrementing deq_idx, so unlike the
+ * CAS loops of the list engine every attempt claims something.  A thread only
+ * retries when its slot was given up on by the other side, or when the
+ * segment is used up and the next one has to be linked in.
+ *
+ * The indices and the link are each on a cache line of their own so that
+ * enqueuers and dequeuers of the same segment do not falsely share.
+ */
+struct _LfQueueSegment {
+	volatile gint    deq_idx;
+	gchar            pad0[LF_CACHE_LINE - sizeof(gint)];
+	volatile gint    enq_idx;
+	gchar            pad1[LF_CACHE_LINE - sizeof(gint)];
+	LfQueueSegment  *next;
+	gchar            pad2[LF_CACHE_LINE - sizeof(gpointer)];
+	gpointer         items[LF_QUEUE_SEGMENT_SIZE];
+};
+
+/*
+ * The counter shard of the thread holding guard g.
+ */
+#define LF_QUEUE_COUNTER(q,g)                                            \
+    (&(q)->counters[(guint)(g)->id % LF_QUEUE_COUNTER_SHARDS])
+
+#ifdef LF_ENABLE_STATS
+#define LF_QUEUE_STAT(q,g,f,n)                                           \
+    lf_atomic_add_fetch(&LF_QUEUE_COUNTER((q), (g))->c.f, (n),           \
+                        memory_order_relaxed)
+#else
+#define LF_QUEUE_STAT(q,g,f,n) G_STMT_START { } G_STMT_END
+#endif
+
+/*
+ * head and tail are used by %LF_QUEUE_ENGINE_LIST queues, seg_head and
+ * seg_tail by %LF_QUEUE_ENGINE_SEGMENT queues.
+ *
+ * waiters counts the threads blocked in lf_queue_dequeue_wait() and
+ * wake_seq is the futex word they sleep on.  Enqueuers only bump wake_seq
+ * and issue a wake up when waiters is non-zero.
+ *
+ * event_fd is the eventfd polled by sources from lf_queue_create_source(),
+ * or -1 until the first one is created.  A source sets armed when it finds
+ * the queue empty, and the first enqueuer to see it set clears it and
+ * signals event_fd, so only the transition from empty to non-empty costs a
+ * system call.
+ *
+ * length is the sum of the counter shards' lengths folded in so far, see
+ * lf_queue_count().  It is the only length enqueuers check against capacity.
+ * length_batch is 0 when the shards are bypassed and every count goes to
+ * length directly.
+ * above is set between the watermark callback reporting the high watermark
+ * and it reporting the low one, and watermark_busy while a thread is
+ * delivering either.
+ */
 struct _LfQueue {
-	LfNode        *head;
-	LfNode        *tail;
-	volatile gint  ref_count;
+	LfNode          *head;
+	LfNode          *tail;
+	LfQueueSegment  *seg_head;
+	LfQueueSegment  *seg_tail;
+	LfQueueEngine    engine;
+	volatile gint    ref_count;
+	volatile gint    waiters;
+	volatile gint    wake_seq;
+	volatile gint    armed;
+	volatile gint    event_fd;
+	LfQueueReclaim   reclaim;
+	LfHazardDomain  *hazards;
+	LfEpochDomain   *epochs;
+	LfQueueCounter  *counters;
+	volatile gssize  length;
+	gssize           length_batch;
+	guint            capacity;
+	guint            low_watermark;
+	guint            high_watermark;
+	volatile gint    above;
+	volatile gint    watermark_busy;
+	LfQueueWatermarkFunc watermark_func;
+	gpointer         watermark_data;
 };
 
+/*
+ * Allocates a segment with the first n_items of items, at most a segment's
+ * worth, already in its first slots.
+ */
+static LfQueueSegment*
+lf_queue_segment_new(gpointer *items,
+                     guint     n_items)
+{
+	LfQueueSegment *segment;
+	gpointer mem;
+
+	if (posix_memalign(&mem, LF_CACHE_LINE, sizeof(LfQueueSegment)) != 0)
+		g_error("Failed to allocate %" G_GSIZE_FORMAT " bytes",
+		        sizeof(LfQueueSegment));
+
+	segment = mem;
+	memcpy(segment->items, items, sizeof(gpointer) * n_items);
+	memset(segment->items + n_items, 0,
+	       sizeof(gpointer) * (LF_QUEUE_SEGMENT_SIZE - n_items));
+	segment->deq_idx = 0;
+	segment->enq_idx = n_items;
+	segment->next = NULL;
+
+	return segment;
+}
+
 static void
-lf_node_free(LfNode *node)
+lf_queue_segment_free(gpointer segment)
 {
-	g_return_if_fail(node != NULL);
-	g_slice_free(LfNode, node);
+	free(segment);
 }
 
 static void
 lf_queue_destroy(LfQueue *queue)
 {
-	LfNode *node;
+	LfQueueSegment *segment, *seg_next;
+	LfNode *node, *next;
 
 	g_return_if_fail(queue != NULL);
 
-	for (node = queue->head; node; node = node->next) {
+	for (node = queue->head; node; node = next) {
+		next = node->next;
 		lf_node_free(node);
 	}
+	for (segment = queue->seg_head; segment; segment = seg_next) {
+		seg_next = segment->next;
+		lf_queue_segment_free(segment);
+	}
+	free(queue->counters);
+#ifdef __linux__
+	if (queue->event_fd >= 0)
+		close(queue->event_fd);
+#endif
+}
+
+/*
+ * Picks how far a counter shard's length may drift from zero before it is
+ * folded into the queue's length.  The drift of all shards together is kept
+ * to a quarter of the capacity and of the gap between the watermarks, so
+ * that capacity checks and watermark crossings are off by no more than that.
+ * A batch of one would make every operation fold its shard in, which costs
+ * more than counting into the queue's length directly, so then the shards
+ * are bypassed.
+ */
+static void
+lf_queue_update_length_batch(LfQueue *queue)
+{
+	guint limit = G_MAXUINT;
+	guint batch;
+
+	if (queue->capacity)
+		limit = queue->capacity;
+	if (queue->watermark_func)
+		limit = MIN(limit, queue->high_watermark - queue->low_watermark);
+
+	batch = limit / (LF_QUEUE_COUNTER_SHARDS * 4);
+	queue->length_batch = batch > 1 ? MIN(batch, LF_QUEUE_LENGTH_BATCH) : 0;
 }
 
 /**
@@ -62,23 +310,142 @@ lf_queue_destroy(LfQueue *queue)
  * Creates a new instance of #LfQueue.  The #LfQueue structure is reference
  * counted and should be freed using lf_queue_unref().
  *
+ * The queue uses the engine and reclaimation scheme chosen at build time
+ * with LF_QUEUE_ENGINE_DEFAULT and LF_QUEUE_RECLAIM_DEFAULT, which are a
+ * linked list and hazard pointers unless overridden.
+ *
  * Returns: The newly created #LfQueue.
  * Side effects: None.
  */
 LfQueue*
 lf_queue_new(void)
 {
-	static gboolean initialized = FALSE;
+	return lf_queue_new_full(LF_QUEUE_RECLAIM_DEFAULT);
+}
+
+/**
+ * lf_queue_new_full:
+ * @reclaim: The #LfQueueReclaim scheme used to free dequeued nodes.
+ *
+ * Creates a new instance of #LfQueue using @reclaim to decide when nodes
+ * removed from the queue may be freed.
+ *
+ * %LF_QUEUE_RECLAIM_HAZARD bounds the number of nodes awaiting reclaimation
+ * but publishes a hazard pointer, with a barrier, for every node read.
+ * %LF_QUEUE_RECLAIM_EPOCH costs a single barrier per operation, but a thread
+ * stalled in the middle of an operation holds back reclaimation for every
+ * queue in the process.
+ *
+ * Returns: The newly created #LfQueue.
+ * Side effects: None.
+ */
+LfQueue*
+lf_queue_new_full(LfQueueReclaim reclaim)
+{
+	return lf_queue_new_with_engine(LF_QUEUE_ENGINE_DEFAULT, reclaim);
+}
+
+/**
+ * lf_queue_new_with_engine:
+ * @engine: The #LfQueueEngine implementing the queue.
+ * @reclaim: The #LfQueueReclaim scheme used to free dequeued memory.
+ *
+ * Creates a new instance of #LfQueue using @engine, and @reclaim to decide
+ * when memory removed from the queue may be freed.
+ *
+ * %LF_QUEUE_ENGINE_LIST allocates a small node per item and claims items
+ * with compare-and-swap loops on the ends of the queue, which may retry any
+ * number of times under contention.  %LF_QUEUE_ENGINE_SEGMENT claims slots
+ * of LF_QUEUE_SEGMENT_SIZE item segments with fetch-and-add, so operations
+ * rarely retry and only one in a segment's worth allocates or reclaims.
+ * Batches claim a run of slots with a single fetch-and-add.  It does however
+ * keep a whole segment around even when nearly empty.
+ *
+ * Returns: The newly created #LfQueue.
+ * Side effects: None.
+ */
+LfQueue*
+lf_queue_new_with_engine(LfQueueEngine  engine,
+                         LfQueueReclaim reclaim)
+{
 	LfQueue *queue;
 
-	if (g_once_init_enter((gsize *)&initialized)) {
-		lf_hazard_free = (gpointer)lf_node_free;
-		g_once_init_leave((gsize *)&initialized, TRUE);
-	}
+	g_return_val_if_fail(engine == LF_QUEUE_ENGINE_LIST ||
+	                     engine == LF_QUEUE_ENGINE_SEGMENT, NULL);
+	g_return_val_if_fail(reclaim == LF_QUEUE_RECLAIM_HAZARD ||
+	                     reclaim == LF_QUEUE_RECLAIM_EPOCH, NULL);
 
 	queue = g_slice_new(LfQueue);
-	queue->head = queue->tail = g_slice_new0(LfNode);
+	queue->head = queue->tail = NULL;
+	queue->seg_head = queue->seg_tail = NULL;
+	if (engine == LF_QUEUE_ENGINE_SEGMENT) {
+		queue->seg_head = queue->seg_tail = lf_queue_segment_new(NULL, 0);
+	} else {
+		queue->head = queue->tail = lf_node_new();
+		queue->head->data = NULL;
+		queue->head->next = NULL;
+	}
+	queue->engine = engine;
 	queue->ref_count = 1;
+	queue->waiters = 0;
+	queue->wake_seq = 0;
+	queue->armed = FALSE;
+	queue->event_fd = -1;
+	queue->reclaim = reclaim;
+	queue->hazards = NULL;
+	queue->epochs = NULL;
+	if (reclaim == LF_QUEUE_RECLAIM_EPOCH)
+		queue->epochs = lf_epoch_domain_get_default();
+	else
+		queue->hazards = lf_hazard_domain_get_default();
+	if (posix_memalign((gpointer *)&queue->counters, LF_CACHE_LINE,
+	                   sizeof(LfQueueCounter) * LF_QUEUE_COUNTER_SHARDS) != 0)
+		g_error("Failed to allocate %" G_GSIZE_FORMAT " bytes",
+		        sizeof(LfQueueCounter) * LF_QUEUE_COUNTER_SHARDS);
+	memset(queue->counters, 0,
+	       sizeof(LfQueueCounter) * LF_QUEUE_COUNTER_SHARDS);
+	queue->length = 0;
+	queue->capacity = 0;
+	queue->low_watermark = 0;
+	queue->high_watermark = 0;
+	queue->above = FALSE;
+	queue->watermark_busy = FALSE;
+	queue->watermark_func = NULL;
+	queue->watermark_data = NULL;
+	lf_queue_update_length_batch(queue);
+
+	return queue;
+}
+
+/**
+ * lf_queue_new_with_capacity:
+ * @capacity: The number of items beyond which lf_queue_try_enqueue() fails,
+ *   or 0 for no limit.
+ *
+ * Creates a new instance of #LfQueue with a soft capacity, using the default
+ * engine and reclaimation scheme like lf_queue_new().
+ *
+ * The capacity only bounds lf_queue_try_enqueue(); lf_queue_enqueue() and
+ * lf_queue_enqueue_many() always succeed.  It is checked against a length
+ * that lags the true one by up to a quarter of @capacity, see
+ * lf_queue_get_length_approx(), so the queue may hold somewhat more or fewer
+ * items than @capacity before producers are turned away.
+ *
+ * Below a capacity of 128 the length is exact instead, but every enqueue and
+ * dequeue then updates the same shared counter, which serializes them under
+ * contention.
+ *
+ * Returns: The newly created #LfQueue.
+ * Side effects: None.
+ */
+LfQueue*
+lf_queue_new_with_capacity(guint capacity)
+{
+	LfQueue *queue;
+
+	queue = lf_queue_new();
+	queue->capacity = capacity;
+	lf_queue_update_length_batch(queue);
 
 	return queue;
 }
@@ -146,6 +513,407 @@ lf_queue_get_type(void)
 	return type_id;
 }
 
+static inline void
+lf_queue_guard_enter(LfQueue      *queue,
+                     LfQueueGuard *guard)
+{
+	if (queue->reclaim == LF_QUEUE_RECLAIM_EPOCH) {
+		guard->hazard = NULL;
+		guard->epoch = lf_epoch_enter(queue->epochs);
+		guard->id = lf_epoch_get_id(guard->epoch);
+	} else {
+		guard->hazard = lf_hazard_get(queue->hazards);
+		guard->epoch = NULL;
+		guard->id = guard->hazard->id;
+	}
+}
+
+/*
+ * Publishes that node may be dereferenced by the calling thread.  The caller
+ * must then verify node is still reachable before doing so, with a seq_cst
+ * load as lf_hazard_set() requires.
+ */
+static inline void
+lf_queue_guard_protect(LfQueueGuard *guard,
+                       gint          i,
+                       gpointer      node)
+{
+	if (guard->hazard)
+		lf_hazard_set(guard->hazard, i, node);
+}
+
+/*
+ * Like LF_HAZARD_SET(), expects the guard in a local named guard.
+ */
+#define LF_GUARD_SET(i,p) lf_queue_guard_protect(&guard, (i), (p))
+
+/*
+ * Queues node, which must no longer be reachable, to be freed with notify.
+ * Whether a reclaimation is due is only checked when leaving, so retiring a
+ * batch of nodes checks just once.
+ */
+static inline void
+lf_queue_guard_retire(LfQueueGuard   *guard,
+                      gpointer        node,
+                      GDestroyNotify  notify)
+{
+	if (guard->hazard)
+		lf_hazard_push(guard->hazard, node, notify);
+	else
+		lf_epoch_retire(guard->epoch, node, notify);
+}
+
+static inline void
+lf_queue_guard_leave(LfQueueGuard *guard)
+{
+	if (guard->hazard) {
+		if (G_UNLIKELY(guard->hazard->rcount >= guard->hazard->rthreshold))
+			lf_hazard_collect(guard->hazard);
+	} else {
+		lf_epoch_leave(guard->epoch);
+	}
+}
+
+/*
+ * Checks whether length is on the far side of the watermark the queue is
+ * waiting for it to cross.
+ */
+static inline gboolean
+lf_queue_crossed(LfQueue *queue,
+                 gssize   length)
+{
+	if (lf_atomic_load(&queue->above, memory_order_seq_cst))
+		return length <= (gssize)queue->low_watermark;
+	return length >= (gssize)queue->high_watermark;
+}
+
+/*
+ * Runs the watermark callback if length has crossed a watermark.  Only the
+ * thread that takes watermark_busy delivers a crossing, and it looks at the
+ * length again after dropping it.  A thread that fails to take it has
+ * already updated the length, so one of the two always sees the latest
+ * length with watermark_busy free.  Callbacks therefore never overlap, always
+ * alternate, and the last one matches the length the queue settled at.
+ */
+static void
+lf_queue_check_watermarks(LfQueue *queue,
+                          gssize   length)
+{
+	gboolean above;
+
+	while (lf_queue_crossed(queue, length) &&
+	       lf_atomic_int_cas(&queue->watermark_busy, FALSE, TRUE,
+	                         memory_order_seq_cst)) {
+		length = lf_atomic_load(&queue->length, memory_order_seq_cst);
+		if (lf_queue_crossed(queue, length)) {
+			above = !lf_atomic_load(&queue->above, memory_order_seq_cst);
+			lf_atomic_store(&queue->above, above, memory_order_seq_cst);
+			queue->watermark_func(queue, above, queue->watermark_data);
+		}
+		lf_atomic_store(&queue->watermark_busy, FALSE, memory_order_seq_cst);
+		length = lf_atomic_load(&queue->length, memory_order_seq_cst);
+	}
+}
+
+/*
+ * Counts n items into the queue, or out of it when negative.  The count goes
+ * to the calling thread's shard, and only once the shard has drifted
+ * length_batch from zero is it folded into the queue's length, so most
+ * operations only touch a cache line of their own.  Folding is also when the
+ * watermarks are checked.  Without a batch, n goes to the length directly.
+ */
+static inline void
+lf_queue_count(LfQueue      *queue,
+               LfQueueGuard *guard,
+               gssize        n)
+{
+	LfQueueCounter *counter;
+	gssize delta, length;
+
+	if (G_LIKELY(queue->length_batch)) {
+		counter = LF_QUEUE_COUNTER(queue, guard);
+		delta = lf_atomic_add_fetch(&counter->c.length, n,
+		                            memory_order_relaxed);
+		if (G_LIKELY(ABS(delta) < queue->length_batch))
+			return;
+		n = lf_atomic_exchange(&counter->c.length, 0,
+		                       memory_order_relaxed);
+	}
+
+	length = lf_atomic_add_fetch(&queue->length, n, memory_order_seq_cst);
+	if (G_UNLIKELY(queue->watermark_func != NULL))
+		lf_queue_check_watermarks(queue, length);
+}
+
+/*
+ * Loads that only find the next node or segment to look at are acquire,
+ * pairing with the CAS that published it.  Loads that verify a pointer is
+ * still reachable after protecting it are seq_cst, as lf_hazard_set()
+ * requires.  The CASes that link and unlink nodes stay seq_cst: the hazard
+ * pointer scan and lf_queue_signal() both order themselves against them, and
+ * on x86 they are locked instructions either way.  Statistics are relaxed.
+ */
+
+/*
+ * Links the private chain of nodes first through last onto the end of the
+ * queue's linked-list.  The chain only becomes visible to other threads once
+ * it is attached, so a chain of any length costs a single successful CAS.
+ */
+static void
+lf_queue_append(LfQueue *queue,
+                LfNode  *first,
+                LfNode  *last,
+                guint    n_items)
+{
+	LfQueueGuard guard;
+	LfNode *tail, *next;
+
+	lf_queue_guard_enter(queue, &guard);
+
+	/*
+	 * Attempt to add our new LfNode to the linked list until we succeed.
+	 * If the queue is only half-consistent due to another thread only
+	 * completing half of its work, we will clean up after it.
+	 */
+	while (TRUE) {
+		                             /* Retrieve the current tail */
+		tail = lf_atomic_load(&queue->tail, memory_order_acquire);
+		LF_GUARD_SET(0, tail);       /* Mark the pointer as hazardous */
+		                             /* Ensure tail is still valid */
+		if (lf_atomic_load(&queue->tail, memory_order_seq_cst) != tail)
+			continue;
+		                             /* Check for possible new tail */
+		next = lf_atomic_load(&tail->next, memory_order_acquire);
+		                             /* Ensure (again) tail is still vaild */
+		if (lf_atomic_load(&queue->tail, memory_order_acquire) != tail)
+			continue;
+		if (next != NULL) {          /* Inconsistent state, help it along */
+			lf_atomic_pointer_cas(&queue->tail, tail, next,
+			                      memory_order_seq_cst);
+			LF_QUEUE_STAT(queue, &guard, tail_helps, 1);
+			continue;
+		}
+		if (lf_atomic_pointer_cas(&tail->next, NULL, first, /* Attempt to  */
+		                          memory_order_seq_cst)) {  /* add ourself */
+			break;                                          /* to the end. */
+		}
+		LF_QUEUE_STAT(queue, &guard, cas_failures, 1);
+	}
+	LF_QUEUE_STAT(queue, &guard, enqueued, n_items);
+	lf_queue_count(queue, &guard, n_items);
+
+	/*
+	 * Attempt to update the tail to point at our last node.  If this fails
+	 * it is because another thread has beaten us.  Not to worry, readers
+	 * and future writers can move the queue into a consistent state.
+	 */
+	lf_atomic_pointer_cas(&queue->tail, tail, last, memory_order_seq_cst);
+	lf_queue_guard_leave(&guard);
+}
+
+/*
+ * Appends items to a %LF_QUEUE_ENGINE_SEGMENT queue.  A run of slots for as
+ * many of them as fit is claimed with a single fetch-and-add on enq_idx, and
+ * each slot claimed is handed out exactly once.  Filling one only fails if a
+ * dequeuer already gave up on it, in which case the item goes into the next.
+ */
+static void
+lf_queue_segment_enqueue_many(LfQueue  *queue,
+                              gpointer *items,
+                              guint     n_items)
+{
+	LfQueueGuard guard;
+	LfQueueSegment *tail, *next, *segment;
+	guint n_done = 0, n_fit;
+	gint idx, end;
+
+	lf_queue_guard_enter(queue, &guard);
+
+	while (n_done < n_items) {
+		tail = lf_atomic_load(&queue->seg_tail, memory_order_acquire);
+		LF_GUARD_SET(0, tail);
+		if (lf_atomic_load(&queue->seg_tail, memory_order_seq_cst) != tail)
+			continue;
+
+		/*
+		 * Claim slots only while the segment has some left, so that a
+		 * full segment costs a read rather than an atomic add.  Claiming
+		 * only has to be atomic; filling the slot publishes the item.
+		 */
+		if (lf_atomic_load(&tail->enq_idx, memory_order_relaxed) <
+		    LF_QUEUE_SEGMENT_SIZE) {
+			n_fit = MIN(n_items - n_done, LF_QUEUE_SEGMENT_SIZE);
+			idx = lf_atomic_int_add(&tail->enq_idx, n_fit,
+			                        memory_order_relaxed);
+			end = MIN(idx + (gint)n_fit, LF_QUEUE_SEGMENT_SIZE);
+			for (; idx < end; idx++) {
+				if (lf_atomic_pointer_cas(&tail->items[idx], NULL,
+				                          items[n_done],
+				                          memory_order_seq_cst))
+					n_done++;
+				else
+					LF_QUEUE_STAT(queue, &guard,
+					              cas_failures, 1);
+			}
+			continue;
+		}
+
+		/*
+		 * The segment is used up.  Link in a new one with as many of our
+		 * items as fit already in it, or help along whoever beat us to it.
+		 */
+		if ((next = lf_atomic_load(&tail->next, memory_order_acquire))) {
+			lf_atomic_pointer_cas(&queue->seg_tail, tail, next,
+			                      memory_order_seq_cst);
+			LF_QUEUE_STAT(queue, &guard, tail_helps, 1);
+			continue;
+		}
+		n_fit = MIN(n_items - n_done, LF_QUEUE_SEGMENT_SIZE);
+		segment = lf_queue_segment_new(items + n_done, n_fit);
+		if (lf_atomic_pointer_cas(&tail->next, NULL, segment,
+		                          memory_order_seq_cst)) {
+			lf_atomic_pointer_cas(&queue->seg_tail, tail, segment,
+			                      memory_order_seq_cst);
+			n_done += n_fit;
+		} else {
+			lf_queue_segment_free(segment);
+			LF_QUEUE_STAT(queue, &guard, cas_failures, 1);
+		}
+	}
+	LF_QUEUE_STAT(queue, &guard, enqueued, n_items);
+	lf_queue_count(queue, &guard, n_items);
+	lf_queue_guard_leave(&guard);
+}
+
+/*
+ * Removes up to max_items of the oldest items of a %LF_QUEUE_ENGINE_SEGMENT
+ * queue.  A run of as many slots as appear to be filled is claimed with a
+ * single fetch-and-add on deq_idx, and each slot is claimed by exactly one
+ * dequeuer.  If its enqueuer has not filled it yet we mark it taken rather
+ * than wait, so a stalled enqueuer never blocks us.
+ */
+static guint
+lf_queue_segment_dequeue_many(LfQueue  *queue,
+                              gpointer *items,
+                              guint     max_items)
+{
+	LfQueueGuard guard;
+	LfQueueSegment *head, *next;
+	gpointer data;
+	guint n_items = 0;
+	gint idx, end, n_claim, deq_idx, enq_idx;
+
+	lf_queue_guard_enter(queue, &guard);
+
+	while (n_items < max_items) {
+		head = lf_atomic_load(&queue->seg_head, memory_order_acquire);
+		LF_GUARD_SET(0, head);
+		if (lf_atomic_load(&queue->seg_head, memory_order_seq_cst) != head)
+			continue;
+
+		/*
+		 * Check for an empty queue before claiming a slot, so polling an
+		 * empty queue does not burn through the slots enqueuers need.
+		 */
+		deq_idx = lf_atomic_load(&head->deq_idx, memory_order_relaxed);
+		enq_idx = lf_atomic_load(&head->enq_idx, memory_order_relaxed);
+		if (deq_idx >= enq_idx &&
+		    !lf_atomic_load(&head->next, memory_order_acquire))
+			break;
+
+		n_claim = CLAMP(MIN(enq_idx, LF_QUEUE_SEGMENT_SIZE) - deq_idx,
+		                1, (gint)(max_items - n_items));
+		idx = lf_atomic_int_add(&head->deq_idx, n_claim,
+		                        memory_order_relaxed);
+		end = MIN(idx + n_claim, LF_QUEUE_SEGMENT_SIZE);
+		if (idx < end) {
+			for (; idx < end; idx++) {
+				data = lf_atomic_load(&head->items[idx],
+				                      memory_order_acquire);
+				if (!data) {
+					if (lf_atomic_pointer_cas(&head->items[idx], NULL,
+					                          LF_QUEUE_TAKEN,
+					                          memory_order_relaxed)) {
+						LF_QUEUE_STAT(queue, &guard,
+						              cas_failures, 1);
+						continue;
+					}
+					data = lf_atomic_load(&head->items[idx],
+					                      memory_order_acquire);
+				}
+				items[n_items++] = data;
+			}
+			continue;
+		}
+
+		/*
+		 * The segment is drained.  Move on to the next one, first making
+		 * sure the tail is not left behind pointing at the old head.
+		 */
+		if (!(next = lf_atomic_load(&head->next, memory_order_acquire)))
+			break;
+		if (lf_atomic_load(&queue->seg_tail, memory_order_acquire) == head) {
+			lf_atomic_pointer_cas(&queue->seg_tail, head, next,
+			                      memory_order_seq_cst);
+			LF_QUEUE_STAT(queue, &guard, tail_helps, 1);
+		}
+		if (lf_atomic_pointer_cas(&queue->seg_head, head, next,
+		                          memory_order_seq_cst))
+			lf_queue_guard_retire(&guard, head, lf_queue_segment_free);
+	}
+
+	if (n_items > 0) {
+		LF_QUEUE_STAT(queue, &guard, dequeued, n_items);
+		lf_queue_count(queue, &guard, -(gssize)n_items);
+	} else {
+		LF_QUEUE_STAT(queue, &guard, empty_dequeues, 1);
+	}
+	lf_queue_guard_leave(&guard);
+
+	return n_items;
+}
+
+/*
+ * Signals the eventfd of the queue's sources.
+ */
+static void
+lf_queue_notify_sources(LfQueue *queue)
+{
+#ifdef __linux__
+	guint64 one = 1;
+
+	if (write(queue->event_fd, &one, sizeof(one)) < 0) {
+		/*
+		 * The counter is saturated, so the source is woken anyway.
+		 */
+	}
+#else
+	(void)queue;
+#endif
+}
+
+/*
+ * Wakes up to n_items threads blocked in lf_queue_dequeue_wait() after new
+ * items have been appended, and any source waiting for the queue to become
+ * non-empty.  Checking for waiters after the append, while waiters re-check
+ * the queue after registering, means one side always sees the other; when
+ * nobody is waiting this costs two reads.  Both the append and these reads
+ * are seq_cst so that neither can be reordered past the other.
+ */
+static inline void
+lf_queue_signal(LfQueue *queue,
+                guint    n_items)
+{
+	if (G_UNLIKELY(lf_atomic_load(&queue->armed, memory_order_seq_cst)) &&
+	    lf_atomic_int_cas(&queue->armed, TRUE, FALSE, memory_order_relaxed))
+		lf_queue_notify_sources(queue);
+
+	if (G_UNLIKELY(lf_atomic_load(&queue->waiters, memory_order_seq_cst) > 0)) {
+		lf_atomic_int_add(&queue->wake_seq, 1, memory_order_release);
+		lf_futex_wake(&queue->wake_seq, MIN(n_items, G_MAXINT));
+	}
+}
+
 /**
  * lf_queue_enqueue:
  * @queue: A #LfQueue.
@@ -159,49 +927,108 @@ void
 lf_queue_enqueue(LfQueue       *queue,
                  gconstpointer  data)
 {
-	LfNode *node, *tail, *next;
-	LF_HAZARD_INIT;
+	LfNode *node;
 
 	g_return_if_fail(queue != NULL);
 	g_return_if_fail(data != NULL);
 
+	if (queue->engine == LF_QUEUE_ENGINE_SEGMENT) {
+		lf_queue_segment_enqueue_many(queue, (gpointer *)&data, 1);
+		lf_queue_signal(queue, 1);
+		return;
+	}
+
 	/*
 	 * Create a new LfNode to add to the queue's linked-list.
 	 */
-	node = g_slice_new(LfNode);
+	node = lf_node_new();
 	node->data = (gpointer)data;
 	node->next = NULL;
 
-	/*
-	 * Attempt to add our new LfNode to the linked list until we succeed.
-	 * If the queue is only half-consistent due to another thread only
-	 * completing half of its work, we will clean up after it.
-	 */
-	while (TRUE) {
-		tail = queue->tail;          /* Retrieve the current tail */
-		LF_HAZARD_SET(0, tail);      /* Mark the pointer as hazardous */
-		if (queue->tail != tail)     /* Ensure tail is still valid */
-			continue;
-		next = tail->next;           /* Check for possible new tail */
-		if (queue->tail != tail)     /* Ensure (again) tail is still vaild */
-			continue;
-		if (next != NULL) {          /* Inconsistent state, help it along */
-			g_atomic_pointer_compare_and_exchange((gpointer *)&queue->tail,
-			                                      tail, next);
-			continue;
-		}
-		if (g_atomic_pointer_compare_and_exchange(      /* Attempt to add    */
-				(gpointer *)&tail->next, NULL, node)) { /* ourself to end of */
-			break;                                      /* queue.            */
-		}
+	lf_queue_append(queue, node, node, 1);
+	lf_queue_signal(queue, 1);
+}
+
+/**
+ * lf_queue_try_enqueue:
+ * @queue: A #LfQueue.
+ * @data: a non-NULL pointer.
+ *
+ * Enqueues an item into the #LfQueue unless it is at its capacity.  See
+ * lf_queue_new_with_capacity().  Checking costs a single read, so producers
+ * that are turned away do not slow down the consumers they are waiting on.
+ *
+ * Returns: %TRUE if @data was enqueued, %FALSE if the queue is full.
+ * Side effects: None.
+ */
+gboolean
+lf_queue_try_enqueue(LfQueue       *queue,
+                     gconstpointer  data)
+{
+	g_return_val_if_fail(queue != NULL, FALSE);
+	g_return_val_if_fail(data != NULL, FALSE);
+
+	if (queue->capacity &&
+	    lf_atomic_load(&queue->length, memory_order_relaxed) >=
+	    (gssize)queue->capacity)
+		return FALSE;
+
+	lf_queue_enqueue(queue, data);
+	return TRUE;
+}
+
+/**
+ * lf_queue_enqueue_many:
+ * @queue: A #LfQueue.
+ * @items: An array of non-%NULL pointers.
+ * @n_items: The number of pointers in @items.
+ *
+ * Enqueues all of @items into the #LfQueue in order.  With the list engine
+ * the items are linked together privately first and then attached to the
+ * queue at once, so contention on the tail of the queue is paid once per call
+ * rather than once per item, and items from concurrent producers are never
+ * interleaved with them.  The segment engine claims a run of slots per
+ * segment the items span instead, so items from concurrent producers may
+ * only be interleaved with them at segment boundaries, or where a dequeuer
+ * gave up on a slot.
+ *
+ * Side effects: None.
+ */
+void
+lf_queue_enqueue_many(LfQueue  *queue,
+                      gpointer *items,
+                      guint     n_items)
+{
+	LfNode *first, *last, *node;
+	guint i;
+
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(items != NULL || n_items == 0);
+
+	for (i = 0; i < n_items; i++)
+		g_return_if_fail(items[i] != NULL);
+
+	if (n_items == 0)
+		return;
+
+	if (queue->engine == LF_QUEUE_ENGINE_SEGMENT) {
+		lf_queue_segment_enqueue_many(queue, items, n_items);
+		lf_queue_signal(queue, n_items);
+		return;
 	}
 
-	/*
-	 * Attempt to update the tail to point at our new node.  If this fails
-	 * it is because another thread has beaten us.  Not to worry, readers
-	 * and future writers can move the queue into a consistent state.
-	 */
-	g_atomic_pointer_compare_and_exchange((gpointer *)&queue->tail, tail, node);
+	first = last = lf_node_new();
+	first->data = items[0];
+	for (i = 1; i < n_items; i++) {
+		node = lf_node_new();
+		node->data = items[i];
+		last->next = node;
+		last = node;
+	}
+	last->next = NULL;
+
+	lf_queue_append(queue, first, last, n_items);
+	lf_queue_signal(queue, n_items);
 }
 
 /**
@@ -218,46 +1045,551 @@ lf_queue_enqueue(LfQueue       *queue,
 gpointer
 lf_queue_dequeue(LfQueue *queue)
 {
+	LfQueueGuard guard;
 	LfNode *head, *tail, *next;
 	gpointer data;
-	LF_HAZARD_INIT;
 
 	g_return_val_if_fail(queue != NULL, NULL);
 
+	if (queue->engine == LF_QUEUE_ENGINE_SEGMENT)
+		return lf_queue_segment_dequeue_many(queue, &data, 1) ? data : NULL;
+
+	lf_queue_guard_enter(queue, &guard);
+
 	/*
 	 * Attempt to retrieve an LfNode off the linked-list until we succeed.
 	 * If the queue is in an inconsistent state we will attempt to clean
 	 * up after the last operation before retreiving our item.
 	 */
 	while (TRUE) {
-		head = queue->head;      /* Retrieve the current head of queue */
-		LF_HAZARD_SET(0, head);  /* Notify threads that head is a hazard */
-		if (queue->head != head) /* Ensure head is still the queues head */
+		                         /* Retrieve the current head of queue */
+		head = lf_atomic_load(&queue->head, memory_order_acquire);
+		LF_GUARD_SET(0, head);   /* Notify threads that head is a hazard */
+		                         /* Ensure head is still the queues head */
+		if (lf_atomic_load(&queue->head, memory_order_seq_cst) != head)
 			continue;
-		tail = queue->tail;      /* Retreive the current tail of queue */
-		next = head->next;       /* Retreive heads next (to become new head) */
-		LF_HAZARD_SET(1, next);  /* Notify threads next is a hazard */ 
-		if (queue->head != head) /* Ensure head is still the queues head */
+		                         /* Retreive the current tail of queue */
+		tail = lf_atomic_load(&queue->tail, memory_order_acquire);
+		                         /* Retreive heads next (to become new head) */
+		next = lf_atomic_load(&head->next, memory_order_acquire);
+		LF_GUARD_SET(1, next);   /* Notify threads next is a hazard */
+		                         /* Ensure head is still the queues head */
+		if (lf_atomic_load(&queue->head, memory_order_seq_cst) != head)
 			continue;
-		if (next == NULL)        /* If there is no next, queue is empty */
+		if (next == NULL) {      /* If there is no next, queue is empty */
+			LF_QUEUE_STAT(queue, &guard, empty_dequeues, 1);
+			lf_queue_guard_leave(&guard);
 			return NULL;
+		}
 		if (head == tail) {      /* Inconsistent state, help thread along */
-			g_atomic_pointer_compare_and_exchange((gpointer *)&queue->tail,
-			                                      tail, next);
+			lf_atomic_pointer_cas(&queue->tail, tail, next,
+			                      memory_order_seq_cst);
+			LF_QUEUE_STAT(queue, &guard, tail_helps, 1);
 			continue;
 		}
 		data = next->data;       /* Retrieve data for the removing node */
 		                         /* Take the head of the queue */
-		if (g_atomic_pointer_compare_and_exchange((gpointer *)&queue->head,
-		                                          head, next))
+		if (lf_atomic_pointer_cas(&queue->head, head, next,
+		                          memory_order_seq_cst))
 			break;
+		LF_QUEUE_STAT(queue, &guard, cas_failures, 1);
 	}
+	LF_QUEUE_STAT(queue, &guard, dequeued, 1);
+	lf_queue_count(queue, &guard, -1);
 
 	/*
 	 * head is no longer a hazard.  Potentially do a reclaimation of
 	 * memory no longer hazardous.
 	 */
-	LF_HAZARD_UNSET(head);
+	lf_queue_guard_retire(&guard, head, (GDestroyNotify)lf_node_free);
+	lf_queue_guard_leave(&guard);
 
 	return data;
 }
+
+/**
+ * lf_queue_dequeue_many:
+ * @queue: A #LfQueue
+ * @items: A location for up to @max_items pointers.
+ * @max_items: The maximum number of items to dequeue.
+ *
+ * Dequeues up to @max_items items from the queue into @items in the order
+ * they were enqueued.  With the list engine all of the items are claimed by
+ * advancing the head of the queue with a single CAS, so contention on the
+ * head of the queue is paid once per call rather than once per item.  The
+ * segment engine claims them with one fetch-and-add per segment instead.
+ *
+ * Returns: The number of items stored in @items, 0 if the queue is empty.
+ *
+ * Side effects: Hazard pointer reclaimation can occur meaning that structures
+ *   no longer in use may be freed by the system.
+ */
+guint
+lf_queue_dequeue_many(LfQueue  *queue,
+                      gpointer *items,
+                      guint     max_items)
+{
+	LfQueueGuard guard;
+	LfNode *head, *tail, *next, *node;
+	gboolean valid;
+	guint n_items;
+
+	g_return_val_if_fail(queue != NULL, 0);
+	g_return_val_if_fail(items != NULL || max_items == 0, 0);
+
+	if (max_items == 0)
+		return 0;
+
+	if (queue->engine == LF_QUEUE_ENGINE_SEGMENT)
+		return lf_queue_segment_dequeue_many(queue, items, max_items);
+
+	lf_queue_guard_enter(queue, &guard);
+
+	while (TRUE) {
+		                         /* Retrieve the current head of queue */
+		head = lf_atomic_load(&queue->head, memory_order_acquire);
+		LF_GUARD_SET(0, head);   /* Notify threads that head is a hazard */
+		                         /* Ensure head is still the queues head */
+		if (lf_atomic_load(&queue->head, memory_order_seq_cst) != head)
+			continue;
+		                         /* Retreive the current tail of queue */
+		tail = lf_atomic_load(&queue->tail, memory_order_acquire);
+		                         /* Retreive heads next (to become new head) */
+		next = lf_atomic_load(&head->next, memory_order_acquire);
+		LF_GUARD_SET(1, next);   /* Notify threads next is a hazard */
+		                         /* Ensure head is still the queues head */
+		if (lf_atomic_load(&queue->head, memory_order_seq_cst) != head)
+			continue;
+		if (next == NULL) {      /* If there is no next, queue is empty */
+			LF_QUEUE_STAT(queue, &guard, empty_dequeues, 1);
+			lf_queue_guard_leave(&guard);
+			return 0;
+		}
+		if (head == tail) {      /* Inconsistent state, help thread along */
+			lf_atomic_pointer_cas(&queue->tail, tail, next,
+			                      memory_order_seq_cst);
+			LF_QUEUE_STAT(queue, &guard, tail_helps, 1);
+			continue;
+		}
+
+		/*
+		 * Walk forward collecting items.  No node after head can be retired
+		 * while head is still the head of the queue, so each node is safe to
+		 * read once it is marked as a hazard and head is verified again.  We
+		 * never walk past the tail we observed so head cannot overtake it.
+		 */
+		node = next;
+		items[0] = node->data;
+		valid = TRUE;
+		for (n_items = 1; n_items < max_items && node != tail; n_items++) {
+			if (!(next = lf_atomic_load(&node->next, memory_order_acquire)))
+				break;
+			LF_GUARD_SET(1, next);
+			if (lf_atomic_load(&queue->head, memory_order_seq_cst) != head) {
+				valid = FALSE;
+				break;
+			}
+			items[n_items] = next->data;
+			node = next;
+		}
+		if (!valid)
+			continue;
+		                         /* Take all of the nodes at once */
+		if (lf_atomic_pointer_cas(&queue->head, head, node,
+		                          memory_order_seq_cst))
+			break;
+		LF_QUEUE_STAT(queue, &guard, cas_failures, 1);
+	}
+	LF_QUEUE_STAT(queue, &guard, dequeued, n_items);
+	lf_queue_count(queue, &guard, -(gssize)n_items);
+
+	/*
+	 * The old head and every node we claimed except the last, which is the
+	 * new head, are no longer reachable.  Retire them together so we check
+	 * whether a reclaimation is due only once.
+	 */
+	while (head != node) {
+		next = head->next;
+		lf_queue_guard_retire(&guard, head, (GDestroyNotify)lf_node_free);
+		head = next;
+	}
+	lf_queue_guard_leave(&guard);
+
+	return n_items;
+}
+
+/**
+ * lf_queue_dequeue_wait:
+ * @queue: A #LfQueue
+ * @timeout_us: The maximum time to wait in microseconds, or -1 to wait
+ *   forever.
+ *
+ * Dequeues an item from the queue, waiting up to @timeout_us microseconds
+ * for one to arrive if the queue is empty.  The queue is polled briefly
+ * before the calling thread goes to sleep, so items that arrive quickly are
+ * picked up without a system call.
+ *
+ * Returns: An item from the queue or %NULL if @timeout_us elapsed.
+ *
+ * Side effects: Hazard pointer reclaimation can occur meaning that structures
+ *   no longer in use may be freed by the system.
+ */
+gpointer
+lf_queue_dequeue_wait(LfQueue *queue,
+                      gint64   timeout_us)
+{
+	gint64 deadline = 0, remaining;
+	gpointer data;
+	gint seq, i;
+
+	g_return_val_if_fail(queue != NULL, NULL);
+
+	for (i = 0; i < LF_QUEUE_SPIN_COUNT; i++) {
+		if ((data = lf_queue_dequeue(queue)) || timeout_us == 0)
+			return data;
+	}
+
+	if (timeout_us > 0)
+		deadline = g_get_monotonic_time() + timeout_us;
+
+	while (TRUE) {
+		/*
+		 * Register as a waiter before the final check of the queue.  An
+		 * enqueue that lands after the check bumps wake_seq, which stops
+		 * the futex from sleeping on a stale value.  The fence keeps the
+		 * check from being reordered before the registration; it pairs
+		 * with the seq_cst read in lf_queue_signal().
+		 */
+		seq = lf_atomic_load(&queue->wake_seq, memory_order_acquire);
+		lf_atomic_int_add(&queue->waiters, 1, memory_order_seq_cst);
+		lf_atomic_fence(memory_order_seq_cst);
+		if (!(data = lf_queue_dequeue(queue))) {
+			if (timeout_us < 0)
+				lf_futex_wait(&queue->wake_seq, seq, -1);
+			else if ((remaining = deadline - g_get_monotonic_time()) > 0)
+				lf_futex_wait(&queue->wake_seq, seq, remaining);
+		}
+		lf_atomic_int_add(&queue->waiters, -1, memory_order_relaxed);
+
+		if (data)
+			return data;
+		if (timeout_us > 0 && g_get_monotonic_time() >= deadline)
+			return lf_queue_dequeue(queue);
+	}
+}
+
+/**
+ * lf_queue_get_stats:
+ * @queue: A #LfQueue
+ * @stats: A location for the statistics.
+ *
+ * Fills @stats with the counters of @queue summed over all threads.  The
+ * counters are sharded per thread and only added together here, so keeping
+ * them costs the enqueue and dequeue paths very little.  Concurrent updates
+ * may or may not be reflected in the result.
+ *
+ * Statistics are only kept when the library is built with LF_ENABLE_STATS
+ * defined.  Otherwise @stats is zeroed.
+ *
+ * Returns: %TRUE if statistics are available.
+ * Side effects: None.
+ */
+gboolean
+lf_queue_get_stats(LfQueue      *queue,
+                   LfQueueStats *stats)
+{
+#ifdef LF_ENABLE_STATS
+	LfQueueCounter *counter;
+	gint i;
+#endif
+
+	g_return_val_if_fail(queue != NULL, FALSE);
+	g_return_val_if_fail(stats != NULL, FALSE);
+
+	memset(stats, 0, sizeof(LfQueueStats));
+
+#ifdef LF_ENABLE_STATS
+	for (i = 0; i < LF_QUEUE_COUNTER_SHARDS; i++) {
+		counter = &queue->counters[i];
+		stats->enqueued += lf_atomic_load(&counter->c.enqueued,
+		                                  memory_order_relaxed);
+		stats->dequeued += lf_atomic_load(&counter->c.dequeued,
+		                                  memory_order_relaxed);
+		stats->empty_dequeues +=
+			lf_atomic_load(&counter->c.empty_dequeues,
+			               memory_order_relaxed);
+		stats->cas_failures += lf_atomic_load(&counter->c.cas_failures,
+		                                      memory_order_relaxed);
+		stats->tail_helps += lf_atomic_load(&counter->c.tail_helps,
+		                                    memory_order_relaxed);
+	}
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+/**
+ * lf_queue_get_length_approx:
+ * @queue: A #LfQueue
+ *
+ * Retrieves the number of items in @queue.  Each thread counts its
+ * operations into a shard of its own, which is only now added up, so keeping
+ * the length costs the enqueue and dequeue paths very little.  With
+ * concurrent updates the result is only a snapshot, and an item may be
+ * counted out by its dequeuer before its enqueuer has counted it in.
+ *
+ * Returns: The approximate number of items in @queue.
+ * Side effects: None.
+ */
+guint
+lf_queue_get_length_approx(LfQueue *queue)
+{
+	gssize length;
+	gint i;
+
+	g_return_val_if_fail(queue != NULL, 0);
+
+	length = lf_atomic_load(&queue->length, memory_order_relaxed);
+	for (i = 0; i < LF_QUEUE_COUNTER_SHARDS; i++)
+		length += lf_atomic_load(&queue->counters[i].c.length,
+		                         memory_order_relaxed);
+
+	return CLAMP(length, 0, G_MAXUINT);
+}
+
+/**
+ * lf_queue_set_watermarks:
+ * @queue: A #LfQueue
+ * @low_watermark: The length at or below which @func reports the queue has
+ *   drained.
+ * @high_watermark: The length at or above which @func reports the queue is
+ *   filling up.  Must be greater than @low_watermark.
+ * @func: The #LfQueueWatermarkFunc to call, or %NULL to remove it.
+ * @user_data: The data to pass to @func.
+ *
+ * Registers a callback for upstream stages to throttle on before the queue
+ * grows without bound.  @func is called with @above %TRUE once the length
+ * reaches @high_watermark, and with %FALSE once it then falls back to
+ * @low_watermark, so the calls always alternate.
+ *
+ * @func runs in whichever thread's enqueue or dequeue moved the length
+ * across, at most one at a time, and should return quickly.  The length it
+ * sees lags the true one by up to a quarter of the gap between the
+ * watermarks.  Set the watermarks before the queue is shared between
+ * threads.
+ *
+ * Side effects: None.
+ */
+void
+lf_queue_set_watermarks(LfQueue              *queue,
+                        guint                 low_watermark,
+                        guint                 high_watermark,
+                        LfQueueWatermarkFunc  func,
+                        gpointer              user_data)
+{
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(low_watermark < high_watermark || func == NULL);
+
+	queue->low_watermark = low_watermark;
+	queue->high_watermark = high_watermark;
+	queue->watermark_func = func;
+	queue->watermark_data = user_data;
+	queue->above = FALSE;
+	lf_queue_update_length_batch(queue);
+}
+
+/**
+ * lf_queue_get_hazard_stats:
+ * @stats: A location for the statistics.
+ *
+ * Fills @stats with the counters of the hazard pointer domain shared by all
+ * #LfQueue<!-- -->s.  See lf_hazard_domain_get_stats().
+ *
+ * Statistics are only kept when the library is built with LF_ENABLE_STATS
+ * defined.  Otherwise @stats is zeroed.
+ *
+ * Returns: %TRUE if statistics are available.
+ * Side effects: None.
+ */
+gboolean
+lf_queue_get_hazard_stats(LfHazardStats *stats)
+{
+	g_return_val_if_fail(stats != NULL, FALSE);
+
+	return lf_hazard_domain_get_stats(lf_hazard_domain_get_default(), stats);
+}
+
+typedef struct _LfQueueSource LfQueueSource;
+
+/*
+ * A source dispatching the items of a queue.  more is set while the last
+ * dispatch stopped at max_batch items, in which case the source stays ready
+ * without waiting for event_fd.
+ */
+struct _LfQueueSource {
+	GSource   source;
+	LfQueue  *queue;
+	GPollFD   pollfd;
+	gboolean  more;
+	guint     max_batch;
+	gpointer *items;
+};
+
+static gboolean
+lf_queue_source_prepare(GSource *source,
+                        gint    *timeout_)
+{
+	LfQueueSource *qsource = (LfQueueSource *)source;
+
+#ifdef __linux__
+	*timeout_ = -1;
+#else
+	*timeout_ = 1;
+#endif
+
+	return qsource->more;
+}
+
+static gboolean
+lf_queue_source_check(GSource *source)
+{
+	LfQueueSource *qsource = (LfQueueSource *)source;
+
+#ifdef __linux__
+	return qsource->more || (qsource->pollfd.revents & G_IO_IN);
+#else
+	return TRUE;
+#endif
+}
+
+static gboolean
+lf_queue_source_dispatch(GSource     *source,
+                         GSourceFunc  callback,
+                         gpointer     user_data)
+{
+	LfQueueSource *qsource = (LfQueueSource *)source;
+	LfQueue *queue = qsource->queue;
+	guint n_items;
+#ifdef __linux__
+	guint64 count;
+
+	if (qsource->pollfd.revents & G_IO_IN) {
+		if (read(qsource->pollfd.fd, &count, sizeof(count)) < 0) {
+			/*
+			 * Another source on the queue already reset it.
+			 */
+		}
+	}
+#endif
+
+	if (!callback) {
+		g_warning("LfQueue source dispatched without callback. "
+		          "You must call g_source_set_callback().");
+		return FALSE;
+	}
+
+	/*
+	 * Should the queue look empty, arm it before looking once more.  An
+	 * enqueue that we miss then sees it armed and signals event_fd.
+	 */
+	n_items = lf_queue_dequeue_many(queue, qsource->items, qsource->max_batch);
+	if (n_items < qsource->max_batch) {
+		lf_atomic_store(&queue->armed, TRUE, memory_order_seq_cst);
+		lf_atomic_fence(memory_order_seq_cst);
+		n_items += lf_queue_dequeue_many(queue, qsource->items + n_items,
+		                                 qsource->max_batch - n_items);
+	}
+	qsource->more = (n_items == qsource->max_batch);
+	if (qsource->more)
+		lf_atomic_store(&queue->armed, FALSE, memory_order_relaxed);
+
+	if (n_items == 0)
+		return TRUE;
+
+	return ((LfQueueSourceFunc)callback)(qsource->items, n_items, user_data);
+}
+
+static void
+lf_queue_source_finalize(GSource *source)
+{
+	LfQueueSource *qsource = (LfQueueSource *)source;
+
+	g_free(qsource->items);
+	lf_queue_unref(qsource->queue);
+}
+
+static GSourceFuncs lf_queue_source_funcs = {
+	lf_queue_source_prepare,
+	lf_queue_source_check,
+	lf_queue_source_dispatch,
+	lf_queue_source_finalize
+};
+
+/**
+ * lf_queue_create_source:
+ * @queue: A #LfQueue
+ * @max_batch: The maximum number of items to dispatch at once, or 0 for
+ *   %LF_QUEUE_SOURCE_BATCH.
+ *
+ * Creates a #GSource that dispatches the items of @queue to a
+ * #LfQueueSourceFunc as they arrive, so a #GMainContext can consume the
+ * queue without polling it on a timer.  Set the callback with
+ * g_source_set_callback(), casting it to a #GSourceFunc, and attach the
+ * source with g_source_attach().
+ *
+ * The source waits on an eventfd which is only signalled by the enqueue that
+ * finds the queue drained by the source, so a busy queue costs producers a
+ * single read per enqueue and no system calls.  Each dispatch dequeues up to
+ * @max_batch items; anything left over is dispatched in the next iteration
+ * of the main loop, giving other sources a turn in between.
+ *
+ * Platforms without eventfd fall back to checking the queue every
+ * millisecond.
+ *
+ * Returns: The newly created #GSource, holding a reference to @queue.
+ * Side effects: Creates the queue's eventfd if it has none yet.
+ */
+GSource*
+lf_queue_create_source(LfQueue *queue,
+                       guint    max_batch)
+{
+	LfQueueSource *qsource;
+	GSource *source;
+	gint fd = -1;
+
+	g_return_val_if_fail(queue != NULL, NULL);
+
+#ifdef __linux__
+	if ((fd = lf_atomic_load(&queue->event_fd, memory_order_acquire)) < 0) {
+		fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0)
+			g_error("Failed to create eventfd: %s", g_strerror(errno));
+		if (!lf_atomic_int_cas(&queue->event_fd, -1, fd,
+		                       memory_order_acq_rel)) {
+			close(fd);
+			fd = lf_atomic_load(&queue->event_fd, memory_order_acquire);
+		}
+	}
+#endif
+
+	source = g_source_new(&lf_queue_source_funcs, sizeof(LfQueueSource));
+	qsource = (LfQueueSource *)source;
+	qsource->queue = lf_queue_ref(queue);
+	qsource->max_batch = max_batch ? max_batch : LF_QUEUE_SOURCE_BATCH;
+	qsource->items = g_new(gpointer, qsource->max_batch);
+
+	/*
+	 * The queue may already hold items, so start out ready.  The first
+	 * dispatch arms the queue once it is drained.
+	 */
+	qsource->more = TRUE;
+	qsource->pollfd.fd = fd;
+	qsource->pollfd.events = G_IO_IN;
+	qsource->pollfd.revents = 0;
+#ifdef __linux__
+	g_source_add_poll(source, &qsource->pollfd);
+#endif
+
+	return source;
+}
@@ -26,16 +26,89 @@
 
 #include <glib-object.h>
 
+#include "lf-stats.h"
+
 G_BEGIN_DECLS
 
 typedef struct _LfQueue LfQueue;
 
-GType    lf_queue_get_type (void) G_GNUC_CONST;
-LfQueue* lf_queue_new      (void);
-LfQueue* lf_queue_ref      (LfQueue *queue);
-void     lf_queue_unref    (LfQueue *queue);
-void     lf_queue_enqueue  (LfQueue *queue, gconstpointer data);
-gpointer lf_queue_dequeue  (LfQueue *queue);
+/**
+ * LfQueueReclaim:
+ * @LF_QUEUE_RECLAIM_HAZARD: Free dequeued nodes using hazard pointers.
+ * @LF_QUEUE_RECLAIM_EPOCH: Free dequeued nodes using epoch based
+ *   reclaimation.
+ *
+ * The scheme an #LfQueue uses to decide when dequeued nodes are no longer
+ * referenced by other threads and may be freed.
+ */
+typedef enum {
+	LF_QUEUE_RECLAIM_HAZARD,
+	LF_QUEUE_RECLAIM_EPOCH
+} LfQueueReclaim;
+
+/**
+ * LfQueueEngine:
+ * @LF_QUEUE_ENGINE_LIST: A Michael-Scott linked list with one node per item.
+ * @LF_QUEUE_ENGINE_SEGMENT: A linked list of array segments in which slots
+ *   are claimed with fetch-and-add.
+ *
+ * The algorithm behind an #LfQueue.  Both offer the same API and ordering.
+ */
+typedef enum {
+	LF_QUEUE_ENGINE_LIST,
+	LF_QUEUE_ENGINE_SEGMENT
+} LfQueueEngine;
+
+/**
+ * LfQueueSourceFunc:
+ * @items: The items dequeued, oldest first.
+ * @n_items: The number of items in @items, at least one.
+ * @user_data: The data passed to g_source_set_callback().
+ *
+ * The callback of a source created with lf_queue_create_source().  Pass it
+ * to g_source_set_callback() cast to a #GSourceFunc.  The items are owned by
+ * the callback; @items itself is only valid until it returns.
+ *
+ * Returns: %FALSE to remove the source.
+ */
+typedef gboolean (*LfQueueSourceFunc) (gpointer *items,
+                                       guint     n_items,
+                                       gpointer  user_data);
+
+/**
+ * LfQueueWatermarkFunc:
+ * @queue: The #LfQueue.
+ * @above: %TRUE when the length has reached the high watermark, %FALSE when
+ *   it has fallen back to the low watermark.
+ * @user_data: The data passed to lf_queue_set_watermarks().
+ *
+ * The callback registered with lf_queue_set_watermarks().
+ */
+typedef void (*LfQueueWatermarkFunc) (LfQueue  *queue,
+                                      gboolean  above,
+                                      gpointer  user_data);
+
+GType    lf_queue_get_type          (void) G_GNUC_CONST;
+LfQueue* lf_queue_new               (void);
+LfQueue* lf_queue_new_full          (LfQueueReclaim reclaim);
+LfQueue* lf_queue_new_with_engine   (LfQueueEngine engine, LfQueueReclaim reclaim);
+LfQueue* lf_queue_new_with_capacity (guint capacity);
+LfQueue* lf_queue_ref               (LfQueue *queue);
+void     lf_queue_unref             (LfQueue *queue);
+void     lf_queue_enqueue           (LfQueue *queue, gconstpointer data);
+gboolean lf_queue_try_enqueue       (LfQueue *queue, gconstpointer data);
+gpointer lf_queue_dequeue           (LfQueue *queue);
+void     lf_queue_enqueue_many      (LfQueue *queue, gpointer *items, guint n_items);
+guint    lf_queue_dequeue_many      (LfQueue *queue, gpointer *items, guint max_items);
+gpointer lf_queue_dequeue_wait      (LfQueue *queue, gint64 timeout_us);
+gboolean lf_queue_get_stats         (LfQueue *queue, LfQueueStats *stats);
+gboolean lf_queue_get_hazard_stats  (LfHazardStats *stats);
+guint    lf_queue_get_length_approx (LfQueue *queue);
+void     lf_queue_set_watermarks    (LfQueue *queue, guint low_watermark,
+                                     guint high_watermark,
+                                     LfQueueWatermarkFunc func,
+                                     gpointer user_data);
+GSource* lf_queue_create_source     (LfQueue *queue, guint max_batch);
 
 G_END_DECLS
 
@@ -0,0 +1,285 @@
+/* lf-ring.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "lf-atomic.h"
+#include "lf-ring.h"
+
+/**
+ * @LF_CACHE_LINE: The assumed size of a cache line in bytes.  The producer
+ *                 and consumer cursors each get a line of their own so they
+ *                 do not falsely share.
+ */
+#define LF_CACHE_LINE (64)
+
+typedef struct _LfRingSlot LfRingSlot;
+
+/*
+ * Each slot carries a sequence number describing its state relative to the
+ * cursors.  A slot at position pos is free for a producer when its sequence
+ * is pos and holds an item for a consumer when its sequence is pos + 1.  The
+ * consumer releases it for the next lap by setting it to pos + capacity.
+ */
+struct _LfRingSlot {
+	volatile gint  sequence;
+	gpointer       data;
+};
+
+struct _LfRing {
+	LfRingSlot    *slots;
+	guint          mask;
+	volatile gint  ref_count;
+	gchar          pad0[LF_CACHE_LINE - sizeof(gpointer) - 2 * sizeof(gint)];
+	volatile gint  enqueue_pos;
+	gchar          pad1[LF_CACHE_LINE - sizeof(gint)];
+	volatile gint  dequeue_pos;
+	gchar          pad2[LF_CACHE_LINE - sizeof(gint)];
+};
+
+static gpointer
+lf_ring_aligned_alloc(gsize size)
+{
+	gpointer mem;
+
+	if (posix_memalign(&mem, LF_CACHE_LINE, size) != 0)
+		g_error("Failed to allocate %" G_GSIZE_FORMAT " bytes", size);
+
+	return mem;
+}
+
+/**
+ * lf_ring_new:
+ * @capacity: The number of items the ring can hold.
+ *
+ * Creates a new instance of #LfRing, a bounded multi-producer multi-consumer
+ * FIFO.  @capacity is rounded up to the next power of two.  All of the memory
+ * used by the ring is allocated up front, so neither lf_ring_enqueue() nor
+ * lf_ring_dequeue() ever allocate.  The #LfRing structure is reference
+ * counted and should be freed using lf_ring_unref().
+ *
+ * Returns: The newly created #LfRing.
+ * Side effects: None.
+ */
+LfRing*
+lf_ring_new(guint capacity)
+{
+	LfRing *ring;
+	guint size, i;
+
+	g_return_val_if_fail(capacity > 0, NULL);
+	g_return_val_if_fail(capacity <= (G_MAXINT / 2), NULL);
+
+	for (size = 2; size < capacity; size <<= 1);
+
+	ring = lf_ring_aligned_alloc(sizeof(LfRing));
+	ring->slots = lf_ring_aligned_alloc(sizeof(LfRingSlot) * size);
+	ring->mask = size - 1;
+	ring->ref_count = 1;
+	ring->enqueue_pos = 0;
+	ring->dequeue_pos = 0;
+
+	for (i = 0; i < size; i++) {
+		ring->slots[i].sequence = i;
+		ring->slots[i].data = NULL;
+	}
+
+	return ring;
+}
+
+/**
+ * lf_ring_ref:
+ * @ring: A #LfRing
+ *
+ * Atomically increments the reference count of @ring by one.
+ *
+ * Returns: A reference to @ring.
+ * Side effects: None.
+ */
+LfRing*
+lf_ring_ref(LfRing *ring)
+{
+	g_return_val_if_fail(ring != NULL, NULL);
+	g_return_val_if_fail(ring->ref_count > 0, NULL);
+
+	g_atomic_int_inc(&ring->ref_count);
+	return ring;
+}
+
+/**
+ * lf_ring_unref:
+ * @ring: A #LfRing
+ *
+ * Decrements the reference count of @ring by one.  When the reference count
+ * reaches zero, the structures allocations are released and the ring is
+ * freed.  Items still in the ring are not freed.
+ */
+void
+lf_ring_unref(LfRing *ring)
+{
+	g_return_if_fail(ring != NULL);
+	g_return_if_fail(ring->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&ring->ref_count)) {
+		free(ring->slots);
+		free(ring);
+	}
+}
+
+/**
+ * lf_ring_get_type:
+ *
+ * Retrieves the GObject type system's type identifier for #LfRing.
+ *
+ * Returns: A #GType containing the type id.
+ * Side effects: Registers the #LfRing type if not already.
+ */
+GType
+lf_ring_get_type(void)
+{
+	static GType type_id = 0;
+	GType tmp_id;
+
+	if (g_once_init_enter((gsize *)&type_id)) {
+		tmp_id = g_boxed_type_register_static("LfRing",
+		                                      (GBoxedCopyFunc)lf_ring_ref,
+		                                      (GBoxedFreeFunc)lf_ring_unref);
+		g_once_init_leave((gsize *)&type_id, tmp_id);
+	}
+
+	return type_id;
+}
+
+/**
+ * lf_ring_get_capacity:
+ * @ring: A #LfRing
+ *
+ * Retrieves the number of items @ring can hold, which is the capacity given
+ * to lf_ring_new() rounded up to the next power of two.
+ *
+ * Returns: The capacity of @ring.
+ * Side effects: None.
+ */
+guint
+lf_ring_get_capacity(LfRing *ring)
+{
+	g_return_val_if_fail(ring != NULL, 0);
+
+	return ring->mask + 1;
+}
+
+/**
+ * lf_ring_enqueue:
+ * @ring: A #LfRing.
+ * @data: a non-NULL pointer.
+ *
+ * Attempts to enqueue an item into the #LfRing.  The pointer must be
+ * non-%NULL.  If the ring is full this fails immediately rather than
+ * waiting for a consumer.
+ *
+ * Returns: %TRUE if @data was enqueued, %FALSE if the ring was full.
+ * Side effects: None.
+ */
+gboolean
+lf_ring_enqueue(LfRing        *ring,
+                gconstpointer  data)
+{
+	LfRingSlot *slot;
+	guint pos;
+	gint diff;
+
+	g_return_val_if_fail(ring != NULL, FALSE);
+	g_return_val_if_fail(data != NULL, FALSE);
+
+	/*
+	 * Claim the slot at the producer cursor.  Positions are compared as the
+	 * signed difference of unsigned values so they may safely wrap.
+	 */
+	pos = lf_atomic_load(&ring->enqueue_pos, memory_order_relaxed);
+	while (TRUE) {
+		slot = &ring->slots[pos & ring->mask];
+		diff = (gint)((guint)lf_atomic_load(&slot->sequence,
+		                                    memory_order_acquire) - pos);
+		if (diff == 0) {             /* Slot is free, try to claim it */
+			if (lf_atomic_int_cas(&ring->enqueue_pos, pos, pos + 1,
+			                      memory_order_relaxed))
+				break;
+		} else if (diff < 0) {       /* Slot still full from last lap */
+			return FALSE;
+		}
+		pos = lf_atomic_load(&ring->enqueue_pos, memory_order_relaxed);
+	}
+
+	/*
+	 * The slot is ours.  Publishing the new sequence hands it to consumers.
+	 */
+	slot->data = (gpointer)data;
+	lf_atomic_store(&slot->sequence, pos + 1, memory_order_release);
+
+	return TRUE;
+}
+
+/**
+ * lf_ring_dequeue:
+ * @ring: A #LfRing
+ *
+ * Dequeues an item from the ring.  If the ring is empty, %NULL is returned.
+ *
+ * Returns: An item from the ring or %NULL.
+ * Side effects: None.
+ */
+gpointer
+lf_ring_dequeue(LfRing *ring)
+{
+	LfRingSlot *slot;
+	gpointer data;
+	guint pos;
+	gint diff;
+
+	g_return_val_if_fail(ring != NULL, NULL);
+
+	pos = lf_atomic_load(&ring->dequeue_pos, memory_order_relaxed);
+	while (TRUE) {
+		slot = &ring->slots[pos & ring->mask];
+		diff = (gint)((guint)lf_atomic_load(&slot->sequence,
+		                                    memory_order_acquire) -
+		              (pos + 1));
+		if (diff == 0) {             /* Slot is full, try to claim it */
+			if (lf_atomic_int_cas(&ring->dequeue_pos, pos, pos + 1,
+			                      memory_order_relaxed))
+				break;
+		} else if (diff < 0) {       /* Slot not yet filled, ring empty */
+			return NULL;
+		}
+		pos = lf_atomic_load(&ring->dequeue_pos, memory_order_relaxed);
+	}
+
+	/*
+	 * Take the item and release the slot for the producers' next lap.
+	 */
+	data = slot->data;
+	lf_atomic_store(&slot->sequence, pos + ring->mask + 1,
+	                memory_order_release);
+
+	return data;
+}
@@ -0,0 +1,305 @@
+/* lf-sharded-queue.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/sysinfo.h>
+#else
+#ifdef __APPLE__
+#include <sys/param.h>
+#include <sys/sysctl.h>
+#endif /* __APPLE__ */
+#endif /* __linux__ */
+
+#include "lf-queue.h"
+#include "lf-sharded-queue.h"
+
+/*
+ * A relaxed FIFO made of independent LfQueue lanes.  Producers on different
+ * CPUs, or different threads with %LF_SHARDED_QUEUE_LANE_ORDER, append to
+ * different lanes and so never contend on the same tail.  Consumers look in
+ * their own lane first and then sweep the others in turn.
+ */
+struct _LfShardedQueue {
+	LfQueue             **lanes;
+	guint                 n_lanes;
+	LfShardedQueueFlags   flags;
+	volatile gint         ref_count;
+};
+
+static GStaticPrivate lf_sharded_queue_thread = G_STATIC_PRIVATE_INIT;
+static volatile gint  lf_sharded_queue_n_threads = 0;
+
+static guint
+lf_sharded_queue_get_num_cpu(void)
+{
+#ifdef __linux__
+	return MAX(get_nprocs(), 1);
+#elif defined(__APPLE__)
+	gint i = 0;
+	size_t s = sizeof(i);
+	if (sysctlbyname("hw.ncpu", &i, &s, NULL, 0))
+		return 1;
+	return MAX(i, 1);
+#else
+	return 1;
+#endif
+}
+
+/*
+ * Retrieves a small number unique to the calling thread, handed out in the
+ * order threads first ask for one.
+ */
+static guint
+lf_sharded_queue_thread_index(void)
+{
+	gint index;
+
+	index = GPOINTER_TO_INT(g_static_private_get(&lf_sharded_queue_thread));
+	if (G_UNLIKELY(!index)) {
+		index = g_atomic_int_exchange_and_add(&lf_sharded_queue_n_threads,
+		                                      1) + 1;
+		g_static_private_set(&lf_sharded_queue_thread,
+		                     GINT_TO_POINTER(index), NULL);
+	}
+
+	return index - 1;
+}
+
+/*
+ * Picks the calling thread's lane.  Without %LF_SHARDED_QUEUE_LANE_ORDER
+ * that is the lane of the CPU it is running on, so threads sharing a CPU
+ * share a lane that is likely already in that CPU's cache.  Where the CPU
+ * cannot be queried the thread's own lane is used instead.
+ */
+static inline LfQueue**
+lf_sharded_queue_lane(LfShardedQueue *queue)
+{
+#ifdef __linux__
+	gint cpu;
+
+	if (!(queue->flags & LF_SHARDED_QUEUE_LANE_ORDER) &&
+	    (cpu = sched_getcpu()) >= 0)
+		return &queue->lanes[cpu % queue->n_lanes];
+#endif
+
+	return &queue->lanes[lf_sharded_queue_thread_index() % queue->n_lanes];
+}
+
+/**
+ * lf_sharded_queue_new:
+ * @n_lanes: The number of lanes, or 0 for one per CPU.
+ * @flags: #LfShardedQueueFlags
+ *
+ * Creates a new instance of #LfShardedQueue, a queue split into @n_lanes
+ * independent lanes so that producers on different CPUs do not contend with
+ * each other.  There is no global FIFO order; an item may be dequeued
+ * before items enqueued earlier into other lanes.  With
+ * %LF_SHARDED_QUEUE_LANE_ORDER the items of any one producer thread are
+ * still dequeued in order.  The #LfShardedQueue structure is reference
+ * counted and should be freed using lf_sharded_queue_unref().
+ *
+ * Returns: The newly created #LfShardedQueue.
+ * Side effects: None.
+ */
+LfShardedQueue*
+lf_sharded_queue_new(guint               n_lanes,
+                     LfShardedQueueFlags flags)
+{
+	LfShardedQueue *queue;
+	guint i;
+
+	if (!n_lanes)
+		n_lanes = lf_sharded_queue_get_num_cpu();
+
+	queue = g_slice_new(LfShardedQueue);
+	queue->lanes = g_new(LfQueue*, n_lanes);
+	queue->n_lanes = n_lanes;
+	queue->flags = flags;
+	queue->ref_count = 1;
+	for (i = 0; i < n_lanes; i++)
+		queue->lanes[i] = lf_queue_new();
+
+	return queue;
+}
+
+/**
+ * lf_sharded_queue_ref:
+ * @queue: A #LfShardedQueue
+ *
+ * Atomically increments the reference count of @queue by one.
+ *
+ * Returns: A reference to @queue.
+ * Side effects: None.
+ */
+LfShardedQueue*
+lf_sharded_queue_ref(LfShardedQueue *queue)
+{
+	g_return_val_if_fail(queue != NULL, NULL);
+	g_return_val_if_fail(queue->ref_count > 0, NULL);
+
+	g_atomic_int_inc(&queue->ref_count);
+	return queue;
+}
+
+/**
+ * lf_sharded_queue_unref:
+ * @queue: A #LfShardedQueue
+ *
+ * Decrements the reference count of @queue by one.  When the reference count
+ * reaches zero, the lanes are released and the queue is freed.
+ */
+void
+lf_sharded_queue_unref(LfShardedQueue *queue)
+{
+	guint i;
+
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(queue->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&queue->ref_count)) {
+		for (i = 0; i < queue->n_lanes; i++)
+			lf_queue_unref(queue->lanes[i]);
+		g_free(queue->lanes);
+		g_slice_free(LfShardedQueue, queue);
+	}
+}
+
+/**
+ * lf_sharded_queue_get_type:
+ *
+ * Retrieves the GObject type system's type identifier for #LfShardedQueue.
+ *
+ * Returns: A #GType containing the type id.
+ * Side effects: Registers the #LfShardedQueue type if not already.
+ */
+GType
+lf_sharded_queue_get_type(void)
+{
+	static GType type_id = 0;
+	GType tmp_id;
+
+	if (g_once_init_enter((gsize *)&type_id)) {
+		tmp_id = g_boxed_type_register_static("LfShardedQueue",
+		                                      (GBoxedCopyFunc)lf_sharded_queue_ref,
+		                                      (GBoxedFreeFunc)lf_sharded_queue_unref);
+		g_once_init_leave((gsize *)&type_id, tmp_id);
+	}
+
+	return type_id;
+}
+
+/**
+ * lf_sharded_queue_enqueue:
+ * @queue: A #LfShardedQueue
+ * @data: a non-%NULL pointer.
+ *
+ * Enqueues an item into the calling thread's lane of @queue.
+ *
+ * Side effects: None.
+ */
+void
+lf_sharded_queue_enqueue(LfShardedQueue *queue,
+                         gconstpointer   data)
+{
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(data != NULL);
+
+	lf_queue_enqueue(*lf_sharded_queue_lane(queue), data);
+}
+
+/**
+ * lf_sharded_queue_dequeue:
+ * @queue: A #LfShardedQueue
+ *
+ * Dequeues an item from @queue, trying the calling thread's own lane first
+ * and then every other lane in turn.
+ *
+ * Returns: An item from the queue or %NULL if every lane was empty.
+ *
+ * Side effects: Hazard pointer reclaimation can occur meaning that structures
+ *   no longer in use may be freed by the system.
+ */
+gpointer
+lf_sharded_queue_dequeue(LfShardedQueue *queue)
+{
+	LfQueue **lane, **start, **end;
+	gpointer data;
+
+	g_return_val_if_fail(queue != NULL, NULL);
+
+	start = lane = lf_sharded_queue_lane(queue);
+	end = queue->lanes + queue->n_lanes;
+
+	do {
+		if ((data = lf_queue_dequeue(*lane)))
+			return data;
+		if (++lane == end)
+			lane = queue->lanes;
+	} while (lane != start);
+
+	return NULL;
+}
+
+/**
+ * lf_sharded_queue_get_n_lanes:
+ * @queue: A #LfShardedQueue
+ *
+ * Retrieves the number of lanes in @queue.
+ *
+ * Returns: The number of lanes.
+ * Side effects: None.
+ */
+guint
+lf_sharded_queue_get_n_lanes(LfShardedQueue *queue)
+{
+	g_return_val_if_fail(queue != NULL, 0);
+
+	return queue->n_lanes;
+}
+
+/**
+ * lf_sharded_queue_get_length_approx:
+ * @queue: A #LfShardedQueue
+ *
+ * Estimates the number of items in @queue by adding up the approximate
+ * lengths of its lanes, see lf_queue_get_length_approx().  With concurrent
+ * updates the result may be slightly off in either direction.
+ *
+ * Returns: The approximate number of items.
+ * Side effects: None.
+ */
+gsize
+lf_sharded_queue_get_length_approx(LfShardedQueue *queue)
+{
+	gsize length = 0;
+	guint i;
+
+	g_return_val_if_fail(queue != NULL, 0);
+
+	for (i = 0; i < queue->n_lanes; i++)
+		length += lf_queue_get_length_approx(queue->lanes[i]);
+
+	return length;
+}
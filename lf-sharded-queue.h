@@ -0,0 +1,60 @@
+/* lf-sharded-queue.h
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LF_SHARDED_QUEUE_H__
+#define __LF_SHARDED_QUEUE_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LfShardedQueue LfShardedQueue;
+
+/**
+ * LfShardedQueueFlags:
+ * @LF_SHARDED_QUEUE_NONE: Producers use the lane of the CPU they run on.
+ * @LF_SHARDED_QUEUE_LANE_ORDER: Each producer thread sticks to one lane, so
+ *   the items of a single producer are dequeued in the order it enqueued
+ *   them.
+ *
+ * Flags controlling how an #LfShardedQueue spreads items over its lanes.
+ */
+typedef enum {
+	LF_SHARDED_QUEUE_NONE       = 0,
+	LF_SHARDED_QUEUE_LANE_ORDER = 1 << 0
+} LfShardedQueueFlags;
+
+GType           lf_sharded_queue_get_type          (void) G_GNUC_CONST;
+LfShardedQueue* lf_sharded_queue_new               (guint n_lanes,
+                                                    LfShardedQueueFlags flags);
+LfShardedQueue* lf_sharded_queue_ref               (LfShardedQueue *queue);
+void            lf_sharded_queue_unref             (LfShardedQueue *queue);
+void            lf_sharded_queue_enqueue           (LfShardedQueue *queue,
+                                                    gconstpointer data);
+gpointer        lf_sharded_queue_dequeue           (LfShardedQueue *queue);
+guint           lf_sharded_queue_get_n_lanes       (LfShardedQueue *queue);
+gsize           lf_sharded_queue_get_length_approx (LfShardedQueue *queue);
+
+G_END_DECLS
+
+#endif /* __LF_SHARDED_QUEUE_H__ */
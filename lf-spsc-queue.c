@@ -0,0 +1,380 @@
+/* lf-spsc-queue.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "lf-atomic.h"
+#include "lf-spsc-queue.h"
+
+/**
+ * @LF_CACHE_LINE: The assumed size of a cache line in bytes.  The producer
+ *                 and consumer each get a line of their own so they do not
+ *                 falsely share.
+ */
+#define LF_CACHE_LINE (64)
+
+/*
+ * A bounded single-producer single-consumer ring.  Only the producer writes
+ * enqueue_pos and only the consumer writes dequeue_pos, so neither needs a
+ * read-modify-write; publishing a position is a release store and reading
+ * the other side's is an acquire load.
+ *
+ * Each side also keeps a private copy of the other side's position on its
+ * own cache line.  It is only refreshed when it says the ring is full, or
+ * empty, so while the two are far apart neither touches the other's line at
+ * all.  Positions count up forever and are compared by subtraction, so they
+ * may wrap.
+ */
+struct _LfSpscQueue {
+	gpointer       *items;
+	guint           mask;
+	volatile gint   ref_count;
+	gchar           pad0[LF_CACHE_LINE - sizeof(gpointer) - 2 * sizeof(gint)];
+	volatile guint  enqueue_pos;
+	guint           cached_dequeue_pos;
+	gchar           pad1[LF_CACHE_LINE - 2 * sizeof(guint)];
+	volatile guint  dequeue_pos;
+	guint           cached_enqueue_pos;
+	gchar           pad2[LF_CACHE_LINE - 2 * sizeof(guint)];
+};
+
+static gpointer
+lf_spsc_queue_aligned_alloc(gsize size)
+{
+	gpointer mem;
+
+	if (posix_memalign(&mem, LF_CACHE_LINE, size) != 0)
+		g_error("Failed to allocate %" G_GSIZE_FORMAT " bytes", size);
+
+	return mem;
+}
+
+/*
+ * Returns the number of slots the producer may fill, refreshing its copy of
+ * the consumer's position only if the stale copy says there are fewer than
+ * wanted.
+ */
+static inline guint
+lf_spsc_queue_free_slots(LfSpscQueue *queue,
+                         guint        pos,
+                         guint        wanted)
+{
+	guint n_free;
+
+	n_free = queue->mask + 1 - (pos - queue->cached_dequeue_pos);
+	if (n_free < wanted) {
+		queue->cached_dequeue_pos = lf_atomic_load(&queue->dequeue_pos,
+		                                           memory_order_acquire);
+		n_free = queue->mask + 1 - (pos - queue->cached_dequeue_pos);
+	}
+
+	return n_free;
+}
+
+/*
+ * Returns the number of items the consumer may take, refreshing its copy of
+ * the producer's position only if the stale copy says there are fewer than
+ * wanted.
+ */
+static inline guint
+lf_spsc_queue_used_slots(LfSpscQueue *queue,
+                         guint        pos,
+                         guint        wanted)
+{
+	guint n_used;
+
+	n_used = queue->cached_enqueue_pos - pos;
+	if (n_used < wanted) {
+		queue->cached_enqueue_pos = lf_atomic_load(&queue->enqueue_pos,
+		                                           memory_order_acquire);
+		n_used = queue->cached_enqueue_pos - pos;
+	}
+
+	return n_used;
+}
+
+/**
+ * lf_spsc_queue_new:
+ * @capacity: The number of items the queue can hold.
+ *
+ * Creates a new instance of #LfSpscQueue, a bounded FIFO for exactly one
+ * producer thread and one consumer thread.  @capacity is rounded up to the
+ * next power of two.  Neither side allocates, takes a lock, or performs an
+ * atomic read-modify-write, which makes it the cheapest way to move items
+ * between a fixed pair of threads.  Which threads those are may change over
+ * time, as long as the hand over itself synchronizes.  The #LfSpscQueue
+ * structure is reference counted and should be freed using
+ * lf_spsc_queue_unref().
+ *
+ * Returns: The newly created #LfSpscQueue.
+ * Side effects: None.
+ */
+LfSpscQueue*
+lf_spsc_queue_new(guint capacity)
+{
+	LfSpscQueue *queue;
+	guint size;
+
+	g_return_val_if_fail(capacity > 0, NULL);
+	g_return_val_if_fail(capacity <= (G_MAXINT / 2), NULL);
+
+	for (size = 2; size < capacity; size <<= 1);
+
+	queue = lf_spsc_queue_aligned_alloc(sizeof(LfSpscQueue));
+	queue->items = lf_spsc_queue_aligned_alloc(sizeof(gpointer) * size);
+	queue->mask = size - 1;
+	queue->ref_count = 1;
+	queue->enqueue_pos = 0;
+	queue->cached_dequeue_pos = 0;
+	queue->dequeue_pos = 0;
+	queue->cached_enqueue_pos = 0;
+
+	return queue;
+}
+
+/**
+ * lf_spsc_queue_ref:
+ * @queue: A #LfSpscQueue
+ *
+ * Atomically increments the reference count of @queue by one.
+ *
+ * Returns: A reference to @queue.
+ * Side effects: None.
+ */
+LfSpscQueue*
+lf_spsc_queue_ref(LfSpscQueue *queue)
+{
+	g_return_val_if_fail(queue != NULL, NULL);
+	g_return_val_if_fail(queue->ref_count > 0, NULL);
+
+	g_atomic_int_inc(&queue->ref_count);
+	return queue;
+}
+
+/**
+ * lf_spsc_queue_unref:
+ * @queue: A #LfSpscQueue
+ *
+ * Decrements the reference count of @queue by one.  When the reference count
+ * reaches zero, the structures allocations are released and the queue is
+ * freed.  Items still in the queue are not freed.
+ */
+void
+lf_spsc_queue_unref(LfSpscQueue *queue)
+{
+	g_return_if_fail(queue != NULL);
+	g_return_if_fail(queue->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&queue->ref_count)) {
+		free(queue->items);
+		free(queue);
+	}
+}
+
+/**
+ * lf_spsc_queue_get_type:
+ *
+ * Retrieves the GObject type system's type identifier for #LfSpscQueue.
+ *
+ * Returns: A #GType containing the type id.
+ * Side effects: Registers the #LfSpscQueue type if not already.
+ */
+GType
+lf_spsc_queue_get_type(void)
+{
+	static GType type_id = 0;
+	GType tmp_id;
+
+	if (g_once_init_enter((gsize *)&type_id)) {
+		tmp_id = g_boxed_type_register_static("LfSpscQueue",
+		                                      (GBoxedCopyFunc)lf_spsc_queue_ref,
+		                                      (GBoxedFreeFunc)lf_spsc_queue_unref);
+		g_once_init_leave((gsize *)&type_id, tmp_id);
+	}
+
+	return type_id;
+}
+
+/**
+ * lf_spsc_queue_get_capacity:
+ * @queue: A #LfSpscQueue
+ *
+ * Retrieves the number of items @queue can hold, which is the capacity given
+ * to lf_spsc_queue_new() rounded up to the next power of two.
+ *
+ * Returns: The capacity of @queue.
+ * Side effects: None.
+ */
+guint
+lf_spsc_queue_get_capacity(LfSpscQueue *queue)
+{
+	g_return_val_if_fail(queue != NULL, 0);
+
+	return queue->mask + 1;
+}
+
+/**
+ * lf_spsc_queue_enqueue:
+ * @queue: A #LfSpscQueue.
+ * @data: a non-%NULL pointer.
+ *
+ * Attempts to enqueue an item into the #LfSpscQueue.  Only the producer may
+ * call this.  If the queue is full this fails immediately rather than
+ * waiting for the consumer.
+ *
+ * Returns: %TRUE if @data was enqueued, %FALSE if the queue was full.
+ * Side effects: None.
+ */
+gboolean
+lf_spsc_queue_enqueue(LfSpscQueue   *queue,
+                      gconstpointer  data)
+{
+	guint pos;
+
+	g_return_val_if_fail(queue != NULL, FALSE);
+	g_return_val_if_fail(data != NULL, FALSE);
+
+	pos = lf_atomic_load(&queue->enqueue_pos, memory_order_relaxed);
+	if (!lf_spsc_queue_free_slots(queue, pos, 1))
+		return FALSE;
+
+	queue->items[pos & queue->mask] = (gpointer)data;
+	lf_atomic_store(&queue->enqueue_pos, pos + 1, memory_order_release);
+
+	return TRUE;
+}
+
+/**
+ * lf_spsc_queue_dequeue:
+ * @queue: A #LfSpscQueue
+ *
+ * Dequeues an item from the queue.  Only the consumer may call this.  If the
+ * queue is empty, %NULL is returned.
+ *
+ * Returns: An item from the queue or %NULL.
+ * Side effects: None.
+ */
+gpointer
+lf_spsc_queue_dequeue(LfSpscQueue *queue)
+{
+	gpointer data;
+	guint pos;
+
+	g_return_val_if_fail(queue != NULL, NULL);
+
+	pos = lf_atomic_load(&queue->dequeue_pos, memory_order_relaxed);
+	if (!lf_spsc_queue_used_slots(queue, pos, 1))
+		return NULL;
+
+	data = queue->items[pos & queue->mask];
+	lf_atomic_store(&queue->dequeue_pos, pos + 1, memory_order_release);
+
+	return data;
+}
+
+/**
+ * lf_spsc_queue_enqueue_many:
+ * @queue: A #LfSpscQueue.
+ * @items: An array of non-%NULL pointers.
+ * @n_items: The number of pointers in @items.
+ *
+ * Enqueues as many of @items into the #LfSpscQueue, in order, as there is
+ * room for.  Only the producer may call this.  The items are published to
+ * the consumer with a single store.
+ *
+ * Returns: The number of items enqueued, which are the first ones in @items.
+ * Side effects: None.
+ */
+guint
+lf_spsc_queue_enqueue_many(LfSpscQueue  *queue,
+                           gpointer     *items,
+                           guint         n_items)
+{
+	guint pos, i;
+
+	g_return_val_if_fail(queue != NULL, 0);
+	g_return_val_if_fail(items != NULL || n_items == 0, 0);
+
+	pos = lf_atomic_load(&queue->enqueue_pos, memory_order_relaxed);
+	n_items = MIN(n_items, lf_spsc_queue_free_slots(queue, pos, n_items));
+	for (i = 0; i < n_items; i++)
+		queue->items[(pos + i) & queue->mask] = items[i];
+	lf_atomic_store(&queue->enqueue_pos, pos + n_items, memory_order_release);
+
+	return n_items;
+}
+
+/**
+ * lf_spsc_queue_dequeue_many:
+ * @queue: A #LfSpscQueue
+ * @items: A location for up to @max_items pointers.
+ * @max_items: The maximum number of items to dequeue.
+ *
+ * Dequeues up to @max_items items from the queue into @items in the order
+ * they were enqueued.  Only the consumer may call this.  The slots are handed
+ * back to the producer with a single store.
+ *
+ * Returns: The number of items stored in @items, 0 if the queue is empty.
+ * Side effects: None.
+ */
+guint
+lf_spsc_queue_dequeue_many(LfSpscQueue *queue,
+                           gpointer    *items,
+                           guint        max_items)
+{
+	guint pos, n_items, i;
+
+	g_return_val_if_fail(queue != NULL, 0);
+	g_return_val_if_fail(items != NULL || max_items == 0, 0);
+
+	pos = lf_atomic_load(&queue->dequeue_pos, memory_order_relaxed);
+	n_items = MIN(max_items, lf_spsc_queue_used_slots(queue, pos, max_items));
+	for (i = 0; i < n_items; i++)
+		items[i] = queue->items[(pos + i) & queue->mask];
+	lf_atomic_store(&queue->dequeue_pos, pos + n_items, memory_order_release);
+
+	return n_items;
+}
+
+/**
+ * lf_spsc_queue_get_length_approx:
+ * @queue: A #LfSpscQueue
+ *
+ * Retrieves the number of items in @queue.  Any thread may call this, but
+ * with concurrent updates the result is only a snapshot.
+ *
+ * Returns: The approximate number of items in @queue.
+ * Side effects: None.
+ */
+guint
+lf_spsc_queue_get_length_approx(LfSpscQueue *queue)
+{
+	guint enqueue_pos, dequeue_pos;
+
+	g_return_val_if_fail(queue != NULL, 0);
+
+	dequeue_pos = lf_atomic_load(&queue->dequeue_pos, memory_order_acquire);
+	enqueue_pos = lf_atomic_load(&queue->enqueue_pos, memory_order_acquire);
+
+	return enqueue_pos - dequeue_pos;
+}
@@ -0,0 +1,353 @@
+/* lf-stack.c
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lf-atomic.h"
+#include "lf-stack.h"
+#include "lf-hazard.h"
+#include "lf-node.h"
+
+/**
+ * @LF_CACHE_LINE: The assumed size of a cache line in bytes.  Elimination
+ *                 slots are padded and aligned to this.
+ */
+#define LF_CACHE_LINE (64)
+
+/**
+ * @LF_STACK_ELIMINATION_SIZE: The number of slots in the elimination array.
+ */
+#define LF_STACK_ELIMINATION_SIZE (8)
+
+/**
+ * @LF_STACK_ELIMINATION_SPIN: The number of times a push waits on its
+ *                             elimination slot for a pop to take its item.
+ */
+#define LF_STACK_ELIMINATION_SPIN (64)
+
+/*
+ * Marks an elimination slot whose item was taken by a pop.  The pushing
+ * thread owns the slot until it sees this and empties the slot again.
+ */
+#define LF_STACK_TAKEN ((gpointer)&_lf_stack_taken)
+
+typedef union _LfStackSlot LfStackSlot;
+
+union _LfStackSlot {
+	gpointer data;
+	gchar    pad[LF_CACHE_LINE];
+};
+
+/*
+ * A Treiber stack.  When the CAS on top fails because of contention, the
+ * thread tries to meet an opposite operation in a random slot of the
+ * elimination array instead.  A push and a pop that meet cancel each other
+ * out without touching top at all, so under contention the operations spread
+ * over many cache lines rather than all fighting over one.
+ */
+struct _LfStack {
+	LfNode          *top;
+	volatile gint    ref_count;
+	LfHazardDomain  *domain;
+	LfStackSlot     *slots;
+};
+
+static gchar _lf_stack_taken;
+
+/*
+ * Picks an elimination slot.  Threads start out in different slots based on
+ * their hazard record and wander further each retry.
+ */
+static inline LfStackSlot*
+lf_stack_slot(LfStack  *stack,
+              LfHazard *hazard,
+              guint     attempt)
+{
+	guint hash;
+
+	hash = (hazard->id + attempt) * 2654435761U;
+	return &stack->slots[(hash >> 16) % LF_STACK_ELIMINATION_SIZE];
+}
+
+/*
+ * Offers data to a concurrent pop through the elimination array.
+ *
+ * Returns: TRUE if a pop took data.
+ */
+static gboolean
+lf_stack_eliminate_push(LfStackSlot *slot,
+                        gpointer     data)
+{
+	gint i;
+
+	if (!lf_atomic_pointer_cas(&slot->data, NULL, data,
+	                           memory_order_release))
+		return FALSE;
+
+	for (i = 0; i < LF_STACK_ELIMINATION_SPIN; i++) {
+		if (lf_atomic_load(&slot->data,
+		                   memory_order_relaxed) == LF_STACK_TAKEN)
+			break;
+	}
+
+	/*
+	 * Withdraw the offer.  If that fails, a pop took it in the meantime.
+	 */
+	if (lf_atomic_pointer_cas(&slot->data, data, NULL, memory_order_relaxed))
+		return FALSE;
+	lf_atomic_store(&slot->data, NULL, memory_order_release);
+	return TRUE;
+}
+
+/*
+ * Takes an item offered by a concurrent push through the elimination array.
+ *
+ * Returns: The item or NULL if none was on offer.
+ */
+static gpointer
+lf_stack_eliminate_pop(LfStackSlot *slot)
+{
+	gpointer data;
+
+	data = lf_atomic_load(&slot->data, memory_order_relaxed);
+	if (data == NULL || data == LF_STACK_TAKEN)
+		return NULL;
+	if (!lf_atomic_pointer_cas(&slot->data, data, LF_STACK_TAKEN,
+	                           memory_order_acquire))
+		return NULL;
+	return data;
+}
+
+static void
+lf_stack_destroy(LfStack *stack)
+{
+	LfNode *node, *next;
+
+	g_return_if_fail(stack != NULL);
+
+	for (node = stack->top; node; node = next) {
+		next = node->next;
+		lf_node_free(node);
+	}
+	free(stack->slots);
+}
+
+/**
+ * lf_stack_new:
+ *
+ * Creates a new instance of #LfStack.  The #LfStack structure is reference
+ * counted and should be freed using lf_stack_unref().
+ *
+ * Returns: The newly created #LfStack.
+ * Side effects: None.
+ */
+LfStack*
+lf_stack_new(void)
+{
+	LfStack *stack;
+	gpointer mem;
+
+	if (posix_memalign(&mem, LF_CACHE_LINE,
+	                   sizeof(LfStackSlot) * LF_STACK_ELIMINATION_SIZE) != 0)
+		g_error("Failed to allocate %" G_GSIZE_FORMAT " bytes",
+		        sizeof(LfStackSlot) * LF_STACK_ELIMINATION_SIZE);
+	memset(mem, 0, sizeof(LfStackSlot) * LF_STACK_ELIMINATION_SIZE);
+
+	stack = g_slice_new(LfStack);
+	stack->top = NULL;
+	stack->ref_count = 1;
+	stack->domain = lf_hazard_domain_get_default();
+	stack->slots = mem;
+
+	return stack;
+}
+
+/**
+ * lf_stack_ref:
+ * @stack: A #LfStack
+ *
+ * Atomically increments the reference count of @stack by one.
+ *
+ * Returns: A reference to @stack.
+ * Side effects: None.
+ */
+LfStack*
+lf_stack_ref(LfStack *stack)
+{
+	g_return_val_if_fail(stack != NULL, NULL);
+	g_return_val_if_fail(stack->ref_count > 0, NULL);
+
+	g_atomic_int_inc(&stack->ref_count);
+	return stack;
+}
+
+/**
+ * lf_stack_unref:
+ * @stack: A #LfStack
+ *
+ * Decrements the reference count of @stack by one.  When the reference count
+ * reaches zero, the structures allocations are released and the stack is
+ * freed.
+ */
+void
+lf_stack_unref(LfStack *stack)
+{
+	g_return_if_fail(stack != NULL);
+	g_return_if_fail(stack->ref_count > 0);
+
+	if (g_atomic_int_dec_and_test(&stack->ref_count)) {
+		lf_stack_destroy(stack);
+		g_slice_free(LfStack, stack);
+	}
+}
+
+/**
+ * lf_stack_get_type:
+ *
+ * Retrieves the GObject type system's type identifier for #LfStack.
+ *
+ * Returns: A #GType containing the type id.
+ * Side effects: Registers the #LfStack type if not already.
+ */
+GType
+lf_stack_get_type(void)
+{
+	static GType type_id = 0;
+	GType tmp_id;
+
+	if (g_once_init_enter((gsize *)&type_id)) {
+		tmp_id = g_boxed_type_register_static("LfStack",
+		                                      (GBoxedCopyFunc)lf_stack_ref,
+		                                      (GBoxedFreeFunc)lf_stack_unref);
+		g_once_init_leave((gsize *)&type_id, tmp_id);
+	}
+
+	return type_id;
+}
+
+/**
+ * lf_stack_push:
+ * @stack: A #LfStack
+ * @data: a non-%NULL pointer.
+ *
+ * Pushes an item onto the top of the #LfStack.  The pointer must be
+ * non-%NULL.
+ *
+ * Side effects: None.
+ */
+void
+lf_stack_push(LfStack       *stack,
+              gconstpointer  data)
+{
+	LfStackSlot *slot;
+	LfNode *node, *top;
+	guint attempt;
+	LF_HAZARD_INIT;
+
+	g_return_if_fail(stack != NULL);
+	g_return_if_fail(data != NULL);
+
+	LF_HAZARD_ENTER(stack->domain);
+
+	node = lf_node_new();
+	node->data = (gpointer)data;
+
+	for (attempt = 0; ; attempt++) {
+		top = lf_atomic_load(&stack->top, memory_order_relaxed);
+		node->next = top;
+		if (lf_atomic_pointer_cas(&stack->top, top, node,
+		                          memory_order_seq_cst))
+			return;
+		/*
+		 * Lost the race for top.  Try to hand the item straight to a
+		 * pop before going back to it.
+		 */
+		slot = lf_stack_slot(stack, LF_HAZARD_TLS, attempt);
+		if (lf_stack_eliminate_push(slot, node->data)) {
+			lf_node_free(node);
+			return;
+		}
+	}
+}
+
+/**
+ * lf_stack_pop:
+ * @stack: A #LfStack
+ *
+ * Pops the item at the top of the stack.  If the stack is empty, %NULL is
+ * returned.
+ *
+ * Returns: An item from the stack or %NULL.
+ *
+ * Side effects: Hazard pointer reclaimation can occur meaning that structures
+ *   no longer in use may be freed by the system.
+ */
+gpointer
+lf_stack_pop(LfStack *stack)
+{
+	LfStackSlot *slot;
+	LfNode *top, *next;
+	gpointer data;
+	guint attempt;
+	LF_HAZARD_INIT;
+
+	g_return_val_if_fail(stack != NULL, NULL);
+
+	LF_HAZARD_ENTER(stack->domain);
+
+	for (attempt = 0; ; attempt++) {
+		/* Retrieve the current top of stack */
+		top = lf_atomic_load(&stack->top, memory_order_acquire);
+		if (top == NULL)         /* The stack is empty */
+			return NULL;
+		LF_HAZARD_SET(0, top);   /* Notify threads that top is a hazard */
+		/* Ensure top is still the stacks top */
+		if (lf_atomic_load(&stack->top, memory_order_seq_cst) != top)
+			continue;
+		next = top->next;        /* Safe to read while top is a hazard */
+		data = top->data;
+		if (lf_atomic_pointer_cas(&stack->top, top, next,
+		                          memory_order_seq_cst))
+			break;
+		/*
+		 * Lost the race for top.  Try to take an item straight from a
+		 * push before going back to it.
+		 */
+		slot = lf_stack_slot(stack, LF_HAZARD_TLS, attempt);
+		if ((data = lf_stack_eliminate_pop(slot))) {
+			LF_HAZARD_SET(0, NULL);
+			return data;
+		}
+	}
+
+	/*
+	 * The hazard pointer keeps top from being freed, and so reused, by
+	 * another thread while we compare against it, which is what protects
+	 * the CAS above from ABA.
+	 */
+	LF_HAZARD_SET(0, NULL);
+	LF_HAZARD_UNSET(top, lf_node_free);
+
+	return data;
+}
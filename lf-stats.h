@@ -0,0 +1,97 @@
+/* lf-stats.h
+ *
+ * Copyright (c) 2009 Christian Hergert
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LF_STATS_H__
+#define __LF_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * @LF_ENABLE_STATS: Define this when building the library to maintain the
+ *                   counters reported through #LfQueueStats and
+ *                   #LfHazardStats.  Without it the counters are compiled
+ *                   out entirely and the accessors report all zeroes.
+ */
+
+typedef struct _LfQueueStats  LfQueueStats;
+typedef struct _LfHazardStats LfHazardStats;
+
+/**
+ * LfQueueStats:
+ * @enqueued: The number of items enqueued.
+ * @dequeued: The number of items dequeued.
+ * @empty_dequeues: The number of dequeue attempts that found the queue empty.
+ * @cas_failures: The number of compare-and-swaps on the head or tail of the
+ *   queue that lost a race with another thread and had to be retried.
+ * @tail_helps: The number of times a thread found the tail lagging behind
+ *   another thread's append and moved it forward on its behalf.
+ *
+ * A snapshot of the counters of an #LfQueue, summed over every thread that
+ * has touched it.
+ */
+struct _LfQueueStats {
+	guint64 enqueued;
+	guint64 dequeued;
+	guint64 empty_dequeues;
+	guint64 cas_failures;
+	guint64 tail_helps;
+};
+
+/**
+ * LfHazardStats:
+ * @scans: The number of times lf_hazard_scan() has run.
+ * @scan_time_ns: The total time spent in lf_hazard_scan() in nanoseconds.
+ * @scan_max_ns: The longest single lf_hazard_scan() in nanoseconds.
+ * @adoptions: The number of retired lists adopted from exited threads or
+ *   handed off to the background reclaimer.
+ * @handoffs: The number of retired lists handed off to the background
+ *   reclaimer instead of being scanned inline.
+ * @retired: The number of pointers currently retired but not yet freed,
+ *   not counting those orphaned by exited threads.
+ * @pending: The number of retired pointers orphaned by exited threads or
+ *   handed off to the reclaimer and not yet adopted.
+ * @n_records: The number of hazard records, active or not.
+ * @n_active: The number of hazard records owned by live threads.
+ * @n_hazards: The total number of hazard pointer slots, _LF_H.
+ *
+ * A snapshot of the hazard pointer reclaimation counters, summed over every
+ * hazard record.
+ */
+struct _LfHazardStats {
+	guint64 scans;
+	guint64 scan_time_ns;
+	guint64 scan_max_ns;
+	guint64 adoptions;
+	guint64 handoffs;
+	guint   retired;
+	guint   pending;
+	guint   n_records;
+	guint   n_active;
+	guint   n_hazards;
+};
+
+G_END_DECLS
+
+#endif /* __LF_STATS_H__ */
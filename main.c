@@ -34,7 +34,21 @@
 #endif /* __APPLE__ */
 #endif /* __linux__ */
 
+#include "lf-atomic.h"
+#include "lf-delay-queue.h"
+#include "lf-deque.h"
+#include "lf-epoch.h"
+#include "lf-executor.h"
+#include "lf-hash-map.h"
+#include "lf-hazard.h"
+#include "lf-iqueue.h"
+#include "lf-mpsc-queue.h"
+#include "lf-priority-queue.h"
 #include "lf-queue.h"
+#include "lf-ring.h"
+#include "lf-sharded-queue.h"
+#include "lf-spsc-queue.h"
+#include "lf-stack.h"
 
 static gint
 get_num_cpu(void)
@@ -73,6 +87,89 @@ test_LfQueue_basic(void)
 	g_assert(!lf_queue_dequeue(q));
 }
 
+static void
+test_LfQueue_segment(void)
+{
+	LfQueue *q;
+	gpointer items[8], *many;
+	gint i;
+
+	q = lf_queue_new_with_engine(LF_QUEUE_ENGINE_SEGMENT,
+	                             LF_QUEUE_RECLAIM_HAZARD);
+	g_assert(q);
+	g_assert(!lf_queue_dequeue(q));
+
+	/*
+	 * Polling an empty queue must not use up slots.
+	 */
+	for (i = 0; i < 1000; i++)
+		g_assert(!lf_queue_dequeue(q));
+
+	for (i = 1; i <= 2000; i++)
+		lf_queue_enqueue(q, GINT_TO_POINTER(i));
+	for (i = 1; i <= 1000; i++)
+		g_assert_cmpint(GPOINTER_TO_INT(lf_queue_dequeue(q)), ==, i);
+
+	for (i = 0; i < G_N_ELEMENTS(items); i++)
+		items[i] = GINT_TO_POINTER(2001 + i);
+	lf_queue_enqueue_many(q, items, G_N_ELEMENTS(items));
+	for (i = 1001; i <= 2000; i++)
+		g_assert_cmpint(GPOINTER_TO_INT(lf_queue_dequeue(q)), ==, i);
+	g_assert_cmpint(lf_queue_dequeue_many(q, items, 5), ==, 5);
+	g_assert_cmpint(lf_queue_dequeue_many(q, items, 5), ==, 3);
+	g_assert_cmpint(GPOINTER_TO_INT(items[2]), ==, 2008);
+	g_assert(!lf_queue_dequeue(q));
+
+	/*
+	 * Batches larger than a segment are split over several.
+	 */
+	many = g_new(gpointer, 1000);
+	for (i = 0; i < 1000; i++)
+		many[i] = GINT_TO_POINTER(i + 1);
+	lf_queue_enqueue_many(q, many, 1000);
+	for (i = 0; i < 1000; i++)
+		many[i] = NULL;
+	g_assert_cmpint(lf_queue_dequeue_many(q, many, 1000), ==, 1000);
+	for (i = 0; i < 1000; i++)
+		g_assert_cmpint(GPOINTER_TO_INT(many[i]), ==, i + 1);
+	g_assert(!lf_queue_dequeue(q));
+	g_free(many);
+
+	lf_queue_enqueue(q, "String 1");
+	lf_queue_unref(q);
+}
+
+static void
+test_LfQueue_many(void)
+{
+	gpointer items[10];
+	LfQueue *q;
+	gint i;
+
+	q = lf_queue_new();
+
+	for (i = 0; i < G_N_ELEMENTS(items); i++)
+		items[i] = GINT_TO_POINTER(i + 1);
+	lf_queue_enqueue(q, GINT_TO_POINTER(100));
+	lf_queue_enqueue_many(q, items, G_N_ELEMENTS(items));
+	lf_queue_enqueue_many(q, items, 0);
+	lf_queue_enqueue(q, GINT_TO_POINTER(200));
+
+	g_assert_cmpint(lf_queue_dequeue_many(q, items, 4), ==, 4);
+	g_assert_cmpint(GPOINTER_TO_INT(items[0]), ==, 100);
+	for (i = 1; i < 4; i++)
+		g_assert_cmpint(GPOINTER_TO_INT(items[i]), ==, i);
+	g_assert_cmpint(GPOINTER_TO_INT(lf_queue_dequeue(q)), ==, 4);
+	g_assert_cmpint(lf_queue_dequeue_many(q, items, G_N_ELEMENTS(items)), ==, 7);
+	for (i = 0; i < 6; i++)
+		g_assert_cmpint(GPOINTER_TO_INT(items[i]), ==, i + 5);
+	g_assert_cmpint(GPOINTER_TO_INT(items[6]), ==, 200);
+	g_assert_cmpint(lf_queue_dequeue_many(q, items, G_N_ELEMENTS(items)), ==, 0);
+	g_assert(!lf_queue_dequeue(q));
+
+	lf_queue_unref(q);
+}
+
 static gpointer
 test_LfQueue_threaded_alternate_enq_deq_thread_func(gpointer data)
 {
@@ -127,6 +224,1832 @@ test_LfQueue_threaded_alternate_enq_deq(void)
 	g_free(threads);
 }
 
+typedef struct {
+	LfQueue         *q;
+	gint             n_items;
+	gint             batch;
+	volatile gint    n_consumed;
+	volatile gint64  sum;
+} ProducerConsumerData;
+
+static gpointer
+test_LfQueue_threaded_producer_consumer_producer(gpointer data)
+{
+	ProducerConsumerData *pc = data;
+	gpointer items[64];
+	gint i, n = 0;
+
+	for (i = 1; i <= pc->n_items; i++) {
+		if (pc->batch < 2) {
+			lf_queue_enqueue(pc->q, GINT_TO_POINTER(i));
+			continue;
+		}
+		items[n++] = GINT_TO_POINTER(i);
+		if (n == pc->batch || i == pc->n_items) {
+			lf_queue_enqueue_many(pc->q, items, n);
+			n = 0;
+		}
+	}
+
+	return NULL;
+}
+
+static gpointer
+test_LfQueue_threaded_producer_consumer_consumer(gpointer data)
+{
+	ProducerConsumerData *pc = data;
+	gpointer items[64];
+	gint i, n;
+
+	while (lf_atomic_load(&pc->n_consumed, memory_order_relaxed) <
+	       pc->n_items * 2) {
+		if (pc->batch < 2)
+			n = (items[0] = lf_queue_dequeue(pc->q)) ? 1 : 0;
+		else
+			n = lf_queue_dequeue_many(pc->q, items, pc->batch);
+		if (!n) {
+			g_thread_yield();
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			lf_atomic_add_fetch(&pc->sum, GPOINTER_TO_INT(items[i]),
+			                    memory_order_relaxed);
+		g_atomic_int_add(&pc->n_consumed, n);
+	}
+
+	return NULL;
+}
+
+/*
+ * This test separates producers from consumers so that every node is
+ * allocated on one thread and reclaimed on another.  This forces nodes to
+ * migrate between thread pools through the shared depot.
+ */
+static void
+test_LfQueue_threaded_producer_consumer_run(LfQueue *q,
+                                            gint     batch)
+{
+	ProducerConsumerData pc = { 0 };
+	GThread *threads[4];
+	gint i;
+
+	pc.q = q;
+	pc.n_items = g_test_perf() ? 1000000 : 100000;
+	pc.batch = batch;
+
+	threads[0] = g_thread_create(test_LfQueue_threaded_producer_consumer_producer,
+	                             &pc, TRUE, NULL);
+	threads[1] = g_thread_create(test_LfQueue_threaded_producer_consumer_producer,
+	                             &pc, TRUE, NULL);
+	threads[2] = g_thread_create(test_LfQueue_threaded_producer_consumer_consumer,
+	                             &pc, TRUE, NULL);
+	threads[3] = g_thread_create(test_LfQueue_threaded_producer_consumer_consumer,
+	                             &pc, TRUE, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+
+	g_assert_cmpint(pc.n_consumed, ==, pc.n_items * 2);
+	g_assert_cmpint(pc.sum, ==, (gint64)pc.n_items * (pc.n_items + 1));
+	g_assert(!lf_queue_dequeue(pc.q));
+
+	lf_queue_unref(pc.q);
+}
+
+static void
+test_LfQueue_threaded_producer_consumer(void)
+{
+	test_LfQueue_threaded_producer_consumer_run(
+		lf_queue_new_full(LF_QUEUE_RECLAIM_HAZARD), 1);
+}
+
+/*
+ * Same as above, but with producers and consumers moving up to 64 items at
+ * a time with lf_queue_enqueue_many() and lf_queue_dequeue_many().
+ */
+static void
+test_LfQueue_threaded_producer_consumer_many(void)
+{
+	test_LfQueue_threaded_producer_consumer_run(
+		lf_queue_new_full(LF_QUEUE_RECLAIM_HAZARD), 64);
+}
+
+static void
+test_LfQueue_threaded_producer_consumer_epoch(void)
+{
+	test_LfQueue_threaded_producer_consumer_run(
+		lf_queue_new_full(LF_QUEUE_RECLAIM_EPOCH), 1);
+	test_LfQueue_threaded_producer_consumer_run(
+		lf_queue_new_full(LF_QUEUE_RECLAIM_EPOCH), 64);
+}
+
+/*
+ * The segment engine under both reclaimation schemes.  Enough items go
+ * through to cross many segment boundaries.
+ */
+static void
+test_LfQueue_threaded_producer_consumer_segment(void)
+{
+	test_LfQueue_threaded_producer_consumer_run(
+		lf_queue_new_with_engine(LF_QUEUE_ENGINE_SEGMENT,
+		                         LF_QUEUE_RECLAIM_HAZARD), 1);
+	test_LfQueue_threaded_producer_consumer_run(
+		lf_queue_new_with_engine(LF_QUEUE_ENGINE_SEGMENT,
+		                         LF_QUEUE_RECLAIM_EPOCH), 64);
+}
+
+static gpointer
+test_LfQueue_dequeue_wait_thread_func(gpointer data)
+{
+	LfQueue *q = data;
+
+	g_usleep(G_USEC_PER_SEC / 20);
+	lf_queue_enqueue(q, "String 1");
+
+	return NULL;
+}
+
+static void
+test_LfQueue_dequeue_wait(void)
+{
+	GThread *thread;
+	LfQueue *q;
+	gint64 begin;
+
+	q = lf_queue_new();
+
+	/*
+	 * Empty queue with and without a timeout.
+	 */
+	g_assert(!lf_queue_dequeue_wait(q, 0));
+	begin = g_get_monotonic_time();
+	g_assert(!lf_queue_dequeue_wait(q, G_USEC_PER_SEC / 50));
+	g_assert_cmpint(g_get_monotonic_time() - begin, >=, G_USEC_PER_SEC / 50);
+
+	/*
+	 * Items already queued are returned immediately.
+	 */
+	lf_queue_enqueue(q, "String 0");
+	g_assert_cmpstr(lf_queue_dequeue_wait(q, -1), ==, "String 0");
+
+	/*
+	 * Block until another thread enqueues.
+	 */
+	thread = g_thread_create(test_LfQueue_dequeue_wait_thread_func,
+	                         q, TRUE, NULL);
+	g_assert_cmpstr(lf_queue_dequeue_wait(q, -1), ==, "String 1");
+	g_thread_join(thread);
+
+	lf_queue_unref(q);
+}
+
+static void
+test_LfQueue_stats(void)
+{
+	LfQueueStats stats;
+	LfHazardStats hstats;
+	gpointer items[4];
+	LfQueue *q;
+	gint i;
+
+	q = lf_queue_new();
+
+	for (i = 0; i < 100; i++)
+		lf_queue_enqueue(q, "String");
+	for (i = 0; i < 4; i++)
+		items[i] = (gpointer)"String";
+	lf_queue_enqueue_many(q, items, 4);
+	for (i = 0; i < 100; i++)
+		g_assert(lf_queue_dequeue(q));
+	g_assert_cmpint(lf_queue_dequeue_many(q, items, 8), ==, 4);
+	g_assert(!lf_queue_dequeue(q));
+
+#ifdef LF_ENABLE_STATS
+	g_assert(lf_queue_get_stats(q, &stats));
+	g_assert_cmpint(stats.enqueued, ==, 104);
+	g_assert_cmpint(stats.dequeued, ==, 104);
+	g_assert_cmpint(stats.empty_dequeues, ==, 1);
+
+	g_assert(lf_queue_get_hazard_stats(&hstats));
+	g_assert_cmpint(hstats.scans, >, 0);
+	g_assert_cmpint(hstats.n_records, >, 0);
+	g_assert_cmpint(hstats.n_hazards, >=, hstats.n_records);
+	g_assert_cmpint(hstats.scan_max_ns, <=, hstats.scan_time_ns);
+#else
+	g_assert(!lf_queue_get_stats(q, &stats));
+	g_assert_cmpint(stats.enqueued, ==, 0);
+	g_assert(!lf_queue_get_hazard_stats(&hstats));
+	g_assert_cmpint(hstats.scans, ==, 0);
+	g_assert_cmpint(hstats.n_records, >, 0);
+#endif
+
+	lf_queue_unref(q);
+}
+
+static void
+test_LfQueue_capacity_watermark(LfQueue  *q,
+                                gboolean  above,
+                                gpointer  user_data)
+{
+	GString *calls = user_data;
+
+	g_assert(q != NULL);
+	g_string_append(calls, above ? "H" : "L");
+}
+
+static void
+test_LfQueue_capacity(void)
+{
+	GString *calls;
+	LfQueue *q;
+	gint i;
+
+	/*
+	 * A small capacity is counted exactly, so the 101st item is refused.
+	 */
+	q = lf_queue_new_with_capacity(100);
+	for (i = 0; i < 100; i++)
+		g_assert(lf_queue_try_enqueue(q, "String"));
+	g_assert(!lf_queue_try_enqueue(q, "String"));
+	g_assert_cmpint(lf_queue_get_length_approx(q), ==, 100);
+	g_assert(lf_queue_dequeue(q));
+	g_assert(lf_queue_try_enqueue(q, "String"));
+	lf_queue_enqueue(q, "String");
+	g_assert_cmpint(lf_queue_get_length_approx(q), ==, 101);
+	lf_queue_unref(q);
+
+	/*
+	 * Without a capacity nothing is refused and the length still adds up.
+	 */
+	q = lf_queue_new_with_engine(LF_QUEUE_ENGINE_SEGMENT,
+	                             LF_QUEUE_RECLAIM_HAZARD);
+	for (i = 0; i < 1000; i++)
+		g_assert(lf_queue_try_enqueue(q, "String"));
+	for (i = 0; i < 10; i++)
+		g_assert(lf_queue_dequeue(q));
+	g_assert_cmpint(lf_queue_get_length_approx(q), ==, 990);
+	lf_queue_unref(q);
+
+	/*
+	 * Crossing the high watermark, even repeatedly, reports it once until
+	 * the queue drains to the low watermark.
+	 */
+	calls = g_string_new(NULL);
+	q = lf_queue_new();
+	lf_queue_set_watermarks(q, 10, 50, test_LfQueue_capacity_watermark, calls);
+	for (i = 0; i < 49; i++)
+		lf_queue_enqueue(q, "String");
+	g_assert_cmpstr(calls->str, ==, "");
+	lf_queue_enqueue(q, "String");
+	g_assert_cmpstr(calls->str, ==, "H");
+	g_assert(lf_queue_dequeue(q));
+	lf_queue_enqueue(q, "String");
+	for (i = 0; i < 39; i++)
+		g_assert(lf_queue_dequeue(q));
+	g_assert_cmpstr(calls->str, ==, "H");
+	g_assert(lf_queue_dequeue(q));
+	g_assert_cmpstr(calls->str, ==, "HL");
+	lf_queue_unref(q);
+	g_string_free(calls, TRUE);
+}
+
+typedef struct {
+	GMainLoop *loop;
+	gint       n_received;
+	gint       n_expected;
+	guint      max_batch;
+} SourceData;
+
+static gboolean
+test_LfQueue_source_func(gpointer *items,
+                         guint     n_items,
+                         gpointer  user_data)
+{
+	SourceData *sd = user_data;
+	guint i;
+
+	g_assert_cmpint(n_items, >, 0);
+	g_assert_cmpint(n_items, <=, sd->max_batch);
+	for (i = 0; i < n_items; i++)
+		g_assert_cmpint(GPOINTER_TO_INT(items[i]), ==, ++sd->n_received);
+	if (sd->n_received == sd->n_expected && sd->loop)
+		g_main_loop_quit(sd->loop);
+
+	return sd->n_received < sd->n_expected;
+}
+
+static gpointer
+test_LfQueue_source_thread_func(gpointer data)
+{
+	LfQueue *q = data;
+	gint i;
+
+	for (i = 11; i <= 1000; i++) {
+		lf_queue_enqueue(q, GINT_TO_POINTER(i));
+		if (i % 100 == 0)
+			g_usleep(1000);
+	}
+
+	return NULL;
+}
+
+static void
+test_LfQueue_source(void)
+{
+	GMainContext *context;
+	SourceData sd = { NULL, 0, 1000, 4 };
+	GThread *thread;
+	GSource *source;
+	LfQueue *q;
+	gint i;
+
+	q = lf_queue_new();
+	context = g_main_context_new();
+	source = lf_queue_create_source(q, sd.max_batch);
+	g_source_set_callback(source, (GSourceFunc)test_LfQueue_source_func,
+	                      &sd, NULL);
+	g_source_attach(source, context);
+
+	/*
+	 * Items already in the queue are dispatched max_batch at a time, after
+	 * which the source sleeps until the next enqueue.
+	 */
+	for (i = 1; i <= 10; i++)
+		lf_queue_enqueue(q, GINT_TO_POINTER(i));
+	while (g_main_context_iteration(context, FALSE));
+	g_assert_cmpint(sd.n_received, ==, 10);
+	g_assert(!g_main_context_iteration(context, FALSE));
+
+	/*
+	 * Items from another thread wake up a blocked main loop.  The callback
+	 * removes the source once it has seen every item.
+	 */
+	sd.loop = g_main_loop_new(context, FALSE);
+	thread = g_thread_create(test_LfQueue_source_thread_func, q, TRUE, NULL);
+	g_main_loop_run(sd.loop);
+	g_thread_join(thread);
+	g_assert_cmpint(sd.n_received, ==, 1000);
+	g_assert(g_source_is_destroyed(source));
+	g_assert(!lf_queue_dequeue(q));
+
+	g_source_unref(source);
+	g_main_loop_unref(sd.loop);
+	g_main_context_unref(context);
+	lf_queue_unref(q);
+}
+
+static gint     test_LfHazard_domain_n_freed = 0;
+static gpointer test_LfHazard_domain_protected = NULL;
+
+static void
+test_LfHazard_domain_free(gpointer data)
+{
+	g_assert(data != test_LfHazard_domain_protected);
+	test_LfHazard_domain_n_freed++;
+	g_free(data);
+}
+
+static void
+test_LfHazard_domain(void)
+{
+	LfHazardDomain *domain;
+	gint i;
+	LF_HAZARD_INIT;
+
+	domain = lf_hazard_domain_new(3);
+	g_assert_cmpint(lf_hazard_domain_get_n_slots(domain), ==, 3);
+	LF_HAZARD_ENTER(domain);
+	g_assert(LF_HAZARD_TLS == lf_hazard_get(domain));
+	g_assert(LF_HAZARD_TLS != lf_hazard_get(lf_hazard_domain_get_default()));
+
+	/*
+	 * A pointer in the last slot must survive every scan until released.
+	 */
+	test_LfHazard_domain_protected = g_new0(gint, 1);
+	LF_HAZARD_SET(2, test_LfHazard_domain_protected);
+	LF_HAZARD_UNSET(test_LfHazard_domain_protected,
+	                test_LfHazard_domain_free);
+	for (i = 0; i < 100; i++)
+		LF_HAZARD_UNSET(g_new0(gint, 1), test_LfHazard_domain_free);
+	g_assert_cmpint(test_LfHazard_domain_n_freed, >=, 100 - LF_HAZARD_R - 3);
+
+	LF_HAZARD_SET(2, NULL);
+	test_LfHazard_domain_protected = NULL;
+	lf_hazard_collect(LF_HAZARD_TLS);
+	g_assert_cmpint(test_LfHazard_domain_n_freed, ==, 101);
+}
+
+static gint test_LfHazard_thread_exit_n_freed = 0;
+
+static void
+test_LfHazard_thread_exit_free(gpointer data)
+{
+	g_atomic_int_inc(&test_LfHazard_thread_exit_n_freed);
+	g_free(data);
+}
+
+static gpointer
+test_LfHazard_thread_exit_thread_func(gpointer data)
+{
+	LfHazardDomain *domain = data;
+	gint i;
+	LF_HAZARD_INIT;
+
+	/*
+	 * Exit with fewer retired pointers than it takes to trigger a scan
+	 * and with a hazard pointer still set.
+	 */
+	LF_HAZARD_ENTER(domain);
+	LF_HAZARD_SET(0, domain);
+	for (i = 0; i < LF_HAZARD_R; i++)
+		LF_HAZARD_UNSET(g_new0(gint, 1), test_LfHazard_thread_exit_free);
+
+	return NULL;
+}
+
+static void
+test_LfHazard_thread_exit(void)
+{
+	LfHazardDomain *domain;
+	LfHazardStats stats;
+	GThread *thread;
+	gint i;
+	LF_HAZARD_INIT;
+
+	domain = lf_hazard_domain_new(2);
+
+	/*
+	 * Each thread releases its record on exit, so the next one reuses it.
+	 */
+	for (i = 0; i < 4; i++) {
+		thread = g_thread_create(test_LfHazard_thread_exit_thread_func,
+		                         domain, TRUE, NULL);
+		g_thread_join(thread);
+		lf_hazard_domain_get_stats(domain, &stats);
+		g_assert_cmpint(stats.n_records, ==, 1);
+		g_assert_cmpint(stats.n_active, ==, 0);
+		g_assert_cmpint(stats.retired, ==, 0);
+	}
+	g_assert_cmpint(test_LfHazard_thread_exit_n_freed, ==, 0);
+
+	/*
+	 * The next scan by a live thread reclaims what they left behind.
+	 */
+	LF_HAZARD_ENTER(domain);
+	lf_hazard_collect(LF_HAZARD_TLS);
+	g_assert_cmpint(test_LfHazard_thread_exit_n_freed, ==, 4 * LF_HAZARD_R);
+	lf_hazard_domain_get_stats(domain, &stats);
+	g_assert_cmpint(stats.n_records, ==, 1);
+	g_assert_cmpint(stats.n_active, ==, 1);
+}
+
+static volatile gint test_LfHazard_reclaimer_n_freed = 0;
+static GThread      *test_LfHazard_reclaimer_caller = NULL;
+static gpointer      test_LfHazard_reclaimer_protected = NULL;
+
+static void
+test_LfHazard_reclaimer_free(gpointer data)
+{
+	g_assert(data != test_LfHazard_reclaimer_protected);
+	g_assert(g_thread_self() != test_LfHazard_reclaimer_caller);
+	g_atomic_int_inc(&test_LfHazard_reclaimer_n_freed);
+	g_free(data);
+}
+
+static void
+test_LfHazard_reclaimer(void)
+{
+	LfHazardDomain *domain;
+	LfHazardStats stats;
+	gint i, n_freed;
+	LF_HAZARD_INIT;
+
+	domain = lf_hazard_domain_new(1);
+	LF_HAZARD_ENTER(domain);
+
+	/*
+	 * Every batch is handed to the reclaimer, so nothing is freed on this
+	 * thread.  The pointer still protected when it stops is left behind.
+	 */
+	test_LfHazard_reclaimer_caller = g_thread_self();
+	lf_hazard_domain_start_reclaimer(domain, G_MAXUINT);
+	test_LfHazard_reclaimer_protected = g_new0(gint, 1);
+	LF_HAZARD_SET(0, test_LfHazard_reclaimer_protected);
+	LF_HAZARD_UNSET(test_LfHazard_reclaimer_protected,
+	                test_LfHazard_reclaimer_free);
+	for (i = 0; i < 100; i++)
+		LF_HAZARD_UNSET(g_new0(gint, 1), test_LfHazard_reclaimer_free);
+	n_freed = 101 - LF_HAZARD_TLS->rcount;
+	lf_hazard_domain_stop_reclaimer(domain);
+	g_assert_cmpint(test_LfHazard_reclaimer_n_freed, ==, n_freed - 1);
+	lf_hazard_domain_get_stats(domain, &stats);
+	g_assert_cmpint(stats.pending, ==, 1);
+#ifdef LF_ENABLE_STATS
+	g_assert_cmpint(stats.handoffs, >, 0);
+#endif
+
+	/*
+	 * Without room for a backlog every scan happens inline again, and the
+	 * first one adopts what the reclaimer left behind.
+	 */
+	LF_HAZARD_SET(0, NULL);
+	test_LfHazard_reclaimer_protected = NULL;
+	test_LfHazard_reclaimer_caller = NULL;
+	lf_hazard_domain_start_reclaimer(domain, 0);
+	lf_hazard_collect(LF_HAZARD_TLS);
+	g_assert_cmpint(test_LfHazard_reclaimer_n_freed, ==, 101);
+	lf_hazard_domain_stop_reclaimer(domain);
+	lf_hazard_domain_get_stats(domain, &stats);
+	g_assert_cmpint(stats.pending, ==, 0);
+}
+
+static gint          test_LfEpoch_n_freed = 0;
+static volatile gint test_LfEpoch_pinned = FALSE;
+static volatile gint test_LfEpoch_unpin = FALSE;
+
+static void
+test_LfEpoch_free(gpointer data)
+{
+	g_atomic_int_inc(&test_LfEpoch_n_freed);
+}
+
+static gpointer
+test_LfEpoch_thread_func(gpointer data)
+{
+	LfEpoch *epoch;
+
+	epoch = lf_epoch_enter(data);
+	lf_atomic_store(&test_LfEpoch_pinned, TRUE, memory_order_release);
+	while (!lf_atomic_load(&test_LfEpoch_unpin, memory_order_acquire))
+		g_usleep(1000);
+	lf_epoch_leave(epoch);
+
+	return NULL;
+}
+
+static void
+test_LfEpoch_basic(void)
+{
+	LfEpochDomain *domain;
+	LfEpoch *epoch;
+	GThread *thread;
+	guint start;
+	gint i;
+
+	domain = lf_epoch_domain_new();
+	start = lf_epoch_domain_get_epoch(domain);
+
+	/*
+	 * Pointers are freed two epochs after they were retired.
+	 */
+	epoch = lf_epoch_enter(domain);
+	lf_epoch_retire(epoch, &i, test_LfEpoch_free);
+	lf_epoch_collect(epoch);
+	g_assert_cmpint(lf_epoch_domain_get_epoch(domain), ==, start + 1);
+	g_assert_cmpint(test_LfEpoch_n_freed, ==, 0);
+	lf_epoch_leave(epoch);
+
+	epoch = lf_epoch_enter(domain);
+	lf_epoch_collect(epoch);
+	g_assert_cmpint(lf_epoch_domain_get_epoch(domain), ==, start + 2);
+	g_assert_cmpint(test_LfEpoch_n_freed, ==, 1);
+	lf_epoch_leave(epoch);
+
+	/*
+	 * A thread inside a critical section holds the epoch back.
+	 */
+	thread = g_thread_create(test_LfEpoch_thread_func, domain, TRUE, NULL);
+	while (!lf_atomic_load(&test_LfEpoch_pinned, memory_order_acquire))
+		g_usleep(1000);
+	epoch = lf_epoch_enter(domain);
+	for (i = 0; i < LF_EPOCH_BATCH * 4; i++)
+		lf_epoch_retire(epoch, &i, test_LfEpoch_free);
+	lf_epoch_leave(epoch);
+	g_assert_cmpint(lf_epoch_domain_get_epoch(domain), <=, start + 3);
+	g_assert_cmpint(test_LfEpoch_n_freed, ==, 1);
+
+	lf_atomic_store(&test_LfEpoch_unpin, TRUE, memory_order_release);
+	g_thread_join(thread);
+	for (i = 0; i < 3; i++) {
+		epoch = lf_epoch_enter(domain);
+		lf_epoch_collect(epoch);
+		lf_epoch_leave(epoch);
+	}
+	g_assert_cmpint(test_LfEpoch_n_freed, ==, 1 + LF_EPOCH_BATCH * 4);
+}
+
+static void
+test_LfRing_basic(void)
+{
+	LfRing *r;
+	gint i;
+
+	r = lf_ring_new(3);
+	g_assert(r);
+	g_assert_cmpint(lf_ring_get_capacity(r), ==, 4);
+
+	g_assert(!lf_ring_dequeue(r));
+
+	/*
+	 * Go around the ring a few times so the slot sequences wrap.
+	 */
+	for (i = 0; i < 3; i++) {
+		g_assert(lf_ring_enqueue(r, "String 1"));
+		g_assert(lf_ring_enqueue(r, "String 2"));
+		g_assert(lf_ring_enqueue(r, "String 3"));
+		g_assert(lf_ring_enqueue(r, "String 4"));
+		g_assert(!lf_ring_enqueue(r, "String 5"));
+
+		g_assert_cmpstr(lf_ring_dequeue(r), ==, "String 1");
+		g_assert_cmpstr(lf_ring_dequeue(r), ==, "String 2");
+		g_assert(lf_ring_enqueue(r, "String 5"));
+		g_assert_cmpstr(lf_ring_dequeue(r), ==, "String 3");
+		g_assert_cmpstr(lf_ring_dequeue(r), ==, "String 4");
+		g_assert_cmpstr(lf_ring_dequeue(r), ==, "String 5");
+		g_assert(!lf_ring_dequeue(r));
+	}
+
+	lf_ring_unref(r);
+}
+
+typedef struct {
+	LfRing          *r;
+	gint             n_items;
+	volatile gint    n_consumed;
+	volatile gint64  sum;
+} RingProducerConsumerData;
+
+static gpointer
+test_LfRing_threaded_producer_consumer_producer(gpointer data)
+{
+	RingProducerConsumerData *pc = data;
+	gint i;
+
+	for (i = 1; i <= pc->n_items; i++) {
+		while (!lf_ring_enqueue(pc->r, GINT_TO_POINTER(i)))
+			g_thread_yield();
+	}
+
+	return NULL;
+}
+
+static gpointer
+test_LfRing_threaded_producer_consumer_consumer(gpointer data)
+{
+	RingProducerConsumerData *pc = data;
+	gpointer item;
+
+	while (lf_atomic_load(&pc->n_consumed, memory_order_relaxed) <
+	       pc->n_items * 2) {
+		if (!(item = lf_ring_dequeue(pc->r))) {
+			g_thread_yield();
+			continue;
+		}
+		lf_atomic_add_fetch(&pc->sum, GPOINTER_TO_INT(item),
+		                    memory_order_relaxed);
+		g_atomic_int_inc(&pc->n_consumed);
+	}
+
+	return NULL;
+}
+
+/*
+ * Two producers and two consumers share a ring much smaller than the number
+ * of items so that producers regularly find it full.
+ */
+static void
+test_LfRing_threaded_producer_consumer(void)
+{
+	RingProducerConsumerData pc = { 0 };
+	GThread *threads[4];
+	gint i;
+
+	pc.r = lf_ring_new(64);
+	pc.n_items = g_test_perf() ? 1000000 : 100000;
+
+	threads[0] = g_thread_create(test_LfRing_threaded_producer_consumer_producer,
+	                             &pc, TRUE, NULL);
+	threads[1] = g_thread_create(test_LfRing_threaded_producer_consumer_producer,
+	                             &pc, TRUE, NULL);
+	threads[2] = g_thread_create(test_LfRing_threaded_producer_consumer_consumer,
+	                             &pc, TRUE, NULL);
+	threads[3] = g_thread_create(test_LfRing_threaded_producer_consumer_consumer,
+	                             &pc, TRUE, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+
+	g_assert_cmpint(pc.n_consumed, ==, pc.n_items * 2);
+	g_assert_cmpint(pc.sum, ==, (gint64)pc.n_items * (pc.n_items + 1));
+	g_assert(!lf_ring_dequeue(pc.r));
+
+	lf_ring_unref(pc.r);
+}
+
+static void
+test_LfSpscQueue_basic(void)
+{
+	LfSpscQueue *q;
+	gpointer items[8];
+	gint i;
+
+	q = lf_spsc_queue_new(3);
+	g_assert(q);
+	g_assert_cmpint(lf_spsc_queue_get_capacity(q), ==, 4);
+	g_assert(!lf_spsc_queue_dequeue(q));
+
+	/*
+	 * Go around the ring a few times so the positions wrap the mask.
+	 */
+	for (i = 0; i < 3; i++) {
+		g_assert(lf_spsc_queue_enqueue(q, "String 1"));
+		g_assert(lf_spsc_queue_enqueue(q, "String 2"));
+		g_assert(lf_spsc_queue_enqueue(q, "String 3"));
+		g_assert(lf_spsc_queue_enqueue(q, "String 4"));
+		g_assert(!lf_spsc_queue_enqueue(q, "String 5"));
+		g_assert_cmpint(lf_spsc_queue_get_length_approx(q), ==, 4);
+
+		g_assert_cmpstr(lf_spsc_queue_dequeue(q), ==, "String 1");
+		g_assert_cmpstr(lf_spsc_queue_dequeue(q), ==, "String 2");
+		g_assert(lf_spsc_queue_enqueue(q, "String 5"));
+		g_assert_cmpstr(lf_spsc_queue_dequeue(q), ==, "String 3");
+		g_assert_cmpstr(lf_spsc_queue_dequeue(q), ==, "String 4");
+		g_assert_cmpstr(lf_spsc_queue_dequeue(q), ==, "String 5");
+		g_assert(!lf_spsc_queue_dequeue(q));
+	}
+
+	/*
+	 * Batches are cut short by the free space and by the items present.
+	 */
+	for (i = 0; i < 6; i++)
+		items[i] = GINT_TO_POINTER(i + 1);
+	g_assert(lf_spsc_queue_enqueue(q, items[0]));
+	g_assert_cmpint(lf_spsc_queue_enqueue_many(q, items + 1, 5), ==, 3);
+	g_assert_cmpint(lf_spsc_queue_enqueue_many(q, items + 4, 2), ==, 0);
+	g_assert_cmpint(lf_spsc_queue_dequeue_many(q, items, 2), ==, 2);
+	g_assert_cmpint(lf_spsc_queue_dequeue_many(q, items + 2, 6), ==, 2);
+	for (i = 0; i < 4; i++)
+		g_assert_cmpint(GPOINTER_TO_INT(items[i]), ==, i + 1);
+	g_assert_cmpint(lf_spsc_queue_dequeue_many(q, items, 8), ==, 0);
+
+	lf_spsc_queue_unref(q);
+}
+
+typedef struct {
+	LfSpscQueue *q;
+	gint         n_items;
+} SpscProducerConsumerData;
+
+static gpointer
+test_LfSpscQueue_threaded_producer(gpointer data)
+{
+	SpscProducerConsumerData *pc = data;
+	gpointer items[7];
+	gint i, j, n;
+
+	/*
+	 * Alternate single items and odd sized batches so that both paths
+	 * meet the consumer's.
+	 */
+	for (i = 1; i <= pc->n_items; ) {
+		if (i % 2) {
+			while (!lf_spsc_queue_enqueue(pc->q, GINT_TO_POINTER(i)))
+				g_thread_yield();
+			i++;
+			continue;
+		}
+		n = MIN(G_N_ELEMENTS(items), pc->n_items - i + 1);
+		for (j = 0; j < n; j++)
+			items[j] = GINT_TO_POINTER(i + j);
+		i += lf_spsc_queue_enqueue_many(pc->q, items, n);
+		if (i % 2 == 0)
+			g_thread_yield();
+	}
+
+	return NULL;
+}
+
+/*
+ * One producer and one consumer share a queue much smaller than the number
+ * of items.  The consumer checks that every item arrives in order.
+ */
+static void
+test_LfSpscQueue_threaded(void)
+{
+	SpscProducerConsumerData pc = { 0 };
+	GThread *producer;
+	gpointer items[5];
+	gint expected = 1, i, n;
+
+	pc.q = lf_spsc_queue_new(64);
+	pc.n_items = g_test_perf() ? 1000000 : 100000;
+
+	producer = g_thread_create(test_LfSpscQueue_threaded_producer, &pc,
+	                           TRUE, NULL);
+
+	while (expected <= pc.n_items) {
+		if (expected % 3) {
+			if ((items[0] = lf_spsc_queue_dequeue(pc.q)))
+				n = 1;
+			else
+				n = 0;
+		} else {
+			n = lf_spsc_queue_dequeue_many(pc.q, items,
+			                               G_N_ELEMENTS(items));
+		}
+		if (!n)
+			g_thread_yield();
+		for (i = 0; i < n; i++)
+			g_assert_cmpint(GPOINTER_TO_INT(items[i]), ==, expected++);
+	}
+
+	g_thread_join(producer);
+	g_assert(!lf_spsc_queue_dequeue(pc.q));
+	lf_spsc_queue_unref(pc.q);
+}
+
+static void
+test_LfMpscQueue_basic(void)
+{
+	LfMpscQueue *q;
+	gpointer items[3];
+
+	q = lf_mpsc_queue_new();
+	g_assert(q);
+	g_assert(!lf_mpsc_queue_dequeue(q));
+
+	lf_mpsc_queue_enqueue(q, "String 1");
+	lf_mpsc_queue_enqueue(q, "String 2");
+	items[0] = (gpointer)"String 3";
+	items[1] = (gpointer)"String 4";
+	items[2] = (gpointer)"String 5";
+	lf_mpsc_queue_enqueue_many(q, items, 3);
+	lf_mpsc_queue_enqueue_many(q, items, 0);
+
+	g_assert_cmpstr(lf_mpsc_queue_dequeue(q), ==, "String 1");
+	g_assert_cmpint(lf_mpsc_queue_dequeue_many(q, items, 3), ==, 3);
+	g_assert_cmpstr(items[0], ==, "String 2");
+	g_assert_cmpstr(items[1], ==, "String 3");
+	g_assert_cmpstr(items[2], ==, "String 4");
+	g_assert_cmpint(lf_mpsc_queue_dequeue_many(q, items, 3), ==, 1);
+	g_assert_cmpstr(items[0], ==, "String 5");
+	g_assert(!lf_mpsc_queue_dequeue(q));
+
+	/*
+	 * Items left behind are not ours to free, but the nodes are.
+	 */
+	lf_mpsc_queue_enqueue(q, "String 6");
+	lf_mpsc_queue_unref(q);
+}
+
+#define MPSC_PRODUCERS (3)
+
+typedef struct {
+	LfMpscQueue *q;
+	gint         n_items;
+	gint         id;
+} MpscProducerData;
+
+static gpointer
+test_LfMpscQueue_threaded_producer(gpointer data)
+{
+	MpscProducerData *p = data;
+	gpointer items[4];
+	gint i, j;
+
+	for (i = 1; i <= p->n_items; ) {
+		if (i % 5) {
+			lf_mpsc_queue_enqueue(p->q, GINT_TO_POINTER((p->id << 24) | i));
+			i++;
+			continue;
+		}
+		for (j = 0; j < G_N_ELEMENTS(items) && i <= p->n_items; j++, i++)
+			items[j] = GINT_TO_POINTER((p->id << 24) | i);
+		lf_mpsc_queue_enqueue_many(p->q, items, j);
+	}
+
+	return NULL;
+}
+
+/*
+ * Several producers feed a single consumer, which checks that each
+ * producer's items arrive in the order it enqueued them.
+ */
+static void
+test_LfMpscQueue_threaded(void)
+{
+	MpscProducerData producers[MPSC_PRODUCERS];
+	GThread *threads[MPSC_PRODUCERS];
+	gint expected[MPSC_PRODUCERS];
+	gpointer items[8];
+	LfMpscQueue *q;
+	gint n_items, remaining, value, i, n;
+
+	q = lf_mpsc_queue_new();
+	n_items = g_test_perf() ? 1000000 : 100000;
+
+	for (i = 0; i < MPSC_PRODUCERS; i++) {
+		producers[i].q = q;
+		producers[i].n_items = n_items;
+		producers[i].id = i;
+		expected[i] = 1;
+		threads[i] = g_thread_create(test_LfMpscQueue_threaded_producer,
+		                             &producers[i], TRUE, NULL);
+	}
+
+	for (remaining = n_items * MPSC_PRODUCERS; remaining > 0; ) {
+		n = lf_mpsc_queue_dequeue_many(q, items, 1 + remaining % 8);
+		if (!n)
+			g_thread_yield();
+		for (i = 0; i < n; i++) {
+			value = GPOINTER_TO_INT(items[i]);
+			g_assert_cmpint(value & 0xffffff, ==, expected[value >> 24]++);
+		}
+		remaining -= n;
+	}
+
+	for (i = 0; i < MPSC_PRODUCERS; i++) {
+		g_thread_join(threads[i]);
+		g_assert_cmpint(expected[i], ==, n_items + 1);
+	}
+	g_assert(!lf_mpsc_queue_dequeue(q));
+
+	lf_mpsc_queue_unref(q);
+}
+
+typedef struct {
+	gint64        deadline;
+	volatile gint seen;
+} DelayItem;
+
+/*
+ * Checks that item is due and has not been handed out before.
+ */
+static void
+test_LfDelayQueue_check(DelayItem *item)
+{
+	g_assert_cmpint(item->deadline, <=, g_get_monotonic_time());
+	g_assert(g_atomic_int_compare_and_exchange(&item->seen, 0, 1));
+}
+
+static void
+test_LfDelayQueue_basic(void)
+{
+	LfDelayQueue *q;
+	DelayItem items[5] = { { 0 } };
+	DelayItem *item;
+	gint64 now, deadline;
+	gint n_seen = 0;
+
+	/*
+	 * Ten microsecond ticks put the later items in the upper levels and the
+	 * last one beyond the wheel altogether, so that it is parked.
+	 */
+	q = lf_delay_queue_new_with_resolution(10);
+	g_assert(q);
+
+	/*
+	 * The first item is a few ticks overdue, so it must come out at once.
+	 */
+	now = g_get_monotonic_time();
+	items[0].deadline = now - 100;
+	items[1].deadline = now + 300;
+	items[2].deadline = now + G_USEC_PER_SEC / 200;
+	items[3].deadline = now + G_USEC_PER_SEC / 20;
+	items[4].deadline = now + G_GINT64_CONSTANT(3600) * G_USEC_PER_SEC;
+	lf_delay_queue_enqueue_at(q, &items[4], items[4].deadline);
+	lf_delay_queue_enqueue_at(q, &items[3], items[3].deadline);
+	lf_delay_queue_enqueue_at(q, &items[1], items[1].deadline);
+	lf_delay_queue_enqueue_at(q, &items[2], items[2].deadline);
+	lf_delay_queue_enqueue_at(q, &items[0], items[0].deadline);
+
+	g_assert(lf_delay_queue_dequeue_ready(q) == &items[0]);
+	items[0].seen = TRUE;
+	n_seen++;
+
+	deadline = now + G_USEC_PER_SEC * 5;
+	while (n_seen < 4 && g_get_monotonic_time() < deadline) {
+		if (!(item = lf_delay_queue_dequeue_ready(q))) {
+			g_usleep(100);
+			continue;
+		}
+		test_LfDelayQueue_check(item);
+		n_seen++;
+	}
+	g_assert_cmpint(n_seen, ==, 4);
+	g_assert(!items[4].seen);
+	g_assert(!lf_delay_queue_dequeue_ready(q));
+
+	lf_delay_queue_unref(q);
+}
+
+#define DELAY_THREADS (2)
+
+typedef struct {
+	LfDelayQueue  *q;
+	DelayItem     *items;
+	gint           n_items;
+	volatile gint  n_seen;
+	volatile gint  next_producer;
+} DelayData;
+
+static gpointer
+test_LfDelayQueue_threaded_producer(gpointer data)
+{
+	DelayData *dd = data;
+	DelayItem *item;
+	gint id, i;
+
+	id = g_atomic_int_exchange_and_add(&dd->next_producer, 1);
+	for (i = id; i < dd->n_items; i += DELAY_THREADS) {
+		item = &dd->items[i];
+		item->deadline = g_get_monotonic_time() + (i * 7919) % 20000;
+		lf_delay_queue_enqueue_at(dd->q, item, item->deadline);
+	}
+
+	return NULL;
+}
+
+static gpointer
+test_LfDelayQueue_threaded_consumer(gpointer data)
+{
+	DelayData *dd = data;
+	gpointer items[16];
+	guint n, i;
+
+	while (lf_atomic_load(&dd->n_seen, memory_order_relaxed) <
+	       dd->n_items) {
+		n = lf_delay_queue_dequeue_ready_many(dd->q, items,
+		                                      G_N_ELEMENTS(items));
+		if (!n)
+			g_usleep(50);
+		for (i = 0; i < n; i++)
+			test_LfDelayQueue_check(items[i]);
+		g_atomic_int_add(&dd->n_seen, n);
+	}
+
+	return NULL;
+}
+
+/*
+ * Producers and consumers race while the wheel turns under them.  Every
+ * item has to come out exactly once, and never before its deadline.
+ */
+static void
+test_LfDelayQueue_threaded(void)
+{
+	DelayData dd = { 0 };
+	GThread *threads[DELAY_THREADS * 2];
+	gint i;
+
+	dd.q = lf_delay_queue_new_with_resolution(100);
+	dd.n_items = g_test_perf() ? 1000000 : 20000;
+	dd.items = g_new0(DelayItem, dd.n_items);
+
+	for (i = 0; i < DELAY_THREADS; i++) {
+		threads[i * 2] = g_thread_create(test_LfDelayQueue_threaded_producer,
+		                                 &dd, TRUE, NULL);
+		threads[i * 2 + 1] = g_thread_create(test_LfDelayQueue_threaded_consumer,
+		                                     &dd, TRUE, NULL);
+	}
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+
+	g_assert_cmpint(dd.n_seen, ==, dd.n_items);
+	for (i = 0; i < dd.n_items; i++)
+		g_assert(dd.items[i].seen);
+	g_assert(!lf_delay_queue_dequeue_ready(dd.q));
+
+	lf_delay_queue_unref(dd.q);
+	g_free(dd.items);
+}
+
+static void
+test_LfStack_basic(void)
+{
+	LfStack *s;
+
+	s = lf_stack_new();
+	g_assert(s);
+	g_assert(!lf_stack_pop(s));
+
+	lf_stack_push(s, "String 1");
+	lf_stack_push(s, "String 2");
+	lf_stack_push(s, "String 3");
+
+	g_assert_cmpstr(lf_stack_pop(s), ==, "String 3");
+	lf_stack_push(s, "String 4");
+	g_assert_cmpstr(lf_stack_pop(s), ==, "String 4");
+	g_assert_cmpstr(lf_stack_pop(s), ==, "String 2");
+	g_assert_cmpstr(lf_stack_pop(s), ==, "String 1");
+	g_assert(!lf_stack_pop(s));
+
+	lf_stack_push(s, "String 5");
+	lf_stack_unref(s);
+}
+
+typedef struct {
+	LfStack       *s;
+	gint           n_items;
+	volatile gint  n_popped;
+	volatile gint  sum;
+} StackPushPopData;
+
+static gpointer
+test_LfStack_threaded_push_pop_thread_func(gpointer data)
+{
+	StackPushPopData *pp = data;
+	gpointer item;
+	gint i;
+
+	for (i = 1; i <= pp->n_items; i++) {
+		lf_stack_push(pp->s, GINT_TO_POINTER(i));
+		if ((item = lf_stack_pop(pp->s))) {
+			g_atomic_int_add(&pp->sum, GPOINTER_TO_INT(item));
+			g_atomic_int_inc(&pp->n_popped);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+test_LfStack_threaded_push_pop(void)
+{
+	StackPushPopData pp = { 0 };
+	GThread *threads[4];
+	gpointer item;
+	gint i;
+
+	pp.s = lf_stack_new();
+	pp.n_items = 20000;
+
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		threads[i] = g_thread_create(test_LfStack_threaded_push_pop_thread_func,
+		                             &pp, TRUE, NULL);
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+
+	while ((item = lf_stack_pop(pp.s))) {
+		pp.sum += GPOINTER_TO_INT(item);
+		pp.n_popped++;
+	}
+
+	g_assert_cmpint(pp.n_popped, ==, pp.n_items * G_N_ELEMENTS(threads));
+	g_assert_cmpint(pp.sum, ==,
+	                G_N_ELEMENTS(threads) * pp.n_items * (pp.n_items + 1) / 2);
+
+	lf_stack_unref(pp.s);
+}
+
+static void
+test_LfHashMap_basic(void)
+{
+	LfHashMap *map;
+	gpointer value;
+	gint i;
+
+	map = lf_hash_map_new(g_str_hash, g_str_equal);
+	g_assert(map);
+	g_assert(!lf_hash_map_lookup(map, "a"));
+
+	g_assert(lf_hash_map_insert(map, "a", "1"));
+	g_assert(lf_hash_map_insert(map, "b", "2"));
+	g_assert(!lf_hash_map_insert(map, "a", "3"));
+	g_assert_cmpint(lf_hash_map_size(map), ==, 2);
+	g_assert_cmpstr(lf_hash_map_lookup(map, "a"), ==, "1");
+	g_assert_cmpstr(lf_hash_map_lookup(map, "b"), ==, "2");
+
+	g_assert_cmpstr(lf_hash_map_remove(map, "a"), ==, "1");
+	g_assert(!lf_hash_map_remove(map, "a"));
+	g_assert(!lf_hash_map_lookup(map, "a"));
+	g_assert_cmpint(lf_hash_map_size(map), ==, 1);
+	lf_hash_map_unref(map);
+
+	/*
+	 * Enough items to grow the bucket table many times over.
+	 */
+	map = lf_hash_map_new(g_direct_hash, g_direct_equal);
+	for (i = 0; i < 10000; i++)
+		g_assert(lf_hash_map_insert(map, GINT_TO_POINTER(i),
+		                            GINT_TO_POINTER(i + 1)));
+	g_assert_cmpint(lf_hash_map_size(map), ==, 10000);
+	for (i = 0; i < 10000; i++) {
+		value = lf_hash_map_lookup(map, GINT_TO_POINTER(i));
+		g_assert_cmpint(GPOINTER_TO_INT(value), ==, i + 1);
+	}
+	for (i = 0; i < 10000; i += 2)
+		g_assert(lf_hash_map_remove(map, GINT_TO_POINTER(i)));
+	for (i = 0; i < 10000; i++) {
+		value = lf_hash_map_lookup(map, GINT_TO_POINTER(i));
+		g_assert((value != NULL) == (i % 2));
+	}
+	g_assert_cmpint(lf_hash_map_size(map), ==, 5000);
+	lf_hash_map_unref(map);
+}
+
+typedef struct {
+	LfHashMap     *map;
+	gint           n_items;
+	volatile gint  next_id;
+} HashMapThreadedData;
+
+static gpointer
+test_LfHashMap_threaded_thread_func(gpointer data)
+{
+	HashMapThreadedData *hd = data;
+	gpointer key, value;
+	gint id, base, i;
+
+	id = g_atomic_int_exchange_and_add(&hd->next_id, 1);
+	base = id * hd->n_items;
+
+	/*
+	 * Each thread owns its range of keys but shares the buckets, and
+	 * reads the other threads' ranges while they change.
+	 */
+	for (i = 1; i <= hd->n_items; i++) {
+		key = GINT_TO_POINTER(base + i);
+		g_assert(lf_hash_map_insert(hd->map, key, key));
+		key = GINT_TO_POINTER((base + i * 7) % (4 * hd->n_items));
+		lf_hash_map_lookup(hd->map, key);
+	}
+	for (i = 1; i <= hd->n_items; i += 2) {
+		key = GINT_TO_POINTER(base + i);
+		g_assert(lf_hash_map_remove(hd->map, key) == key);
+	}
+	for (i = 1; i <= hd->n_items; i++) {
+		value = lf_hash_map_lookup(hd->map, GINT_TO_POINTER(base + i));
+		g_assert((value != NULL) == !(i % 2));
+	}
+
+	return NULL;
+}
+
+static void
+test_LfHashMap_threaded(void)
+{
+	HashMapThreadedData hd = { 0 };
+	GThread *threads[4];
+	gint i;
+
+	hd.map = lf_hash_map_new(g_direct_hash, g_direct_equal);
+	hd.n_items = 10000;
+
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		threads[i] = g_thread_create(test_LfHashMap_threaded_thread_func,
+		                             &hd, TRUE, NULL);
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+
+	g_assert_cmpint(lf_hash_map_size(hd.map), ==,
+	                G_N_ELEMENTS(threads) * hd.n_items / 2);
+
+	lf_hash_map_unref(hd.map);
+}
+
+static void
+test_LfDeque_basic(void)
+{
+	LfDeque *d;
+	gint i;
+
+	d = lf_deque_new();
+	g_assert(d);
+	g_assert(lf_deque_is_empty(d));
+	g_assert(!lf_deque_pop(d));
+	g_assert(!lf_deque_steal(d));
+
+	lf_deque_push(d, "String 1");
+	lf_deque_push(d, "String 2");
+	lf_deque_push(d, "String 3");
+	g_assert(!lf_deque_is_empty(d));
+
+	g_assert_cmpstr(lf_deque_pop(d), ==, "String 3");
+	g_assert_cmpstr(lf_deque_steal(d), ==, "String 1");
+	g_assert_cmpstr(lf_deque_pop(d), ==, "String 2");
+	g_assert(!lf_deque_pop(d));
+	g_assert(!lf_deque_steal(d));
+
+	/*
+	 * Enough items to grow the array a few times.
+	 */
+	for (i = 1; i <= 1000; i++)
+		lf_deque_push(d, GINT_TO_POINTER(i));
+	g_assert_cmpint(GPOINTER_TO_INT(lf_deque_steal(d)), ==, 1);
+	for (i = 1000; i > 1; i--)
+		g_assert_cmpint(GPOINTER_TO_INT(lf_deque_pop(d)), ==, i);
+	g_assert(lf_deque_is_empty(d));
+
+	lf_deque_push(d, "String 4");
+	lf_deque_unref(d);
+}
+
+typedef struct {
+	LfDeque       *d;
+	gint           n_items;
+	volatile gint  done;
+	volatile gint  n_taken;
+	volatile gint  sum;
+} DequeStealData;
+
+static gpointer
+test_LfDeque_threaded_steal_thread_func(gpointer data)
+{
+	DequeStealData *ds = data;
+	gpointer item;
+
+	while (!lf_atomic_load(&ds->done, memory_order_acquire) ||
+	       !lf_deque_is_empty(ds->d)) {
+		if ((item = lf_deque_steal(ds->d))) {
+			g_atomic_int_add(&ds->sum, GPOINTER_TO_INT(item));
+			g_atomic_int_inc(&ds->n_taken);
+		}
+		else
+			g_thread_yield();
+	}
+
+	return NULL;
+}
+
+static void
+test_LfDeque_threaded_steal(void)
+{
+	DequeStealData ds = { 0 };
+	GThread *threads[3];
+	gpointer item;
+	gint i;
+
+	ds.d = lf_deque_new();
+	ds.n_items = 50000;
+
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		threads[i] = g_thread_create(test_LfDeque_threaded_steal_thread_func,
+		                             &ds, TRUE, NULL);
+
+	/*
+	 * Push in bursts so the array grows while thieves are reading it, and
+	 * pop every third item so the owner races them for the last one.
+	 */
+	for (i = 1; i <= ds.n_items; i++) {
+		lf_deque_push(ds.d, GINT_TO_POINTER(i));
+		if (i % 3 == 0 && (item = lf_deque_pop(ds.d))) {
+			g_atomic_int_add(&ds.sum, GPOINTER_TO_INT(item));
+			g_atomic_int_inc(&ds.n_taken);
+		}
+	}
+	lf_atomic_store(&ds.done, TRUE, memory_order_release);
+
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+
+	g_assert(!lf_deque_pop(ds.d));
+	g_assert_cmpint(ds.n_taken, ==, ds.n_items);
+	g_assert_cmpint(ds.sum, ==, ds.n_items / 2 * (ds.n_items + 1));
+
+	lf_deque_unref(ds.d);
+}
+
+static void
+test_LfExecutor_basic_func(gpointer data,
+                           gpointer user_data)
+{
+	g_atomic_int_add((volatile gint *)user_data, GPOINTER_TO_INT(data));
+}
+
+static void
+test_LfExecutor_basic(void)
+{
+	LfExecutor *e;
+	volatile gint sum = 0;
+	gint i;
+
+	e = lf_executor_new(test_LfExecutor_basic_func, (gpointer)&sum, 4);
+	g_assert(e);
+	g_assert_cmpint(lf_executor_get_n_workers(e), ==, 4);
+
+	for (i = 1; i <= 10000; i++)
+		lf_executor_push(e, GINT_TO_POINTER(i));
+	lf_executor_free(e);
+
+	g_assert_cmpint(sum, ==, 10000 * 10001 / 2);
+}
+
+typedef struct {
+	LfExecutor    *e;
+	volatile gint  n_tasks;
+} ExecutorSpawnData;
+
+/*
+ * Each task of depth n pushes two of depth n - 1 from within the worker, so
+ * a task of depth n expands into 2^(n+1) - 1 tasks in total.
+ */
+static void
+test_LfExecutor_spawn_func(gpointer data,
+                           gpointer user_data)
+{
+	ExecutorSpawnData *sd = user_data;
+	gint depth = GPOINTER_TO_INT(data) - 1;
+
+	g_atomic_int_inc(&sd->n_tasks);
+	if (depth > 0) {
+		lf_executor_push(sd->e, GINT_TO_POINTER(depth));
+		lf_executor_push(sd->e, GINT_TO_POINTER(depth));
+	}
+}
+
+static void
+test_LfExecutor_spawn(void)
+{
+	ExecutorSpawnData sd = { 0 };
+	gint i;
+
+	sd.e = lf_executor_new(test_LfExecutor_spawn_func, &sd, 4);
+	for (i = 0; i < 4; i++)
+		lf_executor_push(sd.e, GINT_TO_POINTER(14 + 1));
+	lf_executor_free(sd.e);
+
+	g_assert_cmpint(sd.n_tasks, ==, 4 * ((1 << 15) - 1));
+}
+
+typedef struct {
+	gint           value;
+	volatile gint  ref_count;
+	LfQueueLink    link;
+} IQueueMsg;
+
+static volatile gint iqueue_n_freed = 0;
+
+static IQueueMsg*
+iqueue_msg_new(gint value)
+{
+	IQueueMsg *msg;
+
+	msg = g_slice_new0(IQueueMsg);
+	msg->value = value;
+	msg->ref_count = 2; /* One for the consumer, one for the queue */
+
+	return msg;
+}
+
+static void
+iqueue_msg_unref(IQueueMsg *msg)
+{
+	if (g_atomic_int_dec_and_test(&msg->ref_count)) {
+		g_slice_free(IQueueMsg, msg);
+		g_atomic_int_inc(&iqueue_n_freed);
+	}
+}
+
+static void
+iqueue_msg_reclaim(gpointer data)
+{
+	iqueue_msg_unref(LF_QUEUE_LINK_ENTRY(data, IQueueMsg, link));
+}
+
+static void
+test_LfIQueue_basic(void)
+{
+	LfIQueue *q;
+	LfQueueLink *link;
+	IQueueMsg *msg;
+	gint i;
+
+	iqueue_n_freed = 0;
+	q = lf_iqueue_new(iqueue_msg_reclaim);
+	g_assert(q);
+	g_assert(!lf_iqueue_dequeue(q));
+
+	for (i = 1; i <= 3; i++)
+		lf_iqueue_enqueue(q, &iqueue_msg_new(i)->link);
+
+	for (i = 1; i <= 3; i++) {
+		link = lf_iqueue_dequeue(q);
+		g_assert(link);
+		msg = LF_QUEUE_LINK_ENTRY(link, IQueueMsg, link);
+		g_assert_cmpint(msg->value, ==, i);
+		iqueue_msg_unref(msg);
+	}
+	g_assert(!lf_iqueue_dequeue(q));
+
+	/*
+	 * Links still in the queue are reclaimed along with it.  The consumer
+	 * reference of the last one is never dropped, so it is not freed.
+	 */
+	msg = iqueue_msg_new(4);
+	lf_iqueue_enqueue(q, &msg->link);
+	lf_iqueue_unref(q);
+
+	g_assert_cmpint(msg->ref_count, ==, 1);
+	iqueue_msg_unref(msg);
+
+	lf_hazard_collect(lf_hazard_get(lf_hazard_domain_get_default()));
+	g_assert_cmpint(iqueue_n_freed, ==, 4);
+}
+
+typedef struct {
+	LfIQueue        *q;
+	gint             n_items;
+	volatile gint    n_consumed;
+	volatile gint64  sum;
+} IQueueData;
+
+static gpointer
+test_LfIQueue_threaded_producer(gpointer data)
+{
+	IQueueData *iq = data;
+	gint i;
+
+	for (i = 1; i <= iq->n_items; i++)
+		lf_iqueue_enqueue(iq->q, &iqueue_msg_new(i)->link);
+
+	return NULL;
+}
+
+static gpointer
+test_LfIQueue_threaded_consumer(gpointer data)
+{
+	IQueueData *iq = data;
+	LfQueueLink *link;
+	IQueueMsg *msg;
+
+	while (lf_atomic_load(&iq->n_consumed, memory_order_relaxed) <
+	       iq->n_items * 2) {
+		if (!(link = lf_iqueue_dequeue(iq->q))) {
+			g_thread_yield();
+			continue;
+		}
+		msg = LF_QUEUE_LINK_ENTRY(link, IQueueMsg, link);
+		lf_atomic_add_fetch(&iq->sum, msg->value, memory_order_relaxed);
+		g_atomic_int_inc(&iq->n_consumed);
+		iqueue_msg_unref(msg);
+	}
+
+	return NULL;
+}
+
+/*
+ * Every message is freed by whichever of the consumer and the reclaim
+ * callback lets go of it last.  Once the queue and all threads are gone,
+ * every message must have been freed exactly once.
+ */
+static void
+test_LfIQueue_threaded(void)
+{
+	IQueueData iq = { 0 };
+	GThread *threads[4];
+	gint i;
+
+	iqueue_n_freed = 0;
+	iq.q = lf_iqueue_new(iqueue_msg_reclaim);
+	iq.n_items = 50000;
+
+	threads[0] = g_thread_create(test_LfIQueue_threaded_producer, &iq,
+	                             TRUE, NULL);
+	threads[1] = g_thread_create(test_LfIQueue_threaded_producer, &iq,
+	                             TRUE, NULL);
+	threads[2] = g_thread_create(test_LfIQueue_threaded_consumer, &iq,
+	                             TRUE, NULL);
+	threads[3] = g_thread_create(test_LfIQueue_threaded_consumer, &iq,
+	                             TRUE, NULL);
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+
+	g_assert_cmpint(iq.n_consumed, ==, iq.n_items * 2);
+	g_assert_cmpint(iq.sum, ==, (gint64)iq.n_items * (iq.n_items + 1));
+	g_assert(!lf_iqueue_dequeue(iq.q));
+	lf_iqueue_unref(iq.q);
+
+	/*
+	 * Reclaim whatever retired links the exited threads left behind.
+	 */
+	lf_hazard_collect(lf_hazard_get(lf_hazard_domain_get_default()));
+	g_assert_cmpint(iqueue_n_freed, ==, iq.n_items * 2);
+}
+
+/*
+ * Scrambles value into a key so that items go in out of order.
+ */
+static gint64
+pqueue_key(gint value)
+{
+	return (value * G_GINT64_CONSTANT(2654435761)) % 1000003;
+}
+
+static void
+test_LfPriorityQueue_basic(void)
+{
+	LfPriorityQueue *q;
+	gint64 key, last;
+	gint i;
+
+	q = lf_priority_queue_new();
+	g_assert(!lf_priority_queue_delete_min(q, NULL));
+
+	/*
+	 * Enough items for the deleted prefix to be unlinked several times.
+	 */
+	for (i = 1; i <= 1000; i++)
+		lf_priority_queue_insert(q, pqueue_key(i), GINT_TO_POINTER(i));
+	last = -1;
+	for (i = 1; i <= 500; i++) {
+		g_assert_cmpint(pqueue_key(GPOINTER_TO_INT(
+			lf_priority_queue_delete_min(q, &key))), ==, key);
+		g_assert_cmpint(key, >, last);
+		last = key;
+	}
+
+	/*
+	 * An item with a lower key than some deleted ones goes in after them
+	 * and comes out next.
+	 */
+	lf_priority_queue_insert(q, 0, "String");
+	g_assert_cmpstr(lf_priority_queue_delete_min(q, &key), ==, "String");
+	g_assert_cmpint(key, ==, 0);
+
+	for (i = 501; i <= 1000; i++) {
+		g_assert(lf_priority_queue_delete_min(q, &key));
+		g_assert_cmpint(key, >, last);
+		last = key;
+	}
+	g_assert(!lf_priority_queue_delete_min(q, NULL));
+
+	/*
+	 * Items still in the queue are freed along with it.
+	 */
+	lf_priority_queue_insert(q, 1, "String");
+	lf_priority_queue_unref(q);
+}
+
+typedef struct {
+	LfPriorityQueue *q;
+	gint             n_items;
+	volatile gint    n_producers;
+	volatile gint    n_consumed;
+	volatile gint    sum;
+} PQueueData;
+
+static gpointer
+test_LfPriorityQueue_threaded_producer(gpointer data)
+{
+	PQueueData *pq = data;
+	gint i, base;
+
+	base = g_atomic_int_exchange_and_add(&pq->n_producers, 1) * pq->n_items;
+	for (i = base + 1; i <= base + pq->n_items; i++)
+		lf_priority_queue_insert(pq->q, pqueue_key(i), GINT_TO_POINTER(i));
+
+	return NULL;
+}
+
+static gpointer
+test_LfPriorityQueue_threaded_consumer(gpointer data)
+{
+	PQueueData *pq = data;
+	gpointer item;
+	gint64 key;
+
+	while (lf_atomic_load(&pq->n_consumed, memory_order_relaxed) <
+	       pq->n_items * 2) {
+		if (!(item = lf_priority_queue_delete_min(pq->q, &key))) {
+			g_thread_yield();
+			continue;
+		}
+		g_assert_cmpint(pqueue_key(GPOINTER_TO_INT(item)), ==, key);
+		g_atomic_int_add(&pq->sum, GPOINTER_TO_INT(item));
+		g_atomic_int_inc(&pq->n_consumed);
+	}
+
+	return NULL;
+}
+
+/*
+ * Every item inserted must be removed exactly once, along with its own key.
+ */
+static void
+test_LfPriorityQueue_threaded(void)
+{
+	PQueueData pq = { 0 };
+	GThread *threads[4];
+	gint i;
+
+	pq.q = lf_priority_queue_new();
+	pq.n_items = 20000;
+
+	threads[0] = g_thread_create(test_LfPriorityQueue_threaded_producer, &pq,
+	                             TRUE, NULL);
+	threads[1] = g_thread_create(test_LfPriorityQueue_threaded_producer, &pq,
+	                             TRUE, NULL);
+	threads[2] = g_thread_create(test_LfPriorityQueue_threaded_consumer, &pq,
+	                             TRUE, NULL);
+	threads[3] = g_thread_create(test_LfPriorityQueue_threaded_consumer, &pq,
+	                             TRUE, NULL);
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+
+	g_assert_cmpint(pq.n_consumed, ==, pq.n_items * 2);
+	g_assert_cmpint(pq.sum, ==, pq.n_items * (pq.n_items * 2 + 1));
+	g_assert(!lf_priority_queue_delete_min(pq.q, NULL));
+	lf_priority_queue_unref(pq.q);
+}
+
+static void
+test_LfShardedQueue_basic(void)
+{
+	LfShardedQueue *q;
+	gint i;
+
+	q = lf_sharded_queue_new(0, LF_SHARDED_QUEUE_NONE);
+	g_assert(q);
+	g_assert_cmpint(lf_sharded_queue_get_n_lanes(q), ==, get_num_cpu());
+	lf_sharded_queue_unref(q);
+
+	/*
+	 * A single thread always uses the same lane with lane ordering, so
+	 * everything comes back out in order.
+	 */
+	q = lf_sharded_queue_new(4, LF_SHARDED_QUEUE_LANE_ORDER);
+	g_assert_cmpint(lf_sharded_queue_get_n_lanes(q), ==, 4);
+	g_assert(!lf_sharded_queue_dequeue(q));
+	g_assert_cmpint(lf_sharded_queue_get_length_approx(q), ==, 0);
+
+	for (i = 1; i <= 100; i++)
+		lf_sharded_queue_enqueue(q, GINT_TO_POINTER(i));
+	g_assert_cmpint(lf_sharded_queue_get_length_approx(q), ==, 100);
+	for (i = 1; i <= 60; i++)
+		g_assert_cmpint(GPOINTER_TO_INT(lf_sharded_queue_dequeue(q)), ==, i);
+	g_assert_cmpint(lf_sharded_queue_get_length_approx(q), ==, 40);
+
+	lf_sharded_queue_enqueue(q, "String 1");
+	lf_sharded_queue_unref(q);
+}
+
+typedef struct {
+	LfShardedQueue *q;
+	gint            n_items;
+	volatile gint   n_producer;
+	volatile gint   n_done;
+} ShardedQueueData;
+
+static gpointer
+test_LfShardedQueue_threaded_producer(gpointer data)
+{
+	ShardedQueueData *sq = data;
+	gint id, i;
+
+	id = g_atomic_int_exchange_and_add(&sq->n_producer, 1);
+	for (i = 1; i <= sq->n_items; i++)
+		lf_sharded_queue_enqueue(sq->q, GINT_TO_POINTER((id << 20) | i));
+	g_atomic_int_inc(&sq->n_done);
+
+	return NULL;
+}
+
+/*
+ * Producers each stick to a lane, so a single consumer has to see the items
+ * of every producer in order even though they interleave arbitrarily.
+ */
+static void
+test_LfShardedQueue_threaded_lane_order(void)
+{
+	ShardedQueueData sq = { 0 };
+	GThread *threads[4];
+	gint last[G_N_ELEMENTS(threads)] = { 0 };
+	gpointer item;
+	gboolean done;
+	gint i, id, seq, n_consumed = 0;
+
+	sq.q = lf_sharded_queue_new(3, LF_SHARDED_QUEUE_LANE_ORDER);
+	sq.n_items = 50000;
+
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		threads[i] = g_thread_create(test_LfShardedQueue_threaded_producer,
+		                             &sq, TRUE, NULL);
+
+	while (TRUE) {
+		done = (g_atomic_int_get(&sq.n_done) == G_N_ELEMENTS(threads));
+		if (!(item = lf_sharded_queue_dequeue(sq.q))) {
+			if (done)
+				break;
+			g_thread_yield();
+			continue;
+		}
+		id = GPOINTER_TO_INT(item) >> 20;
+		seq = GPOINTER_TO_INT(item) & ((1 << 20) - 1);
+		g_assert_cmpint(seq, ==, last[id] + 1);
+		last[id] = seq;
+		n_consumed++;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+
+	g_assert_cmpint(n_consumed, ==, sq.n_items * G_N_ELEMENTS(threads));
+	g_assert_cmpint(lf_sharded_queue_get_length_approx(sq.q), ==, 0);
+
+	lf_sharded_queue_unref(sq.q);
+}
+
 gint
 main(gint   argc,
      gchar *argv[])
@@ -136,8 +2059,52 @@ main(gint   argc,
 	g_thread_init(NULL);
 
 	g_test_add_func("/LfQueue/basic", test_LfQueue_basic);
+	g_test_add_func("/LfQueue/many", test_LfQueue_many);
+	g_test_add_func("/LfQueue/segment", test_LfQueue_segment);
 	g_test_add_func("/LfQueue/threaded_alternate_enq_deq",
 		            test_LfQueue_threaded_alternate_enq_deq);
+	g_test_add_func("/LfQueue/threaded_producer_consumer",
+	                test_LfQueue_threaded_producer_consumer);
+	g_test_add_func("/LfQueue/threaded_producer_consumer_many",
+	                test_LfQueue_threaded_producer_consumer_many);
+	g_test_add_func("/LfQueue/threaded_producer_consumer_epoch",
+	                test_LfQueue_threaded_producer_consumer_epoch);
+	g_test_add_func("/LfQueue/threaded_producer_consumer_segment",
+	                test_LfQueue_threaded_producer_consumer_segment);
+	g_test_add_func("/LfQueue/dequeue_wait", test_LfQueue_dequeue_wait);
+	g_test_add_func("/LfQueue/stats", test_LfQueue_stats);
+	g_test_add_func("/LfQueue/capacity", test_LfQueue_capacity);
+	g_test_add_func("/LfQueue/source", test_LfQueue_source);
+	g_test_add_func("/LfHazard/domain", test_LfHazard_domain);
+	g_test_add_func("/LfHazard/thread_exit", test_LfHazard_thread_exit);
+	g_test_add_func("/LfHazard/reclaimer", test_LfHazard_reclaimer);
+	g_test_add_func("/LfEpoch/basic", test_LfEpoch_basic);
+	g_test_add_func("/LfRing/basic", test_LfRing_basic);
+	g_test_add_func("/LfRing/threaded_producer_consumer",
+	                test_LfRing_threaded_producer_consumer);
+	g_test_add_func("/LfSpscQueue/basic", test_LfSpscQueue_basic);
+	g_test_add_func("/LfSpscQueue/threaded", test_LfSpscQueue_threaded);
+	g_test_add_func("/LfMpscQueue/basic", test_LfMpscQueue_basic);
+	g_test_add_func("/LfMpscQueue/threaded", test_LfMpscQueue_threaded);
+	g_test_add_func("/LfDelayQueue/basic", test_LfDelayQueue_basic);
+	g_test_add_func("/LfDelayQueue/threaded", test_LfDelayQueue_threaded);
+	g_test_add_func("/LfStack/basic", test_LfStack_basic);
+	g_test_add_func("/LfHashMap/basic", test_LfHashMap_basic);
+	g_test_add_func("/LfHashMap/threaded", test_LfHashMap_threaded);
+	g_test_add_func("/LfStack/threaded_push_pop",
+	                test_LfStack_threaded_push_pop);
+	g_test_add_func("/LfDeque/basic", test_LfDeque_basic);
+	g_test_add_func("/LfDeque/threaded_steal", test_LfDeque_threaded_steal);
+	g_test_add_func("/LfExecutor/basic", test_LfExecutor_basic);
+	g_test_add_func("/LfExecutor/spawn", test_LfExecutor_spawn);
+	g_test_add_func("/LfIQueue/basic", test_LfIQueue_basic);
+	g_test_add_func("/LfIQueue/threaded", test_LfIQueue_threaded);
+	g_test_add_func("/LfPriorityQueue/basic", test_LfPriorityQueue_basic);
+	g_test_add_func("/LfPriorityQueue/threaded",
+	                test_LfPriorityQueue_threaded);
+	g_test_add_func("/LfShardedQueue/basic", test_LfShardedQueue_basic);
+	g_test_add_func("/LfShardedQueue/threaded_lane_order",
+	                test_LfShardedQueue_threaded_lane_order);
 
 	return g_test_run();
 }